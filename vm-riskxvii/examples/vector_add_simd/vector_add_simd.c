@@ -0,0 +1,29 @@
+#include "../xsimd.h"
+
+int volatile *const ConsoleWriteSInt = (int *)0x0804;
+
+void prints(char *str){
+    while(*str) *((char *)0x0800) = *(str++);
+}
+
+int a[16];
+int b[16];
+int c[16];
+
+int main(){
+    for(int i = 0; i < 16; i++){
+        a[i] = i;
+        b[i] = 100 * i;
+    }
+
+    // One instruction for the whole loop of lw, lw, add, sw
+    vadd_w(c, a, b, 16);
+
+    prints("c[15] = ");
+    *ConsoleWriteSInt = c[15];
+    prints("\na . b = ");
+    *ConsoleWriteSInt = vdot_w(a, b, 16);
+    prints("\n");
+
+    return 0;
+}
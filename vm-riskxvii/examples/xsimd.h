@@ -0,0 +1,55 @@
+// Custom packed and vector instructions of vm_riskxvii, run images that use them with --isa=rv32im_xsimd.
+// .insn encodes them, so the stock assembler needs no patches.
+#ifndef XSIMD_H
+#define XSIMD_H
+
+// Packed lanes in a register, in custom-0: func3 picks the operation, func7 the lane width
+#define XSIMD_PACKED(name, func3, func7)                                                        \
+    static inline unsigned int name(unsigned int a, unsigned int b) {                           \
+        unsigned int result;                                                                    \
+        asm volatile(".insn r 0x0B, " #func3 ", " #func7 ", %[res], %[a], %[b]"                 \
+            : [res]"=r"(result)                                                                 \
+            : [a]"r"(a), [b]"r"(b));                                                            \
+        return result;                                                                          \
+    }
+
+XSIMD_PACKED(add8, 0, 0)
+XSIMD_PACKED(sub8, 1, 0)
+XSIMD_PACKED(smin8, 2, 0)
+XSIMD_PACKED(smax8, 3, 0)
+XSIMD_PACKED(umin8, 4, 0)
+XSIMD_PACKED(umax8, 5, 0)
+XSIMD_PACKED(add16, 0, 1)
+XSIMD_PACKED(sub16, 1, 1)
+XSIMD_PACKED(smin16, 2, 1)
+XSIMD_PACKED(smax16, 3, 1)
+XSIMD_PACKED(umin16, 4, 1)
+XSIMD_PACKED(umax16, 5, 1)
+
+// dst[i] = a[i] + b[i] for n words, in custom-1
+static inline void vadd_w(int *dst, const int *a, const int *b, unsigned int n) {
+    asm volatile(".insn r4 0x2B, 0, 0, %[dst], %[a], %[b], %[n]"
+        :
+        : [dst]"r"(dst), [a]"r"(a), [b]"r"(b), [n]"r"(n)
+        : "memory");
+}
+
+// dst[i] = a[i] - b[i] for n words
+static inline void vsub_w(int *dst, const int *a, const int *b, unsigned int n) {
+    asm volatile(".insn r4 0x2B, 1, 0, %[dst], %[a], %[b], %[n]"
+        :
+        : [dst]"r"(dst), [a]"r"(a), [b]"r"(b), [n]"r"(n)
+        : "memory");
+}
+
+// The sum of a[i] * b[i] for n words, modulo 2^32
+static inline int vdot_w(const int *a, const int *b, unsigned int n) {
+    int result;
+    asm volatile(".insn r4 0x2B, 2, 0, %[res], %[a], %[b], %[n]"
+        : [res]"=r"(result)
+        : [a]"r"(a), [b]"r"(b), [n]"r"(n)
+        : "memory");
+    return result;
+}
+
+#endif
@@ -0,0 +1,360 @@
+#define _POSIX_C_SOURCE 200809L  // For sigsetjmp and pthread_rwlock_t
+#include "libriskxvii.h"
+#include "vm_riskxvii.h"
+#include "vm_profile.h"
+#include "vm_cache.h"
+#include "vm_pipeline.h"
+#include "vm_guard.h"
+#include "vm_harts.h"
+#include "vm_image.h"
+#include "vm_input.h"
+#include "vm_shadow.h"
+#include "vm_program.h"
+
+struct vm* vm_create(const unsigned char* image, size_t size) {
+    int sectioned = is_sectioned_image(image, size);
+    int elf = is_elf_image(image, size);
+    if (image == NULL || size == 0 || (!sectioned && !elf && size > VM_IMAGE_SIZE)) {
+        return NULL;
+    }
+
+    struct vm* vm = (struct vm*)calloc(1, sizeof(struct vm));
+    if (vm == NULL) {
+        return NULL;
+    }
+    vm->program = program_create(program_key(image, size));
+    if (vm->program == NULL) {
+        free(vm);
+        return NULL;
+    }
+    if (!sectioned && !elf) {
+        size_t inst_len = size < INST_MEM_SIZE ? size : INST_MEM_SIZE;
+        memcpy(vm->program->inst_mem, image, inst_len);
+        memcpy(vm->memory.data_mem, image + inst_len, size - inst_len);
+    }
+    vm->inst_len = INSTRUCT_BYTES;
+    vm->console.read_char = stdio_read_char;
+    vm->console.read_int = stdio_read_int;
+    vm->console.write = stdio_write;
+    init_heap(vm);
+    reset_vm(vm);
+    // Sections and ELF headers may set the registers and entry pc, so they are loaded over the reset state
+    if ((sectioned && !load_sections(vm, image, size)) || (elf && !load_elf(vm, image, size))) {
+        vm_destroy(vm);
+        return NULL;
+    }
+    vm->entry_pc = vm->pc;
+    memcpy(vm->entry_regs, vm->reg_bank, sizeof(vm->entry_regs));
+    // What vm_reset restores is kept with the instructions, so vms of the same image share it too
+    memcpy(vm->program->data_mem, vm->memory.data_mem, DATA_MEM_SIZE);
+    memcpy(vm->program->heap_banks, vm->heap_banks, sizeof(vm->heap_banks));
+    program_share(vm);
+    vm->status = VM_READY;
+    return vm;
+}
+
+void vm_destroy(struct vm* vm) {
+    if (vm == NULL) {
+        return;
+    }
+    free_heap(vm);
+    profile_free(vm);
+    cache_free(vm);
+    pipeline_free(vm);
+    guard_free(vm);
+    input_free(vm);
+    shadow_free(vm);
+    program_release(vm->program);
+    free_symbols(&vm->symbols);
+    free(vm);
+}
+
+void vm_reset(struct vm* vm) {
+    restore_dirty_pages(vm);
+    // Images hold no allocations, so the allocator starts empty
+    free_heap(vm);
+    init_heap(vm);
+    guard_map_heap(vm);
+    memset(&vm->heap_stats, 0, sizeof(vm->heap_stats));
+    reset_vm(vm);
+    vm->pc = vm->entry_pc;
+    memcpy(vm->reg_bank, vm->entry_regs, sizeof(vm->reg_bank));
+    vm->reserved = 0;
+    input_seek(vm, 0);
+    vm->read_host_clock = 0;
+    if (vm->profile) {
+        vm->profile->stack_num = 0;
+    }
+    vm->status = VM_READY;
+}
+
+int vm_enable_guard(struct vm* vm) {
+    return vm->guard != NULL || guard_start(vm);
+}
+
+int vm_map_input(struct vm* vm, const char* path) {
+    return input_map(vm, path);
+}
+
+int vm_enable_shadow(struct vm* vm, uint64_t interval) {
+    return vm->shadow != NULL || shadow_start(vm, interval);
+}
+
+int vm_set_isa(struct vm* vm, const char* isa) {
+    int extensions = parse_isa(isa);
+    if (extensions < 0) {
+        return 0;
+    }
+    vm->isa_extensions = (uint32_t)extensions;
+    return program_set_isa(vm);
+}
+
+void vm_set_console(struct vm* vm, const struct vm_console* console) {
+    vm->console = *console;
+}
+
+enum vm_status vm_run(struct vm* vm, uint64_t max_instructions) {
+    if (vm->status != VM_READY && vm->status != VM_BUDGET_EXCEEDED) {
+        return vm->status;
+    }
+    vm->status = VM_READY;
+
+    uint64_t limit = vm->instret + max_instructions;
+    struct guard* guard = vm->guard;
+    // Halts and faults in the middle of an instruction come back here through vm_stop
+    if (setjmp(vm->stop)) {
+        guard_leave(vm, guard);
+        return vm->status;
+    }
+    if (guard) {
+        guard_enter(guard);
+        // Accesses that hit the guard page come back here through the SIGSEGV handler
+        if (sigsetjmp(guard->fault, 1)) {
+            guard_retry(vm, guard);
+        }
+    }
+    while (vm->pc < INST_MEM_SIZE) {
+        if (max_instructions && vm->instret >= limit) {
+            vm->status = VM_BUDGET_EXCEEDED;
+            guard_leave(vm, guard);
+            return vm->status;
+        }
+        step_instruct(vm);
+    }
+    vm->status = VM_FINISHED;
+    guard_leave(vm, guard);
+    return vm->status;
+}
+
+enum vm_status vm_run_harts(struct vm* vm, int hart_num, uint64_t max_instructions) {
+    if (vm->status != VM_READY && vm->status != VM_BUDGET_EXCEEDED) {
+        return vm->status;
+    }
+    int started = hart_num > 1 ? harts_start(vm, hart_num, max_instructions) : 0;
+    if (started == 0) {
+        return vm_run(vm, max_instructions);
+    }
+    hart_run(vm);
+    harts_finish(vm, started);
+    return vm->status;
+}
+
+enum vm_status vm_run_shadow(struct vm* vm, uint64_t max_instructions) {
+    if (vm->shadow == NULL) {
+        return vm_run(vm, max_instructions);
+    }
+    return shadow_run(vm, max_instructions);
+}
+
+enum vm_status vm_step(struct vm* vm) {
+    if (vm->status != VM_READY && vm->status != VM_BUDGET_EXCEEDED) {
+        return vm->status;
+    }
+    vm->status = VM_READY;
+
+    struct guard* guard = vm->guard;
+    if (setjmp(vm->stop)) {
+        guard_leave(vm, guard);
+        return vm->status;
+    }
+    if (guard) {
+        guard_enter(guard);
+        if (sigsetjmp(guard->fault, 1)) {
+            // The retried instruction is the step
+            guard_retry(vm, guard);
+            guard_leave(vm, guard);
+            if (vm->pc >= INST_MEM_SIZE) {
+                vm->status = VM_FINISHED;
+            }
+            return vm->status;
+        }
+    }
+    if (vm->pc < INST_MEM_SIZE) {
+        step_instruct(vm);
+    }
+    guard_leave(vm, guard);
+    if (vm->pc >= INST_MEM_SIZE) {
+        vm->status = VM_FINISHED;
+    }
+    return vm->status;
+}
+
+enum vm_status vm_get_status(const struct vm* vm) {
+    return vm->status;
+}
+
+const char* vm_status_name(enum vm_status status) {
+    switch (status) {
+        case VM_READY:
+            return "ready";
+        case VM_FINISHED:
+            return "finished";
+        case VM_HALTED:
+            return "halted";
+        case VM_ILLEGAL_OPERATION:
+            return "illegal operation";
+        case VM_NOT_IMPLEMENTED:
+            return "not implemented";
+        case VM_BUDGET_EXCEEDED:
+            return "instruction budget exceeded";
+        case VM_INPUT_ERROR:
+            return "input error";
+        case VM_DIVERGED:
+            return "diverged from its shadow";
+    }
+    return "unknown";
+}
+
+int vm_exit_code(enum vm_status status) {
+    return (status == VM_FINISHED || status == VM_HALTED) ? 0 : 1;
+}
+
+uint32_t vm_get_pc(const struct vm* vm) {
+    return vm->pc;
+}
+
+void vm_set_pc(struct vm* vm, uint32_t pc) {
+    vm->pc = pc;
+}
+
+uint32_t vm_get_reg(const struct vm* vm, int reg) {
+    if (reg < 0 || reg >= REG_NUM) {
+        return 0;
+    }
+    return vm->reg_bank[reg];
+}
+
+void vm_set_reg(struct vm* vm, int reg, uint32_t value) {
+    if (reg > 0 && reg < REG_NUM) {
+        vm->reg_bank[reg] = value;
+    }
+}
+
+uint64_t vm_get_instret(const struct vm* vm) {
+    return vm->instret;
+}
+
+unsigned char* guest_byte(struct vm* vm, uint32_t address) {
+    if (address <= INST_MEM_END) {
+        return &vm->program->inst_mem[address];
+    } else if (address >= DATA_MEM_START && address <= DATA_MEM_END) {
+        return &vm->memory.data_mem[address - DATA_MEM_START];
+    } else if (address >= HEAP_START && address < HEAP_END) {
+        return &vm->heap_banks[address - HEAP_START];
+    }
+    return NULL;
+}
+
+int dirty_page_index(uint32_t address) {
+    if (address <= INST_MEM_END) {
+        return INST_PAGE_FIRST + address / DIRTY_PAGE_SIZE;
+    } else if (address >= DATA_MEM_START && address <= DATA_MEM_END) {
+        return DATA_PAGE_FIRST + (address - DATA_MEM_START) / DIRTY_PAGE_SIZE;
+    } else if (address >= HEAP_START && address < HEAP_END) {
+        return HEAP_PAGE_FIRST + (address - HEAP_START) / DIRTY_PAGE_SIZE;
+    }
+    return -1;
+}
+
+uint32_t dirty_page_address(int page) {
+    if (page >= INST_PAGE_FIRST) {
+        return (uint32_t)(page - INST_PAGE_FIRST) * DIRTY_PAGE_SIZE;
+    } else if (page >= HEAP_PAGE_FIRST) {
+        return HEAP_START + (uint32_t)(page - HEAP_PAGE_FIRST) * DIRTY_PAGE_SIZE;
+    }
+    return DATA_MEM_START + (uint32_t)(page - DATA_PAGE_FIRST) * DIRTY_PAGE_SIZE;
+}
+
+void mark_dirty(struct vm* vm, uint32_t address) {
+    int page = dirty_page_index(address);
+    if (page < 0 || vm->pages.is_dirty[page]) {
+        return;
+    }
+    vm->pages.is_dirty[page] = 1;
+    vm->pages.dirty_list[vm->pages.dirty_num++] = (uint16_t)page;
+}
+
+void mark_dirty_range(struct vm* vm, uint32_t address, uint32_t len) {
+    if (len == 0) {
+        return;
+    }
+    uint32_t last = address + len - 1;
+    for (uint32_t page = address & ~(uint32_t)(DIRTY_PAGE_SIZE - 1); page <= last; page += DIRTY_PAGE_SIZE) {
+        mark_dirty(vm, page);
+    }
+}
+
+void restore_dirty_pages(struct vm* vm) {
+    int code_restored = 0;
+    for (int i = 0; i < vm->pages.dirty_num; i++) {
+        int page = vm->pages.dirty_list[i];
+        uint32_t address = dirty_page_address(page);
+        if (page >= INST_PAGE_FIRST) {
+            code_restored = 1;
+        } else if (page >= HEAP_PAGE_FIRST) {
+            memcpy(guest_byte(vm, address), &vm->program->heap_banks[address - HEAP_START], DIRTY_PAGE_SIZE);
+        } else {
+            memcpy(guest_byte(vm, address), &vm->program->data_mem[address - DATA_MEM_START], DIRTY_PAGE_SIZE);
+        }
+        vm->pages.is_dirty[page] = 0;
+    }
+    vm->pages.dirty_num = 0;
+    // The host wrote instructions into a private copy, the shared program still holds them as loaded
+    if (code_restored) {
+        program_revert(vm);
+    }
+}
+
+int vm_read_memory(const struct vm* vm, uint32_t address, void* buffer, size_t len) {
+    // Check the whole range first so a failed read copies nothing
+    for (size_t i = 0; i < len; i++) {
+        if (!guest_byte((struct vm*)vm, address + (uint32_t)i)) {
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < len; i++) {
+        ((unsigned char*)buffer)[i] = *guest_byte((struct vm*)vm, address + (uint32_t)i);
+    }
+    return 1;
+}
+
+int vm_write_memory(struct vm* vm, uint32_t address, const void* buffer, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!guest_byte(vm, address + (uint32_t)i)) {
+            return 0;
+        }
+    }
+    // Other vms may share the instructions, so they are written in a private copy
+    if (address <= INST_MEM_END && !program_unshare(vm)) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        mark_dirty(vm, address + (uint32_t)i);
+        *guest_byte(vm, address + (uint32_t)i) = ((const unsigned char*)buffer)[i];
+    }
+    // Rewritten instructions must be decoded again
+    if (address <= INST_MEM_END) {
+        memset(vm->program->decode_cache, 0, sizeof(vm->program->decode_cache));
+    }
+    return 1;
+}
@@ -0,0 +1,211 @@
+#ifndef LIBRISKXVII_H
+#define LIBRISKXVII_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VM_IMAGE_SIZE 2048  // Legacy image size, instruction memory followed by data memory
+
+struct vm;  // A virtual machine instance, every instance is independent of the others
+
+enum vm_status {
+    VM_READY,              // Created or stepped, and able to run further
+    VM_FINISHED,           // pc ran past the end of instruction memory
+    VM_HALTED,             // The guest wrote to the halt routine
+    VM_ILLEGAL_OPERATION,  // The guest accessed an invalid address, the register dump has been written
+    VM_NOT_IMPLEMENTED,    // The guest executed an unknown instruction, the register dump has been written
+    VM_BUDGET_EXCEEDED,    // vm_run executed its maximum number of instructions
+    VM_INPUT_ERROR,        // The console could not read an integer
+    VM_DIVERGED            // A shadowed vm no longer matched its reference, the report has been written
+};  // The outcome of running a vm
+
+struct vm_console {
+    int (*read_char)(void* context);                  // Returns the next character, or -1 at the end of input
+    int (*read_int)(void* context, int32_t* value);   // Returns 1 if an integer was read, otherwise 0
+    void (*write)(void* context, const char* data, size_t len);
+    void* context;  // Passed to every callback
+};  // Where the guest console reads and writes go
+
+/**
+ * Create a vm from a memory image, registers, pc and heap are reset unless the image sets them
+ * @param image The image bytes, either a legacy image of instruction memory then data memory, a sectioned image
+ *        or a riscv32 ELF executable
+ * @param size The image size, shorter legacy images are zero filled
+ * @return struct vm* The vm, or NULL if the image is empty, a legacy image is larger than VM_IMAGE_SIZE
+ *         or a sectioned or ELF image fails its checks
+*/
+struct vm* vm_create(const unsigned char* image, size_t size);
+
+/**
+ * Free a vm and everything it owns
+ * @param vm The vm
+*/
+void vm_destroy(struct vm* vm);
+
+/**
+ * Put a vm back in the state vm_create left it in, keeping its ISA, console and attached tools,
+ * the cost grows with the memory the previous run wrote rather than with the memory size
+ * @param vm The vm
+*/
+void vm_reset(struct vm* vm);
+
+/**
+ * Check guest loads and stores with the host MMU instead of in software. Illegal addresses land in a
+ * PROT_NONE guard page, and a SIGSEGV handler turns the fault into the usual illegal operation.
+ * Install no other SIGSEGV handler afterwards
+ * @param vm The vm
+ * @return int 1 if successful, 0 if the host could not reserve the guard page or install the handler
+*/
+int vm_enable_guard(struct vm* vm);
+
+/**
+ * Map a host file read only at guest address 0x10000000, where the guest reads it with plain loads
+ * and finds its length and a cursor through virtual routines 0x0860 to 0x0868
+ * @param vm The vm
+ * @param path The file
+ * @return int 1 if successful, 0 if the file could not be mapped or does not fit the window
+*/
+int vm_map_input(struct vm* vm, const char* path);
+
+/**
+ * Enable ISA extensions for a vm
+ * @param vm The vm
+ * @param isa An ISA string such as rv32i or rv32imc
+ * @return int 1 if the string is supported, otherwise 0, or if the program could not be decoded for it
+*/
+int vm_set_isa(struct vm* vm, const char* isa);
+
+/**
+ * Replace the console callbacks of a vm, stdin and stdout are used by default
+ * @param vm The vm
+ * @param console The callbacks, copied into the vm
+*/
+void vm_set_console(struct vm* vm, const struct vm_console* console);
+
+/**
+ * Run a vm until it stops or has executed a number of instructions
+ * @param vm The vm
+ * @param max_instructions The instruction budget, 0 for no limit
+ * @return enum vm_status VM_BUDGET_EXCEEDED if the budget ran out, otherwise why the vm stopped
+*/
+enum vm_status vm_run(struct vm* vm, uint64_t max_instructions);
+
+/**
+ * Run a vm on several harts until hart 0 stops or any hart faults. Each hart runs on its own host thread
+ * with its own pc and registers, starting where the vm is, and shares data memory, the heap and the console.
+ * Another hart that halts or runs past the end of memory only ends itself. Guard pages are given up, and
+ * the profiler, cache simulator and pipeline model watch hart 0 alone
+ * @param vm The vm, hart 0, which takes the registers of the hart that stopped the machine
+ * @param hart_num The number of harts, 1 runs the vm as vm_run does
+ * @param max_instructions The instruction budget of each hart, 0 for no limit
+ * @return enum vm_status Why the machine stopped
+*/
+enum vm_status vm_run_harts(struct vm* vm, int hart_num, uint64_t max_instructions);
+
+/**
+ * Check a vm against a reference copy of it, stepped one instruction at a time through execute_instruct
+ * with software access checks and fed the same console input. pc, registers, data memory, the heap and
+ * console output are compared every interval instructions. Called before the vm runs, once its ISA,
+ * input file, guard and console are set
+ * @param vm The vm
+ * @param interval Instructions between comparisons
+ * @return int 1 if successful, 0 if the reference could not be allocated
+*/
+int vm_enable_shadow(struct vm* vm, uint64_t interval);
+
+/**
+ * Run a vm like vm_run, and if it is shadowed, compare it with its reference as it goes. When they differ
+ * both are run again on the recorded input to the first instruction they differ after, which is reported
+ * on stderr with the registers, memory words and output that differ
+ * @param vm The vm
+ * @param max_instructions The instruction budget, 0 for no limit
+ * @return enum vm_status As for vm_run, or VM_DIVERGED
+*/
+enum vm_status vm_run_shadow(struct vm* vm, uint64_t max_instructions);
+
+/**
+ * Execute a single instruction
+ * @param vm The vm
+ * @return enum vm_status VM_READY if the vm can continue, otherwise why it stopped
+*/
+enum vm_status vm_step(struct vm* vm);
+
+/**
+ * Get why a vm last stopped
+ * @param vm The vm
+ * @return enum vm_status The status
+*/
+enum vm_status vm_get_status(const struct vm* vm);
+
+/**
+ * Get a short description of a status, e.g. "halted"
+ * @param status The status
+ * @return const char* The description
+*/
+const char* vm_status_name(enum vm_status status);
+
+/**
+ * Get the process exit code the command line vm uses for a status, 0 for finished and halted, otherwise 1
+ * @param status The status
+ * @return int The exit code
+*/
+int vm_exit_code(enum vm_status status);
+
+/**
+ * Get the program counter
+ * @param vm The vm
+ * @return uint32_t The program counter
+*/
+uint32_t vm_get_pc(const struct vm* vm);
+
+/**
+ * Set the program counter
+ * @param vm The vm
+ * @param pc The new program counter
+*/
+void vm_set_pc(struct vm* vm, uint32_t pc);
+
+/**
+ * Get a register
+ * @param vm The vm
+ * @param reg The register number, 0 to 31
+ * @return uint32_t The register value, 0 for an invalid register
+*/
+uint32_t vm_get_reg(const struct vm* vm, int reg);
+
+/**
+ * Set a register, writes to x0 and invalid registers are ignored
+ * @param vm The vm
+ * @param reg The register number, 0 to 31
+ * @param value The new value
+*/
+void vm_set_reg(struct vm* vm, int reg, uint32_t value);
+
+/**
+ * Get the number of retired instructions
+ * @param vm The vm
+ * @return uint64_t The count since the vm was created
+*/
+uint64_t vm_get_instret(const struct vm* vm);
+
+/**
+ * Copy bytes out of instruction, data or heap memory, without running virtual routines
+ * @param vm The vm
+ * @param address The guest address of the first byte
+ * @param buffer Where the bytes are copied
+ * @param len The number of bytes
+ * @return int 1 if the whole range is backed by memory, otherwise 0 and nothing is copied
+*/
+int vm_read_memory(const struct vm* vm, uint32_t address, void* buffer, size_t len);
+
+/**
+ * Copy bytes into instruction, data or heap memory, without running virtual routines
+ * @param vm The vm
+ * @param address The guest address of the first byte
+ * @param buffer The bytes to copy
+ * @param len The number of bytes
+ * @return int 1 if the whole range is backed by memory, otherwise 0 and nothing is copied
+*/
+int vm_write_memory(struct vm* vm, uint32_t address, const void* buffer, size_t len);
+
+#endif
@@ -0,0 +1,395 @@
+#include "vm_aot.h"
+
+unsigned char is_leader[INST_MEM_SIZE];   // Addresses starting a basic block
+unsigned char is_visited[INST_MEM_SIZE];  // Addresses already reached by the control flow walk
+
+int main(int argc, char* argv[]) {
+    const char* image = NULL;
+    const char* output = NULL;
+    const char* isa = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--isa=", 6) == 0) {
+            isa = argv[i] + 6;
+            if (parse_isa(isa) < 0) {
+                printf("Unsupported ISA: %s\n", isa);
+                exit(1);
+            }
+        } else if (image == NULL) {
+            image = argv[i];
+        } else {
+            output = argv[i];
+        }
+    }
+    if (image == NULL) {
+        printf("Usage: %s [--isa=rv32i[m][a][c][_xsimd]] <memory_image_binary> [output.c]\n", argv[0]);
+        exit(1);
+    }
+
+    size_t image_size;
+    unsigned char* image_bytes = read_memory_image(image, &image_size);
+    if (image_bytes == NULL) {
+        perror("Error reading image");
+        exit(1);
+    }
+    // The vm is only used to decode, the image is never run here
+    struct vm* vm = vm_create(image_bytes, image_size);
+    if (vm == NULL) {
+        printf("Invalid memory image: %s\n", image);
+        exit(1);
+    }
+    if (isa) {
+        vm_set_isa(vm, isa);
+    }
+
+    FILE* out = stdout;
+    if (output != NULL) {
+        out = fopen(output, "w");
+        if (out == NULL) {
+            perror("Error opening output");
+            exit(1);
+        }
+    }
+
+    find_blocks(vm);
+    emit_program(out, vm, image_bytes, image_size);
+    free(image_bytes);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    vm_destroy(vm);
+    return 0;
+}
+
+union instruction decode_at(struct vm* vm, uint32_t address, uint32_t* length) {
+    // Reuse the interpreter fetch so compressed instructions expand the same way
+    vm->pc = address;
+    union instruction instruct = fetch_instruct(vm);
+    *length = vm->inst_len;
+    return instruct;
+}
+
+enum Translation classify_instruct(struct vm* vm, union instruction instruct) {
+    switch (decode_instruct(vm->isa_extensions, instruct)->format) {
+        case FORMAT_R:
+        case FORMAT_I:
+        case FORMAT_LOAD:
+        case FORMAT_S:
+        case FORMAT_U:
+            return AOT_LINEAR;
+        case FORMAT_JALR:
+            return AOT_JALR;
+        case FORMAT_SB:
+            return AOT_BRANCH;
+        case FORMAT_UJ:
+            return AOT_JAL;
+        default:
+            return AOT_FALLBACK;
+    }
+}
+
+uint32_t branch_offset(union instruction instruct) {
+    return decode_operands(instruct, FORMAT_SB).imm;
+}
+
+uint32_t jump_offset(union instruction instruct) {
+    return decode_operands(instruct, FORMAT_UJ).imm;
+}
+
+void find_blocks(struct vm* vm) {
+    uint32_t worklist[INST_MEM_SIZE + 1];
+    int pending = 0;
+    worklist[pending++] = 0;
+    is_leader[0] = 1;
+    // Sectioned images may start elsewhere
+    if (vm->pc < INST_MEM_SIZE && vm->pc != 0) {
+        worklist[pending++] = vm->pc;
+        is_leader[vm->pc] = 1;
+    }
+
+    while (pending > 0) {
+        uint32_t address = worklist[--pending];
+        // Walk straight line code until the block ends
+        while (address < INST_MEM_SIZE && !is_visited[address]) {
+            is_visited[address] = 1;
+            uint32_t length;
+            union instruction instruct = decode_at(vm, address, &length);
+            uint32_t next = address + length;
+            uint32_t targets[2];
+            int target_num = 0;
+
+            switch (classify_instruct(vm, instruct)) {
+                case AOT_LINEAR:
+                    address = next;
+                    continue;
+                case AOT_BRANCH:
+                    targets[target_num++] = address + branch_offset(instruct);
+                    targets[target_num++] = next;
+                    break;
+                case AOT_JAL:
+                    targets[target_num++] = address + jump_offset(instruct);
+                    // The return address is reached again through a jalr
+                    if (instruct.UJ_type.rd != 0) {
+                        targets[target_num++] = next;
+                    }
+                    break;
+                case AOT_JALR:
+                    if (instruct.I_type.rd != 0) {
+                        targets[target_num++] = next;
+                    }
+                    break;
+                case AOT_FALLBACK:
+                    targets[target_num++] = next;
+                    break;
+            }
+
+            for (int i = 0; i < target_num; i++) {
+                if (targets[i] < INST_MEM_SIZE && !is_leader[targets[i]]) {
+                    is_leader[targets[i]] = 1;
+                    worklist[pending++] = targets[i];
+                }
+            }
+            break;
+        }
+    }
+}
+
+void emit_instret(FILE* out, uint32_t* pending) {
+    if (*pending > 0) {
+        fprintf(out, "    vm->instret += %u;\n", *pending);
+        *pending = 0;
+    }
+}
+
+void emit_step(FILE* out, uint32_t address, uint32_t* pending) {
+    emit_instret(out, pending);
+    fprintf(out, "    vm->pc = 0x%03x;\n    step_instruct(vm);\n", address);
+}
+
+void emit_instruct(FILE* out, uint32_t address, union instruction instruct, uint32_t length, uint32_t* pending) {
+    uint8_t rd = instruct.R_type.rd;
+    uint8_t func3 = instruct.R_type.func3;
+    uint8_t rs1 = instruct.R_type.rs1;
+    uint8_t rs2 = instruct.R_type.rs2;
+    uint8_t func7 = instruct.R_type.func7;
+    uint32_t imm = instruct.I_type.imm;
+    if (imm & 0x800) {
+        imm |= 0xFFFFF000;
+    }
+
+    switch ((enum Opcode)(instruct.raw_instruct & 0x7F)) {
+        case R_TYPE: {
+            if (func7 == 0b0000001) {
+                // The pc the handler moves on is not used, blocks return their successor
+                fprintf(out, "    execute_instruct(vm, (union instruction){.raw_instruct = 0x%08xu});\n",
+                        instruct.raw_instruct);
+                break;
+            }
+            if (rd == 0) {
+                break;  // No side effects besides the discarded result
+            }
+            // Same expressions as INSTRUCTION_TABLE, indexed by func3
+            const char* ops[8] = {"vm->reg_bank[%u] + vm->reg_bank[%u]", "vm->reg_bank[%u] << vm->reg_bank[%u]",
+                                  "((int32_t)vm->reg_bank[%u] < (int32_t)vm->reg_bank[%u]) ? 1 : 0",
+                                  "(vm->reg_bank[%u] < vm->reg_bank[%u]) ? 1 : 0", "vm->reg_bank[%u] ^ vm->reg_bank[%u]",
+                                  "vm->reg_bank[%u] >> vm->reg_bank[%u]", "vm->reg_bank[%u] | vm->reg_bank[%u]",
+                                  "vm->reg_bank[%u] & vm->reg_bank[%u]"};
+            fprintf(out, "    vm->reg_bank[%u] = ", rd);
+            if (func7 == 0b0100000 && func3 == 0b000) {
+                fprintf(out, "vm->reg_bank[%u] - vm->reg_bank[%u]", rs1, rs2);
+            } else if (func7 == 0b0100000) {
+                // sra rotates right, matching the interpreter
+                fprintf(out, "(vm->reg_bank[%u] >> (vm->reg_bank[%u] %% WORD_BITS)) | "
+                             "(vm->reg_bank[%u] << (WORD_BITS - vm->reg_bank[%u] %% WORD_BITS))", rs1, rs2, rs1, rs2);
+            } else {
+                fprintf(out, ops[func3], rs1, rs2);
+            }
+            fprintf(out, ";\n");
+            break;
+        }
+
+        case I_TYPE_ONE: {
+            // Indexed by func3, shifts are not part of the ISA
+            const char* ops[8] = {"vm->reg_bank[%u] + 0x%08xu", NULL, "((int32_t)vm->reg_bank[%u] < (int32_t)0x%08xu) ? 1 : 0",
+                                  "(vm->reg_bank[%u] < 0x%08xu) ? 1 : 0", "vm->reg_bank[%u] ^ 0x%08xu", NULL,
+                                  "vm->reg_bank[%u] | 0x%08xu", "vm->reg_bank[%u] & 0x%08xu"};
+            if (ops[func3] == NULL) {
+                emit_step(out, address, pending);
+                return;
+            }
+            if (rd == 0) {
+                break;
+            }
+            fprintf(out, "    vm->reg_bank[%u] = ", rd);
+            fprintf(out, ops[func3], rs1, imm);
+            fprintf(out, ";\n");
+            break;
+        }
+
+        case I_TYPE_TWO: {
+            // Indexed by func3, casts as in INSTRUCTION_TABLE
+            const char* loads[8] = {"(uint32_t)(int32_t)(int8_t)load_byte", "(uint32_t)(int32_t)(int16_t)load_half_word",
+                                    "load_word", NULL, "(uint32_t)load_byte", "(uint32_t)load_half_word", NULL, NULL};
+            if (loads[func3] == NULL) {
+                emit_step(out, address, pending);
+                return;
+            }
+            emit_instret(out, pending);
+            fprintf(out, "    vm->pc = 0x%03x;\n", address);
+            if (rd == 0) {
+                fprintf(out, "    (void)");
+            } else {
+                fprintf(out, "    vm->reg_bank[%u] = ", rd);
+            }
+            fprintf(out, "%s(vm, vm->reg_bank[%u] + 0x%08xu, (union instruction){.raw_instruct = 0x%08xu});\n",
+                    loads[func3], rs1, imm, instruct.raw_instruct);
+            *pending = 1;
+            return;
+        }
+
+        case S_TYPE: {
+            const char* stores[3] = {"store_byte", "store_half_word", "store_word"};
+            const char* casts[3] = {"(uint8_t)", "(uint16_t)", ""};
+            uint32_t offset = (instruct.S_type.imm11_5 << 5) | instruct.S_type.imm4_0;
+            if (offset & 0x800) {
+                offset |= 0xFFFFF000;
+            }
+            emit_instret(out, pending);
+            fprintf(out, "    vm->pc = 0x%03x;\n", address);
+            fprintf(out, "    %s(vm, vm->reg_bank[%u] + 0x%08xu, %svm->reg_bank[%u], "
+                         "(union instruction){.raw_instruct = 0x%08xu});\n",
+                    stores[func3], rs1, offset, casts[func3], rs2, instruct.raw_instruct);
+            *pending = 1;
+            return;
+        }
+
+        case CUSTOM_0:
+            // Packed lanes run the interpreter's SIMD kernels, pc is not used as for the M extension
+            fprintf(out, "    execute_instruct(vm, (union instruction){.raw_instruct = 0x%08xu});\n",
+                    instruct.raw_instruct);
+            break;
+
+        case U_TYPE:
+            if (rd != 0) {
+                fprintf(out, "    vm->reg_bank[%u] = 0x%08xu;\n", rd, instruct.U_type.imm31_12 << 12);
+            }
+            break;
+
+        case SB_TYPE: {
+            // Indexed by func3, conditions as in INSTRUCTION_TABLE
+            const char* conditions[8] = {"vm->reg_bank[%u] == vm->reg_bank[%u]", "vm->reg_bank[%u] != vm->reg_bank[%u]", NULL, NULL,
+                                         "(int32_t)vm->reg_bank[%u] < (int32_t)vm->reg_bank[%u]",
+                                         "(int32_t)vm->reg_bank[%u] >= (int32_t)vm->reg_bank[%u]",
+                                         "vm->reg_bank[%u] < vm->reg_bank[%u]", "vm->reg_bank[%u] >= vm->reg_bank[%u]"};
+            if (conditions[func3] == NULL) {
+                emit_step(out, address, pending);
+                fprintf(out, "    return vm->pc;\n");
+                return;
+            }
+            *pending += 1;
+            emit_instret(out, pending);
+            fprintf(out, "    if (");
+            fprintf(out, conditions[func3], rs1, rs2);
+            fprintf(out, ") {\n        return 0x%03xu;\n    }\n", address + branch_offset(instruct));
+            fprintf(out, "    return 0x%03xu;\n", address + length);
+            return;
+        }
+
+        case UJ_TYPE:
+            *pending += 1;
+            emit_instret(out, pending);
+            if (rd != 0) {
+                fprintf(out, "    vm->reg_bank[%u] = 0x%03xu;\n", rd, address + length);
+            }
+            fprintf(out, "    return 0x%03xu;\n", address + jump_offset(instruct));
+            return;
+
+        case I_TYPE_THREE:
+            // The link is written before rs1 is read, exactly as the interpreter's jalr does
+            *pending += 1;
+            emit_instret(out, pending);
+            fprintf(out, "    vm->reg_bank[%u] = 0x%03xu;\n", rd, address + length);
+            fprintf(out, "    uint32_t target = vm->reg_bank[%u] + 0x%08xu;\n", rs1, imm);
+            fprintf(out, "    vm->reg_bank[0] = 0;\n");
+            fprintf(out, "    return target;\n");
+            return;
+
+        default:
+            break;
+    }
+    *pending += 1;
+}
+
+void emit_block(FILE* out, uint32_t leader, struct vm* vm) {
+    fprintf(out, "uint32_t block_%03x(struct vm* vm) {\n", leader);
+    uint32_t pending = 0;  // Instructions retired since instret was last updated
+    uint32_t address = leader;
+
+    while (address < INST_MEM_SIZE) {
+        uint32_t length;
+        union instruction instruct = decode_at(vm, address, &length);
+        enum Translation kind = classify_instruct(vm, instruct);
+
+        if (kind == AOT_FALLBACK) {
+            // Let the interpreter execute it, it either faults or moves pc on
+            emit_instret(out, &pending);
+            fprintf(out, "    vm->pc = 0x%03x;\n    vm->inst_len = %u;\n", address, length);
+            fprintf(out, "    execute_instruct(vm, (union instruction){.raw_instruct = 0x%08xu});\n",
+                    instruct.raw_instruct);
+            fprintf(out, "    vm->instret++;\n    return vm->pc;\n}\n\n");
+            return;
+        }
+
+        emit_instruct(out, address, instruct, length, &pending);
+        if (kind != AOT_LINEAR) {
+            fprintf(out, "}\n\n");
+            return;
+        }
+
+        address += length;
+        if (address < INST_MEM_SIZE && is_leader[address]) {
+            break;  // Fall through into the next block
+        }
+    }
+
+    emit_instret(out, &pending);
+    fprintf(out, "    return 0x%03xu;\n}\n\n", address);
+}
+
+void emit_program(FILE* out, struct vm* vm, const unsigned char* image, size_t size) {
+    fprintf(out, "// Translated by vm_riskxvii_aot, do not edit\n");
+    fprintf(out, "#include \"vm_riskxvii.h\"\n\n");
+
+    // The image is embedded so the executable needs no input file
+    fprintf(out, "const unsigned char image[%zu] = {", size);
+    for (size_t i = 0; i < size; i++) {
+        fprintf(out, "%s0x%02x,", (i % 16 == 0) ? "\n    " : " ", image[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    for (uint32_t leader = 0; leader < INST_MEM_SIZE; leader++) {
+        if (is_leader[leader]) {
+            emit_block(out, leader, vm);
+        }
+    }
+
+    fprintf(out, "int main() {\n");
+    fprintf(out, "    struct vm* vm = vm_create(image, sizeof(image));\n");
+    fprintf(out, "    vm->isa_extensions = 0x%x;\n\n", vm->isa_extensions);
+    // Halts and faults in the interpreter helpers return here through vm_stop
+    fprintf(out, "    if (setjmp(vm->stop) == 0) {\n");
+    fprintf(out, "        while (vm->pc < INST_MEM_SIZE) {\n            switch (vm->pc) {\n");
+    for (uint32_t leader = 0; leader < INST_MEM_SIZE; leader++) {
+        if (is_leader[leader]) {
+            fprintf(out, "                case 0x%03x:\n                    vm->pc = block_%03x(vm);\n"
+                         "                    break;\n", leader, leader);
+        }
+    }
+    // Targets of computed jumps that were not found statically
+    fprintf(out, "                default:\n");
+    fprintf(out, "                    step_instruct(vm);\n                    break;\n");
+    fprintf(out, "            }\n        }\n        vm->status = VM_FINISHED;\n    }\n\n");
+    fprintf(out, "    enum vm_status status = vm->status;\n");
+    fprintf(out, "    if (status == VM_INPUT_ERROR) {\n        perror(\"Error scanf\");\n    }\n");
+    fprintf(out, "    vm_destroy(vm);\n    return vm_exit_code(status);\n}\n");
+}
@@ -0,0 +1,95 @@
+#ifndef VM_AOT_H
+#define VM_AOT_H
+
+#include "vm_riskxvii.h"
+#include "vm_decode.h"
+
+enum Translation {
+    AOT_LINEAR,    // Translated inline, continues with the next instruction
+    AOT_BRANCH,    // Conditional branch, ends the block
+    AOT_JAL,       // Direct jump, ends the block
+    AOT_JALR,      // Indirect jump, ends the block and goes through the dispatch switch
+    AOT_FALLBACK   // Executed by the interpreter, ends the block
+};  // How an instruction is translated
+
+/**
+ * Decode the instruction at the specified address of the image
+ * @param vm The vm holding the image
+ * @param address The instruction address
+ * @param length Set to the instruction length in bytes
+ * @return union instruction The instruction, expanded if it was compressed
+*/
+union instruction decode_at(struct vm* vm, uint32_t address, uint32_t* length);
+
+/**
+ * Classify how an instruction is translated
+ * @param vm The vm holding the image, for its enabled extensions
+ * @param instruct The instruction
+ * @return enum Translation The translation kind
+*/
+enum Translation classify_instruct(struct vm* vm, union instruction instruct);
+
+/**
+ * Get the target offset of a SB type instruction, as decode_operands computes it
+ * @param instruct The branch instruction
+ * @return uint32_t The offset from the branch address
+*/
+uint32_t branch_offset(union instruction instruct);
+
+/**
+ * Get the target offset of a UJ type instruction, as decode_operands computes it
+ * @param instruct The jal instruction
+ * @return uint32_t The offset from the jal address
+*/
+uint32_t jump_offset(union instruction instruct);
+
+/**
+ * Mark block leaders by following the control flow from the entry pc, including return addresses
+ * @param vm The vm holding the image
+*/
+void find_blocks(struct vm* vm);
+
+/**
+ * Write the pending instret update before an instruction that can observe it
+ * @param out The output file
+ * @param pending Retired instructions not yet added to instret, reset to 0
+*/
+void emit_instret(FILE* out, uint32_t* pending);
+
+/**
+ * Write a call to the interpreter for an instruction the translation tables do not cover, it faults or moves pc
+ * on and counts itself as the interpreter does
+ * @param out The output file
+ * @param address The instruction address
+ * @param pending Retired instructions not yet added to instret, reset to 0
+*/
+void emit_step(FILE* out, uint32_t address, uint32_t* pending);
+
+/**
+ * Write the C translation of one instruction
+ * @param out The output file
+ * @param address The instruction address
+ * @param instruct The instruction
+ * @param length The instruction length in bytes
+ * @param pending Retired instructions not yet added to instret, updated after the instruction
+*/
+void emit_instruct(FILE* out, uint32_t address, union instruction instruct, uint32_t length, uint32_t* pending);
+
+/**
+ * Write the C function for the basic block starting at the specified leader
+ * @param out The output file
+ * @param leader The address of the first instruction of the block
+ * @param vm The vm holding the image
+*/
+void emit_block(FILE* out, uint32_t leader, struct vm* vm);
+
+/**
+ * Write the whole translated program, the embedded image and the dispatch loop
+ * @param out The output file
+ * @param vm The vm holding the image
+ * @param image The image file bytes, embedded as they are so sectioned images keep their sections
+ * @param size The number of bytes
+*/
+void emit_program(FILE* out, struct vm* vm, const unsigned char* image, size_t size);
+
+#endif
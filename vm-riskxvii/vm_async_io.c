@@ -0,0 +1,252 @@
+#define _POSIX_C_SOURCE 200809L  // For pthread cancellation
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "vm_async_io.h"
+
+void ring_init(struct spsc_ring* ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->head_seen = 0;
+    ring->tail_seen = 0;
+    atomic_init(&ring->closed, 0);
+    atomic_init(&ring->waiting, 0);
+    ring->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? ASYNC_SPIN : 0;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->wake, NULL);
+}
+
+void ring_destroy(struct spsc_ring* ring) {
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->wake);
+}
+
+int ring_ready(struct spsc_ring* ring, int for_data) {
+    size_t used = atomic_load_explicit(&ring->head, memory_order_acquire) -
+                  atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return atomic_load_explicit(&ring->closed, memory_order_acquire) ||
+           (for_data ? used > 0 : used < ASYNC_RING_SIZE);
+}
+
+void unlock_ring(void* ring) {
+    pthread_mutex_unlock(&((struct spsc_ring*)ring)->lock);
+}
+
+void ring_wait(struct spsc_ring* ring, int for_data) {
+    for (int i = 0; i < ring->spin; i++) {
+        if (ring_ready(ring, for_data)) {
+            return;
+        }
+    }
+    pthread_mutex_lock(&ring->lock);
+    pthread_cleanup_push(unlock_ring, ring);  // The reader thread is cancelled while it waits
+    for (;;) {
+        // The other side reads waiting without a fence so its hot path stays cheap, a wake up it
+        // misses only delays this side until the timeout
+        atomic_store(&ring->waiting, 1);
+        if (ring_ready(ring, for_data)) {
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += ASYNC_WAIT_NS;
+        if (deadline.tv_nsec >= NSEC_PER_SEC) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= NSEC_PER_SEC;
+        }
+        pthread_cond_timedwait(&ring->wake, &ring->lock, &deadline);
+    }
+    atomic_store(&ring->waiting, 0);
+    pthread_cleanup_pop(1);
+}
+
+void ring_notify(struct spsc_ring* ring) {
+    if (atomic_load_explicit(&ring->waiting, memory_order_relaxed) && atomic_exchange(&ring->waiting, 0)) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->wake);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+void ring_push(struct spsc_ring* ring, const void* data, size_t len) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (len > 0) {
+        // The consumer's index is only read again when the last view of it leaves no room
+        if (head - ring->tail_seen == ASYNC_RING_SIZE) {
+            ring->tail_seen = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            if (head - ring->tail_seen == ASYNC_RING_SIZE) {
+                ring_wait(ring, 0);
+                continue;
+            }
+        }
+        size_t offset = head & (ASYNC_RING_SIZE - 1);
+        size_t room = ASYNC_RING_SIZE - (head - ring->tail_seen);
+        // Copy up to the end of the array, the rest goes in on the next pass
+        size_t n = len < room ? len : room;
+        if (n > ASYNC_RING_SIZE - offset) {
+            n = ASYNC_RING_SIZE - offset;
+        }
+        memcpy(ring->data + offset, bytes, n);
+        head += n;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+        bytes += n;
+        len -= n;
+    }
+}
+
+int ring_peek(struct spsc_ring* ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    // The producer's index is only read again when the last view of it is used up
+    while (ring->head_seen == tail) {
+        ring->head_seen = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (ring->head_seen != tail) {
+            break;
+        }
+        if (atomic_load_explicit(&ring->closed, memory_order_acquire)) {
+            // Everything produced before the close is visible now
+            ring->head_seen = atomic_load_explicit(&ring->head, memory_order_acquire);
+            if (ring->head_seen == tail) {
+                return -1;
+            }
+            break;
+        }
+        ring_wait(ring, 1);
+    }
+    return ring->data[tail & (ASYNC_RING_SIZE - 1)];
+}
+
+void ring_skip(struct spsc_ring* ring) {
+    atomic_store_explicit(&ring->tail, atomic_load_explicit(&ring->tail, memory_order_relaxed) + 1,
+                          memory_order_release);
+    ring_notify(ring);
+}
+
+void ring_close(struct spsc_ring* ring) {
+    atomic_store_explicit(&ring->closed, 1, memory_order_release);
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_broadcast(&ring->wake);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void* reader_main(void* context) {
+    struct spsc_ring* ring = &((struct async_console*)context)->input;
+    unsigned char chunk[ASYNC_READ_CHUNK];
+    for (;;) {
+        ssize_t got = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        ring_push(ring, chunk, (size_t)got);
+        ring_notify(ring);
+    }
+    ring_close(ring);
+    return NULL;
+}
+
+void* writer_main(void* context) {
+    struct spsc_ring* ring = &((struct async_console*)context)->output;
+    for (;;) {
+        ring_wait(ring, 1);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head == tail) {
+            break;  // Closed and drained
+        }
+        size_t offset = tail & (ASYNC_RING_SIZE - 1);
+        size_t len = head - tail;
+        if (len > ASYNC_RING_SIZE - offset) {
+            len = ASYNC_RING_SIZE - offset;
+        }
+        ssize_t written = write(STDOUT_FILENO, ring->data + offset, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            written = (ssize_t)len;  // Output that cannot be written is dropped, as stdio drops it
+        }
+        atomic_store_explicit(&ring->tail, tail + (size_t)written, memory_order_release);
+        ring_notify(ring);
+    }
+    return NULL;
+}
+
+struct async_console* async_console_start(void) {
+    // The ring indexes are cache line aligned, beyond what calloc promises
+    struct async_console* console =
+        (struct async_console*)aligned_alloc(alignof(struct async_console), sizeof(struct async_console));
+    if (console == NULL) {
+        return NULL;
+    }
+    memset(console, 0, sizeof(struct async_console));
+    ring_init(&console->input);
+    ring_init(&console->output);
+    fflush(stdout);
+    if (pthread_create(&console->writer, NULL, writer_main, console) != 0) {
+        ring_destroy(&console->input);
+        ring_destroy(&console->output);
+        free(console);
+        return NULL;
+    }
+    if (pthread_create(&console->reader, NULL, reader_main, console) != 0) {
+        ring_close(&console->output);
+        pthread_join(console->writer, NULL);
+        ring_destroy(&console->input);
+        ring_destroy(&console->output);
+        free(console);
+        return NULL;
+    }
+    return console;
+}
+
+void async_console_stop(struct async_console* console) {
+    ring_close(&console->output);
+    pthread_join(console->writer, NULL);
+    // The guest is done with its input, the reader may still be blocked on stdin
+    pthread_cancel(console->reader);
+    pthread_join(console->reader, NULL);
+    ring_destroy(&console->input);
+    ring_destroy(&console->output);
+    free(console);
+}
+
+int console_peek(void* context) {
+    struct async_console* console = (struct async_console*)context;
+    // Prompts must be out before the guest waits for its answer
+    if (!ring_ready(&console->input, 1)) {
+        ring_notify(&console->output);
+    }
+    return ring_peek(&console->input);
+}
+
+void console_skip(void* context) {
+    ring_skip(&((struct async_console*)context)->input);
+}
+
+int async_read_char(void* context) {
+    int c = console_peek(context);
+    if (c >= 0) {
+        console_skip(context);
+    }
+    return c;
+}
+
+int async_read_int(void* context, int32_t* value) {
+    return parse_int(context, console_peek, console_skip, value);
+}
+
+void async_write(void* context, const char* data, size_t len) {
+    struct spsc_ring* ring = &((struct async_console*)context)->output;
+    ring_push(ring, data, len);
+    // Otherwise the writer picks the output up when its sleep times out, in larger writes
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - ring->tail_seen >= ASYNC_WAKE_BYTES) {
+        ring->tail_seen = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->tail_seen >= ASYNC_WAKE_BYTES) {
+            ring_notify(ring);
+        }
+    }
+}
@@ -0,0 +1,170 @@
+#ifndef VM_ASYNC_IO_H
+#define VM_ASYNC_IO_H
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libriskxvii.h"
+#include "vm_buffer.h"
+
+#define ASYNC_RING_SIZE (1 << 16)  // Bytes per ring, a power of two
+#define ASYNC_READ_CHUNK 4096      // Most bytes the reader thread asks stdin for at once
+#define ASYNC_SPIN 4096            // Times a side polls an empty or full ring before sleeping on it
+#define ASYNC_WAIT_NS 1000000      // Longest sleep on a ring, bounds how long output or a missed wake up waits
+#define ASYNC_WAKE_BYTES (ASYNC_RING_SIZE / 4)  // Pending output that wakes the writer early
+#define CACHE_LINE_BYTES 64
+#define NSEC_PER_SEC 1000000000L
+
+struct spsc_ring {
+    alignas(CACHE_LINE_BYTES) _Atomic size_t head;  // Bytes ever produced, only the producer writes it
+    size_t tail_seen;                               // The producer's last view of tail
+    alignas(CACHE_LINE_BYTES) _Atomic size_t tail;  // Bytes ever consumed, only the consumer writes it
+    size_t head_seen;                               // The consumer's last view of head
+    alignas(CACHE_LINE_BYTES) _Atomic int closed;   // Set once the producer adds nothing more
+    _Atomic int waiting;   // Set while a side sleeps on the ring, the other side only signals then
+    int spin;              // Polls before sleeping, 0 on a single CPU where polling only delays the other side
+    pthread_mutex_t lock;  // Guards sleeping and waking, never the data
+    pthread_cond_t wake;
+    unsigned char data[ASYNC_RING_SIZE];
+};  // A lock-free single producer, single consumer byte queue, each index on its own cache line
+
+struct async_console {
+    struct spsc_ring input;   // Filled from stdin by the reader thread, drained by the vm
+    struct spsc_ring output;  // Filled by the vm, drained to stdout by the writer thread
+    pthread_t reader;
+    pthread_t writer;
+};  // Console callbacks context that keeps console syscalls off the interpreter thread
+
+/**
+ * Prepare an empty ring
+ * @param ring The ring
+*/
+void ring_init(struct spsc_ring* ring);
+
+/**
+ * Free the synchronisation objects of a ring
+ * @param ring The ring
+*/
+void ring_destroy(struct spsc_ring* ring);
+
+/**
+ * Check whether a side of a ring can go ahead
+ * @param ring The ring
+ * @param for_data 1 for the consumer, 0 for the producer
+ * @return int 1 if the ring holds data, or room, or is closed, otherwise 0
+*/
+int ring_ready(struct spsc_ring* ring, int for_data);
+
+/**
+ * Cancellation cleanup releasing the lock of a ring
+ * @param ring The ring
+*/
+void unlock_ring(void* ring);
+
+/**
+ * Wait until a ring has data to consume or room to produce into, or is closed
+ * @param ring The ring
+ * @param for_data 1 to wait as the consumer, 0 to wait as the producer
+*/
+void ring_wait(struct spsc_ring* ring, int for_data);
+
+/**
+ * Wake the other side of a ring once if it sleeps on it, without a syscall otherwise
+ * @param ring The ring
+*/
+void ring_notify(struct spsc_ring* ring);
+
+/**
+ * Copy bytes into a ring, waiting for room as needed, the consumer is not woken
+ * @param ring The ring
+ * @param data The bytes
+ * @param len The number of bytes
+*/
+void ring_push(struct spsc_ring* ring, const void* data, size_t len);
+
+/**
+ * Look at the next byte of a ring without consuming it, waiting for one if the ring is empty
+ * @param ring The ring
+ * @return int The byte, or -1 once the ring is closed and empty
+*/
+int ring_peek(struct spsc_ring* ring);
+
+/**
+ * Consume the byte ring_peek returned
+ * @param ring The ring
+*/
+void ring_skip(struct spsc_ring* ring);
+
+/**
+ * Mark a ring as finished and wake its consumer
+ * @param ring The ring
+*/
+void ring_close(struct spsc_ring* ring);
+
+/**
+ * Reader thread body, copies stdin into the input ring until the end of stdin or until cancelled
+ * @param context The async console
+ * @return void* NULL
+*/
+void* reader_main(void* context);
+
+/**
+ * Writer thread body, writes the output ring to stdout until it is closed and drained
+ * @param context The async console
+ * @return void* NULL
+*/
+void* writer_main(void* context);
+
+/**
+ * Start the reader and writer threads, stdout is flushed first so earlier output stays in order
+ * @return struct async_console* The console context, NULL if the threads could not be started
+*/
+struct async_console* async_console_start(void);
+
+/**
+ * Write out everything the guest wrote, then stop both threads and free the console
+ * @param console The console context
+*/
+void async_console_stop(struct async_console* console);
+
+/**
+ * Look at the next input byte, first waking the writer if the guest is about to wait for input
+ * @param context The async console
+ * @return int The byte, or -1 at the end of stdin
+*/
+int console_peek(void* context);
+
+/**
+ * Consume the input byte console_peek returned
+ * @param context The async console
+*/
+void console_skip(void* context);
+
+/**
+ * Console callback reading a character from the input ring
+ * @param context The async console
+ * @return int The character, or -1 at the end of stdin
+*/
+int async_read_char(void* context);
+
+/**
+ * Console callback reading a decimal integer from the input ring, parsing as scanf("%d") does
+ * @param context The async console
+ * @param value Set to the integer
+ * @return int 1 if an integer was read, otherwise 0
+*/
+int async_read_int(void* context, int32_t* value);
+
+/**
+ * Console callback queueing guest output for the writer thread, which is woken once enough is pending
+ * @param context The async console
+ * @param data The bytes
+ * @param len The number of bytes
+*/
+void async_write(void* context, const char* data, size_t len);
+
+#endif
@@ -0,0 +1,96 @@
+#include <ctype.h>
+#include "vm_buffer.h"
+
+void buffer_append(struct byte_buffer* buffer, const void* data, size_t len) {
+    if (buffer->len + len > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : BUFFER_INITIAL_SIZE;
+        while (capacity < buffer->len + len) {
+            capacity *= 2;
+        }
+        buffer->data = (unsigned char*)realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+}
+
+void buffer_clear(struct byte_buffer* buffer) {
+    buffer->len = 0;
+    buffer->pos = 0;
+    buffer->examined = 0;
+    buffer->at_end = 0;
+}
+
+int buffer_peek(void* input) {
+    struct byte_buffer* buffer = (struct byte_buffer*)input;
+    if (buffer->pos >= buffer->len) {
+        buffer->at_end = 1;
+        return -1;
+    }
+    if (buffer->pos + 1 > buffer->examined) {
+        buffer->examined = buffer->pos + 1;
+    }
+    return buffer->data[buffer->pos];
+}
+
+void buffer_skip(void* input) {
+    ((struct byte_buffer*)input)->pos++;
+}
+
+int buffer_read_char(struct byte_buffer* buffer) {
+    int ch = buffer_peek(buffer);
+    if (ch >= 0) {
+        buffer->pos++;
+    }
+    return ch;
+}
+
+int buffer_read_int(struct byte_buffer* buffer, int32_t* value) {
+    // The byte after the number is examined too, as it ends the number
+    return parse_int(buffer, buffer_peek, buffer_skip, value);
+}
+
+int parse_int(void* input, int (*peek)(void* input), void (*skip)(void* input), int32_t* value) {
+    // Skip white space, then an optional sign and at least one digit
+    while (peek(input) >= 0 && isspace(peek(input))) {
+        skip(input);
+    }
+    int negative = 0;
+    if (peek(input) == '-' || peek(input) == '+') {
+        negative = peek(input) == '-';
+        skip(input);
+    }
+    if (peek(input) < 0 || !isdigit(peek(input))) {
+        return 0;
+    }
+    // The byte after the number is left unconsumed, as scanf pushes it back
+    uint32_t magnitude = 0;
+    while (peek(input) >= 0 && isdigit(peek(input))) {
+        magnitude = magnitude * 10 + (uint32_t)(peek(input) - '0');
+        skip(input);
+    }
+    *value = (int32_t)(negative ? 0u - magnitude : magnitude);
+    return 1;
+}
+
+void buffer_read_file(FILE* fp, struct byte_buffer* buffer) {
+    unsigned char chunk[BUFFER_INITIAL_SIZE];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        buffer_append(buffer, chunk, got);
+    }
+}
+
+void put_le(unsigned char* out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+uint64_t get_le(const unsigned char* in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
@@ -0,0 +1,95 @@
+#ifndef VM_BUFFER_H
+#define VM_BUFFER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_INITIAL_SIZE 4096
+
+struct byte_buffer {
+    unsigned char* data;
+    size_t len;
+    size_t capacity;
+    size_t pos;       // Read position, for console input
+    size_t examined;  // Bytes the reads have looked at, one past pos after an integer is parsed
+    int at_end;       // Set once a read looked past the last byte
+};  // A growable byte array, also used as console input
+
+/**
+ * Append bytes to a buffer
+ * @param buffer The buffer
+ * @param data The bytes
+ * @param len The number of bytes
+*/
+void buffer_append(struct byte_buffer* buffer, const void* data, size_t len);
+
+/**
+ * Empty a buffer, keeping its memory
+ * @param buffer The buffer
+*/
+void buffer_clear(struct byte_buffer* buffer);
+
+/**
+ * Look at the byte at the read position without consuming it, recording how far input was examined
+ * @param input The console input, a struct byte_buffer
+ * @return int The byte, or -1 at the end of the input
+*/
+int buffer_peek(void* input);
+
+/**
+ * Consume the byte buffer_peek returned
+ * @param input The console input, a struct byte_buffer
+*/
+void buffer_skip(void* input);
+
+/**
+ * Read a character from console input
+ * @param buffer The console input
+ * @return int The character, or -1 at the end of the input
+*/
+int buffer_read_char(struct byte_buffer* buffer);
+
+/**
+ * Read a decimal integer from console input, parsing as scanf("%d") does
+ * @param buffer The console input
+ * @param value Set to the integer
+ * @return int 1 if an integer was read, otherwise 0
+*/
+int buffer_read_int(struct byte_buffer* buffer, int32_t* value);
+
+/**
+ * Parse a decimal integer as scanf("%d") does, from any console input
+ * @param input The console input
+ * @param peek Look at the next byte of input without consuming it, -1 at its end
+ * @param skip Consume the byte peek returned
+ * @param value Set to the integer
+ * @return int 1 if an integer was read, otherwise 0
+*/
+int parse_int(void* input, int (*peek)(void* input), void (*skip)(void* input), int32_t* value);
+
+/**
+ * Read a whole file into a buffer
+ * @param fp The file
+ * @param buffer The buffer, appended to
+*/
+void buffer_read_file(FILE* fp, struct byte_buffer* buffer);
+
+/**
+ * Write a 16, 32 or 64-bit value little endian
+ * @param out The destination
+ * @param value The value
+ * @param bytes 2, 4 or 8
+*/
+void put_le(unsigned char* out, uint64_t value, int bytes);
+
+/**
+ * Read a 16, 32 or 64-bit little endian value
+ * @param in The source
+ * @param bytes 2, 4 or 8
+ * @return uint64_t The value
+*/
+uint64_t get_le(const unsigned char* in, int bytes);
+
+#endif
@@ -0,0 +1,174 @@
+#include "vm_cache.h"
+#include "vm_riskxvii.h"
+
+const char* region_names[CACHE_REGION_NUM] = {"instruction memory", "data memory", "heap"};
+
+int cache_configure(const char* config, struct cache* cache) {
+    unsigned int size, line_size, ways;
+    if (sscanf(config, "%u:%u:%u", &size, &line_size, &ways) != 3) {
+        return 0;
+    }
+    // Line size and set count must be powers of two so addresses split into tag, set and offset
+    if (line_size == 0 || ways == 0 || (line_size & (line_size - 1)) || size % (line_size * ways)) {
+        return 0;
+    }
+    uint32_t sets = size / (line_size * ways);
+    if (sets == 0 || (sets & (sets - 1))) {
+        return 0;
+    }
+
+    cache->size = size;
+    cache->line_size = line_size;
+    cache->ways = ways;
+    cache->sets = sets;
+    cache->lines = (struct cache_line*)calloc(sets * ways, sizeof(struct cache_line));
+    cache->pcs = (struct cache_stats*)calloc(INST_MEM_SIZE, sizeof(struct cache_stats));
+    return 1;
+}
+
+int cache_start(struct vm* vm, const char* icache_config, const char* dcache_config, const char* report) {
+    struct cache_sim* sim = (struct cache_sim*)calloc(1, sizeof(struct cache_sim));
+    vm->cache_sim = sim;
+    sim->output = report;
+    if (icache_config && !cache_configure(icache_config, &sim->icache)) {
+        return 0;
+    }
+    if (dcache_config && !cache_configure(dcache_config, &sim->dcache)) {
+        return 0;
+    }
+    return 1;
+}
+
+void cache_access(struct cache* cache, uint32_t address, uint32_t size, int region, uint32_t at_pc) {
+    // An unaligned access touching two lines counts as a miss if either line misses
+    uint32_t first_line = address / cache->line_size;
+    uint32_t last_line = (address + size - 1) / cache->line_size;
+    int missed = 0;
+
+    for (uint32_t line = first_line; line <= last_line; line++) {
+        uint32_t set = line & (cache->sets - 1);
+        uint32_t tag = line / cache->sets;
+        struct cache_line* ways = &cache->lines[set * cache->ways];
+        struct cache_line* victim = &ways[0];
+        int hit = 0;
+
+        cache->clock++;
+        for (uint32_t way = 0; way < cache->ways; way++) {
+            if (ways[way].valid && ways[way].tag == tag) {
+                ways[way].last_used = cache->clock;
+                hit = 1;
+                break;
+            }
+            // Prefer an empty way, otherwise the least recently used one
+            if (!ways[way].valid || (victim->valid && ways[way].last_used < victim->last_used)) {
+                victim = &ways[way];
+            }
+        }
+        if (!hit) {
+            victim->valid = 1;
+            victim->tag = tag;
+            victim->last_used = cache->clock;
+            missed = 1;
+        }
+    }
+
+    cache->total.accesses++;
+    cache->regions[region].accesses++;
+    cache->pcs[at_pc % INST_MEM_SIZE].accesses++;
+    if (missed) {
+        cache->total.misses++;
+        cache->regions[region].misses++;
+        cache->pcs[at_pc % INST_MEM_SIZE].misses++;
+    }
+}
+
+void cache_fetch(struct cache_sim* sim, uint32_t address, uint32_t size) {
+    if (sim->icache.size) {
+        cache_access(&sim->icache, address, size, CACHE_REGION_INST, address);
+    }
+}
+
+void cache_data_access(struct cache_sim* sim, uint32_t address, uint32_t size, uint32_t at_pc) {
+    if (!sim->dcache.size) {
+        return;
+    }
+    if (address <= DATA_MEM_END) {
+        cache_access(&sim->dcache, address, size, CACHE_REGION_DATA, at_pc);
+    } else if (address >= HEAP_START) {
+        cache_access(&sim->dcache, address, size, CACHE_REGION_HEAP, at_pc);
+    }
+}
+
+void cache_report_one(FILE* out, const char* name, struct cache* cache) {
+    fprintf(out, "%s %uB, %uB lines, %u-way: %llu accesses, %llu misses (%.2f%%)\n", name, cache->size,
+            cache->line_size, cache->ways, (unsigned long long)cache->total.accesses,
+            (unsigned long long)cache->total.misses,
+            cache->total.accesses ? 100.0 * cache->total.misses / cache->total.accesses : 0.0);
+
+    for (int i = 0; i < CACHE_REGION_NUM; i++) {
+        struct cache_stats* stats = &cache->regions[i];
+        if (stats->accesses) {
+            fprintf(out, "  %s: %llu accesses, %llu misses (%.2f%%)\n", region_names[i],
+                    (unsigned long long)stats->accesses, (unsigned long long)stats->misses,
+                    100.0 * stats->misses / stats->accesses);
+        }
+    }
+
+    // Instructions with misses, the most missing first
+    uint32_t order[INST_MEM_SIZE];
+    uint32_t order_num = 0;
+    for (uint32_t i = 0; i < INST_MEM_SIZE; i++) {
+        if (cache->pcs[i].misses) {
+            uint32_t j = order_num++;
+            while (j > 0 && cache->pcs[order[j - 1]].misses < cache->pcs[i].misses) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+    }
+    for (uint32_t i = 0; i < order_num; i++) {
+        struct cache_stats* stats = &cache->pcs[order[i]];
+        fprintf(out, "  pc 0x%08x: %llu accesses, %llu misses (%.2f%%)\n", order[i],
+                (unsigned long long)stats->accesses, (unsigned long long)stats->misses,
+                100.0 * stats->misses / stats->accesses);
+    }
+}
+
+void cache_report(struct vm* vm) {
+    struct cache_sim* sim = vm->cache_sim;
+    if (sim == NULL) {
+        return;
+    }
+    FILE* out = (strcmp(sim->output, "-") == 0) ? stdout : fopen(sim->output, "w");
+    if (out == NULL) {
+        perror("Error opening cache report");
+        return;
+    }
+
+    if (sim->icache.size) {
+        cache_report_one(out, "I-cache", &sim->icache);
+    }
+    if (sim->dcache.size) {
+        cache_report_one(out, "D-cache", &sim->dcache);
+    }
+
+    if (out == stdout) {
+        fflush(out);
+    } else {
+        fclose(out);
+    }
+}
+
+void cache_free(struct vm* vm) {
+    struct cache_sim* sim = vm->cache_sim;
+    if (sim == NULL) {
+        return;
+    }
+    free(sim->icache.lines);
+    free(sim->icache.pcs);
+    free(sim->dcache.lines);
+    free(sim->dcache.pcs);
+    free(sim);
+    vm->cache_sim = NULL;
+}
@@ -0,0 +1,111 @@
+#ifndef VM_CACHE_H
+#define VM_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_REGION_NUM 3
+#define CACHE_REGION_INST 0
+#define CACHE_REGION_DATA 1
+#define CACHE_REGION_HEAP 2
+
+struct cache_line {
+    uint32_t tag;
+    int valid;
+    uint64_t last_used;  // Access stamp for LRU replacement
+};  // One line of a cache way
+
+struct cache_stats {
+    uint64_t accesses;
+    uint64_t misses;
+};  // Hit and miss counts
+
+struct cache {
+    uint32_t size;       // Total bytes
+    uint32_t line_size;  // Bytes per line
+    uint32_t ways;       // Associativity
+    uint32_t sets;
+    struct cache_line* lines;  // sets * ways lines, set major
+    uint64_t clock;            // Access stamp source
+    struct cache_stats total;
+    struct cache_stats regions[CACHE_REGION_NUM];
+    struct cache_stats* pcs;   // Indexed by the pc of the accessing instruction
+};  // A simulated set associative LRU cache
+
+struct cache_sim {
+    struct cache icache;  // The simulated instruction cache, size 0 when not simulated
+    struct cache dcache;  // The simulated data cache, size 0 when not simulated
+    const char* output;   // Where the report is written
+};  // The cache simulator state of one vm
+
+struct vm;
+
+/**
+ * Parse a cache configuration of the form size:line:ways, in bytes, e.g. 1024:16:2
+ * @param config The configuration string
+ * @param cache The cache to configure
+ * @return int 1 if the configuration is valid, otherwise 0
+*/
+int cache_configure(const char* config, struct cache* cache);
+
+/**
+ * Turn on the simulator for the configured caches of a vm, the report is written by cache_report
+ * @param vm The vm
+ * @param icache The instruction cache configuration, NULL for none
+ * @param dcache The data cache configuration, NULL for none
+ * @param report The file for the report, "-" for stdout
+ * @return int 1 if successful, 0 if a configuration is invalid
+*/
+int cache_start(struct vm* vm, const char* icache, const char* dcache, const char* report);
+
+/**
+ * Look up a byte range in a cache, filling missing lines
+ * @param cache The cache
+ * @param address The first byte address
+ * @param size The number of bytes
+ * @param region The memory region the address belongs to
+ * @param at_pc The pc of the accessing instruction
+*/
+void cache_access(struct cache* cache, uint32_t address, uint32_t size, int region, uint32_t at_pc);
+
+/**
+ * Simulate an instruction fetch
+ * @param sim The cache simulator
+ * @param address The instruction address
+ * @param size The instruction length in bytes
+*/
+void cache_fetch(struct cache_sim* sim, uint32_t address, uint32_t size);
+
+/**
+ * Simulate a data load or store, virtual routine accesses are not cached. Instruction memory only goes through
+ * cache_fetch, so the I-cache is the one place it is counted
+ * @param sim The cache simulator
+ * @param address The first byte address, in data memory or above
+ * @param size The number of bytes
+ * @param at_pc The pc of the accessing instruction
+*/
+void cache_data_access(struct cache_sim* sim, uint32_t address, uint32_t size, uint32_t at_pc);
+
+/**
+ * Write the hit and miss rates of one cache, per region and per pc
+ * @param out The output file
+ * @param name The cache name
+ * @param cache The cache
+*/
+void cache_report_one(FILE* out, const char* name, struct cache* cache);
+
+/**
+ * Write the report of every simulated cache
+ * @param vm The vm, nothing is written if it is not simulated
+*/
+void cache_report(struct vm* vm);
+
+/**
+ * Free the cache simulator of a vm
+ * @param vm The vm
+*/
+void cache_free(struct vm* vm);
+
+#endif
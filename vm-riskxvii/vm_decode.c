@@ -0,0 +1,220 @@
+#include "vm_decode.h"
+#include "vm_program.h"
+
+#define OPCODE_DECODE(name, func3_mask, func7_mask) [name] = {SLOT_##name, func3_mask, func7_mask},
+const struct opcode_decode opcode_decodes[OPCODE_NUM] = {
+    OPCODE_TABLE(OPCODE_DECODE)
+};
+#undef OPCODE_DECODE
+
+// Built by the compiler, every key that no row names stays INSN_INVALID
+#define DECODE_ENTRY(mnemonic, format, opcode, func3, func7, extensions, ...) \
+    [DECODE_KEY(SLOT_##opcode, func3, func7)] = INSN_##mnemonic,
+const uint8_t decode_table[DECODE_TABLE_SIZE] = {
+    INSTRUCTION_TABLE(DECODE_ENTRY)
+};
+#undef DECODE_ENTRY
+
+#define INSTRUCTION_SPEC(mnemonic, format, opcode, func3, func7, extensions, ...) \
+    [INSN_##mnemonic] = {#mnemonic, FORMAT_##format, extensions, execute_##mnemonic},
+const struct instruction_spec instruction_specs[INSN_NUM] = {
+    [INSN_INVALID] = {NULL, FORMAT_NONE, 0, instruct_not_implement},
+    INSTRUCTION_TABLE(INSTRUCTION_SPEC)
+};
+#undef INSTRUCTION_SPEC
+
+const char* const register_names[REG_NUM] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+uint32_t decode_key(uint32_t raw) {
+    const struct opcode_decode* decode = &opcode_decodes[raw & 0x7F];
+    return DECODE_KEY((uint32_t)decode->slot, (raw >> 12) & decode->func3_mask, (raw >> 25) & decode->func7_mask);
+}
+
+const struct instruction_spec* decode_instruct(uint32_t isa_extensions, union instruction instruct) {
+    const struct instruction_spec* spec = &instruction_specs[decode_table[decode_key(instruct.raw_instruct)]];
+    // Extension instructions are not implemented unless the extension is enabled for this run
+    if ((spec->extensions & isa_extensions) != spec->extensions) {
+        return &instruction_specs[INSN_INVALID];
+    }
+    return spec;
+}
+
+struct operands decode_operands(union instruction instruct, enum InstructionFormat format) {
+    struct operands op;
+    op.rd = instruct.R_type.rd;
+    op.rs1 = instruct.R_type.rs1;
+    op.rs2 = instruct.R_type.rs2;
+    op.imm = 0;
+    switch (format) {
+        case FORMAT_I:
+        case FORMAT_LOAD:
+        case FORMAT_JALR:
+            op.imm = instruct.I_type.imm;
+            if (op.imm & 0x800) {
+                op.imm |= 0xFFFFF000;  // Extend 12 bits to 32
+            }
+            break;
+        case FORMAT_S:
+            op.imm = (instruct.S_type.imm11_5 << 5) | instruct.S_type.imm4_0;
+            if (op.imm & 0x800) {
+                op.imm |= 0xFFFFF000;
+            }
+            break;
+        case FORMAT_SB:
+            op.imm = (instruct.SB_type.imm12 << 11) | (instruct.SB_type.imm11 << 10) |
+                     (instruct.SB_type.imm10_5 << 4) | instruct.SB_type.imm4_1;
+            if (op.imm & 0x800) {
+                op.imm |= 0xFFFFF000;
+            }
+            op.imm <<= 1;
+            break;
+        case FORMAT_U:
+            op.imm = instruct.U_type.imm31_12 << 12;
+            break;
+        case FORMAT_R4:
+            op.rs3 = instruct.R4_type.rs3;
+            break;
+        case FORMAT_UJ:
+            op.imm = (instruct.UJ_type.imm20 << 19) | (instruct.UJ_type.imm19_12 << 11) |
+                     (instruct.UJ_type.imm11 << 10) | instruct.UJ_type.imm10_1;
+            op.imm <<= 1;
+            // Bit 19 is taken as the sign, the jumps in a 1 KiB instruction memory never reach it
+            if (op.imm & 0x80000) {
+                op.imm |= 0xFFF00000;
+            }
+            break;
+        default:
+            break;
+    }
+    return op;
+}
+
+void disassemble(uint32_t isa_extensions, union instruction instruct, uint32_t pc, char* out, size_t size) {
+    const struct instruction_spec* spec = decode_instruct(isa_extensions, instruct);
+    struct operands op = decode_operands(instruct, spec->format);
+    const char* rd = register_names[op.rd];
+    const char* rs1 = register_names[op.rs1];
+    const char* rs2 = register_names[op.rs2];
+    switch (spec->format) {
+        case FORMAT_R:
+            snprintf(out, size, "%s %s, %s, %s", spec->mnemonic, rd, rs1, rs2);
+            break;
+        case FORMAT_I:
+            snprintf(out, size, "%s %s, %s, %d", spec->mnemonic, rd, rs1, (int32_t)op.imm);
+            break;
+        case FORMAT_LOAD:
+        case FORMAT_JALR:
+            snprintf(out, size, "%s %s, %d(%s)", spec->mnemonic, rd, (int32_t)op.imm, rs1);
+            break;
+        case FORMAT_S:
+            snprintf(out, size, "%s %s, %d(%s)", spec->mnemonic, rs2, (int32_t)op.imm, rs1);
+            break;
+        case FORMAT_SB:
+            snprintf(out, size, "%s %s, %s, 0x%x", spec->mnemonic, rs1, rs2, pc + op.imm);
+            break;
+        case FORMAT_U:
+            snprintf(out, size, "%s %s, 0x%x", spec->mnemonic, rd, op.imm >> 12);
+            break;
+        case FORMAT_UJ:
+            snprintf(out, size, "%s %s, 0x%x", spec->mnemonic, rd, pc + op.imm);
+            break;
+        // The table names end in _w, where the assembler writes .w
+        case FORMAT_LR:
+            snprintf(out, size, "%.*s.w %s, (%s)", (int)strlen(spec->mnemonic) - 2, spec->mnemonic, rd, rs1);
+            break;
+        case FORMAT_AMO:
+            snprintf(out, size, "%.*s.w %s, %s, (%s)", (int)strlen(spec->mnemonic) - 2, spec->mnemonic, rd, rs2,
+                     rs1);
+            break;
+        case FORMAT_R4:
+            snprintf(out, size, "%.*s.w %s, %s, %s, %s", (int)strlen(spec->mnemonic) - 2, spec->mnemonic, rd, rs1,
+                     rs2, register_names[op.rs3]);
+            break;
+        default:
+            snprintf(out, size, ".word 0x%08x", instruct.raw_instruct);
+            break;
+    }
+}
+
+void disassemble_image(struct vm* vm, FILE* out) {
+    uint32_t end = INST_MEM_SIZE;
+    while (end > 0 && vm->program->inst_mem[end - 1] == 0) {
+        end--;
+    }
+
+    uint32_t saved_pc = vm->pc;
+    int next_symbol = 0;
+    vm->pc = 0;
+    while (vm->pc < end) {
+        // Labels for every symbol at this address, in the table's order
+        while (next_symbol < vm->symbols.count && vm->symbols.symbols[next_symbol].address <= vm->pc) {
+            if (vm->symbols.symbols[next_symbol].address == vm->pc) {
+                fprintf(out, "\n%08x <%s>:\n", vm->pc, vm->symbols.symbols[next_symbol].name);
+            }
+            next_symbol++;
+        }
+
+        union instruction instruct = fetch_instruct(vm);
+        char text[DISASM_LEN];
+        disassemble(vm->isa_extensions, instruct, vm->pc, text, sizeof(text));
+        if (vm->inst_len == COMPRESSED_BYTES) {
+            uint16_t half = (uint16_t)(vm->program->inst_mem[vm->pc] | (vm->program->inst_mem[vm->pc + 1] << 8));
+            fprintf(out, "%8x:\t%04x    \t%s\n", vm->pc, half, text);
+        } else {
+            uint32_t raw;
+            memcpy(&raw, vm->program->inst_mem + vm->pc, sizeof(raw));
+            fprintf(out, "%8x:\t%08x\t%s\n", vm->pc, raw, text);
+        }
+        vm->pc += vm->inst_len;
+    }
+    vm->pc = saved_pc;
+}
+
+void record_stop(struct vm* vm, enum vm_status status, struct run_stop* stop) {
+    stop->status = status;
+    stop->pc = vm->pc;
+    stop->instruct = 0;
+    if (vm->pc <= INST_MEM_SIZE - INSTRUCT_BYTES) {
+        stop->instruct = fetch_instruct(vm).raw_instruct;
+    }
+}
+
+void describe_stop(const struct run_stop* stop, uint32_t isa_extensions, const struct symbol_table* symbols,
+                   FILE* out) {
+    if ((stop->status != VM_ILLEGAL_OPERATION && stop->status != VM_NOT_IMPLEMENTED) ||
+        stop->pc > INST_MEM_SIZE - INSTRUCT_BYTES) {
+        return;
+    }
+    union instruction instruct = {.raw_instruct = stop->instruct};
+    char text[DISASM_LEN];
+    disassemble(isa_extensions, instruct, stop->pc, text, sizeof(text));
+    const struct symbol* symbol = find_symbol(symbols, stop->pc);
+    if (symbol) {
+        fprintf(out, "Stopped at 0x%08x <%s+0x%x>: %s\n", stop->pc, symbol->name, stop->pc - symbol->address, text);
+    } else {
+        fprintf(out, "Stopped at 0x%08x: %s\n", stop->pc, text);
+    }
+}
+
+void describe_image_stop(const struct run_stop* stop, const unsigned char* image, size_t size, const char* isa,
+                         const char* symbol_file, FILE* out) {
+    if ((stop->status != VM_ILLEGAL_OPERATION && stop->status != VM_NOT_IMPLEMENTED) || image == NULL) {
+        return;
+    }
+    // The instruction was recorded, the image only gives its symbols
+    struct vm* vm = vm_create(image, size);
+    if (vm == NULL) {
+        return;
+    }
+    if (isa) {
+        vm_set_isa(vm, isa);
+    }
+    if (symbol_file) {
+        load_symbols(symbol_file, &vm->symbols);
+    }
+    describe_stop(stop, vm->isa_extensions, &vm->symbols, out);
+    vm_destroy(vm);
+}
@@ -0,0 +1,158 @@
+#ifndef VM_DECODE_H
+#define VM_DECODE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "vm_riskxvii.h"
+#include "vm_instructions.h"
+
+#define OPCODE_NUM 128
+#define DECODE_KEY(slot, func3, func7) (((slot) << 10) | ((func3) << 7) | (func7))
+#define DISASM_LEN 64  // Longest disassembled instruction
+
+enum InstructionFormat {
+    FORMAT_NONE,  // Not an instruction
+    FORMAT_R,     // rd, rs1, rs2
+    FORMAT_I,     // rd, rs1, immediate
+    FORMAT_LOAD,  // rd, offset(rs1)
+    FORMAT_JALR,  // rd, offset(rs1)
+    FORMAT_S,     // rs2, offset(rs1)
+    FORMAT_SB,    // rs1, rs2, target
+    FORMAT_U,     // rd, upper immediate
+    FORMAT_UJ,    // rd, target
+    FORMAT_LR,    // rd, (rs1)
+    FORMAT_AMO,   // rd, rs2, (rs1)
+    FORMAT_R4     // rd, rs1, rs2, rs3
+};  // How the operands of an instruction are encoded and written
+
+#define OPCODE_SLOT(name, func3_mask, func7_mask) SLOT_##name,
+enum OpcodeSlot {
+    SLOT_NONE,  // Opcodes the vm does not decode
+    OPCODE_TABLE(OPCODE_SLOT)
+    SLOT_NUM
+};  // Dense numbering of the decoded opcodes, the high part of a decode key
+#undef OPCODE_SLOT
+
+#define INSTRUCTION_ID(mnemonic, format, opcode, func3, func7, extensions, ...) INSN_##mnemonic,
+enum InstructionId {
+    INSN_INVALID,  // Anything that does not decode, executed as not implemented
+    INSTRUCTION_TABLE(INSTRUCTION_ID)
+    INSN_NUM
+};  // Index of an instruction in instruction_specs
+#undef INSTRUCTION_ID
+
+#define DECODE_TABLE_SIZE (SLOT_NUM << 10)
+
+struct opcode_decode {
+    uint8_t slot;        // The opcode slot, SLOT_NONE if the opcode is not decoded
+    uint8_t func3_mask;  // The func3 bits that pick the instruction
+    uint8_t func7_mask;  // The func7 bits that pick the instruction
+};  // How the instructions under one opcode are told apart
+
+struct instruction_spec {
+    const char* mnemonic;
+    enum InstructionFormat format;
+    uint32_t extensions;  // ISA extensions that must be enabled, 0 for the base ISA
+    void (*execute)(struct vm* vm, union instruction instruct);
+};  // One row of the instruction table
+
+struct operands {
+    uint32_t rd;
+    uint32_t rs1;
+    uint32_t rs2;
+    uint32_t rs3;  // Only decoded for FORMAT_R4
+    uint32_t imm;  // Sign extended, branch and jump offsets are in bytes
+};  // The fields of an instruction as its format encodes them
+
+struct run_stop {
+    enum vm_status status;  // Why the run stopped
+    uint32_t pc;            // Where it stopped
+    uint32_t instruct;      // The instruction at pc, expanded if compressed, 0 outside instruction memory
+};  // How a run ended, enough to describe a fault without the vm, for cached and daemon runs
+
+/**
+ * Execute one instruction of the table, generated from its semantics, pc moves past it or to its target
+ * @param vm The vm
+ * @param instruct The instruction
+*/
+#define EXECUTE_DECLARATION(mnemonic, ...) void execute_##mnemonic(struct vm* vm, union instruction instruct);
+INSTRUCTION_TABLE(EXECUTE_DECLARATION)
+#undef EXECUTE_DECLARATION
+
+extern const struct opcode_decode opcode_decodes[OPCODE_NUM];
+extern const uint8_t decode_table[DECODE_TABLE_SIZE];
+extern const struct instruction_spec instruction_specs[INSN_NUM];
+extern const char* const register_names[REG_NUM];
+
+/**
+ * Compute the decode table index of an instruction from its opcode, func3 and func7
+ * @param raw The 32-bit instruction
+ * @return uint32_t The decode key
+*/
+uint32_t decode_key(uint32_t raw);
+
+/**
+ * Look up the table row of an instruction
+ * @param isa_extensions The enabled ISA extensions, instructions of other extensions do not decode
+ * @param instruct The 32-bit instruction
+ * @return const struct instruction_spec* The row, the INSN_INVALID row if the instruction does not decode
+*/
+const struct instruction_spec* decode_instruct(uint32_t isa_extensions, union instruction instruct);
+
+/**
+ * Extract the register numbers and sign extended immediate of an instruction
+ * @param instruct The 32-bit instruction
+ * @param format Its format
+ * @return struct operands The operands
+*/
+struct operands decode_operands(union instruction instruct, enum InstructionFormat format);
+
+/**
+ * Write an instruction in assembly syntax, branch and jump targets as absolute addresses
+ * @param isa_extensions The enabled ISA extensions
+ * @param instruct The 32-bit instruction, already expanded if it was compressed
+ * @param pc The address of the instruction
+ * @param out Where the text is written
+ * @param size The size of out
+*/
+void disassemble(uint32_t isa_extensions, union instruction instruct, uint32_t pc, char* out, size_t size);
+
+/**
+ * List instruction memory up to its last non-zero byte, with symbol labels
+ * @param vm The vm holding the image, its pc is restored afterwards
+ * @param out Where the listing is written
+*/
+void disassemble_image(struct vm* vm, FILE* out);
+
+/**
+ * Record how a vm stopped
+ * @param vm The stopped vm
+ * @param status The status of the run
+ * @param stop Set to the status, pc and instruction
+*/
+void record_stop(struct vm* vm, enum vm_status status, struct run_stop* stop);
+
+/**
+ * Describe the instruction a run stopped on if it faulted, with the function it is in if symbols are loaded
+ * @param stop How the run stopped
+ * @param isa_extensions The ISA extensions enabled for the run
+ * @param symbols The guest symbols, may be empty
+ * @param out Where the description is written
+*/
+void describe_stop(const struct run_stop* stop, uint32_t isa_extensions, const struct symbol_table* symbols,
+                   FILE* out);
+
+/**
+ * Describe the instruction a run stopped on if it faulted, for a run answered by the result cache or a daemon,
+ * with the symbols the image and a symbols file would have given a local run
+ * @param stop How the run stopped
+ * @param image The image bytes, NULL to describe nothing
+ * @param size The image size
+ * @param isa The ISA string, NULL for rv32i
+ * @param symbol_file The symbols file, NULL for none
+ * @param out Where the description is written
+*/
+void describe_image_stop(const struct run_stop* stop, const unsigned char* image, size_t size, const char* isa,
+                         const char* symbol_file, FILE* out);
+
+#endif
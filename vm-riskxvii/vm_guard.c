@@ -0,0 +1,136 @@
+#define _DEFAULT_SOURCE  // For sigaction, sigsetjmp and MAP_ANONYMOUS
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "vm_guard.h"
+#include "vm_program.h"
+
+_Thread_local struct guard* active_guard = NULL;  // The guard of the vm running on this thread
+struct sigaction previous_segv;                   // The SIGSEGV action before guard_install
+pthread_once_t guard_installed = PTHREAD_ONCE_INIT;
+int guard_install_failed = 0;
+
+void guard_map_heap(struct vm* vm) {
+    struct guard* guard = vm->guard;
+    if (guard == NULL) {
+        return;
+    }
+    uint32_t first = HEAP_START >> GUARD_BLOCK_SHIFT;
+    for (uint32_t i = 0; i < HEAP_BANK_NUM; i++) {
+        guard->blocks[first + i].load = guard->page;
+        guard->blocks[first + i].store = guard->page;
+        guard->blocks[first + i].limit = GUARD_BLOCK_SIZE;
+    }
+    for (struct heap_node* cursor = &vm->head; cursor; cursor = cursor->next) {
+        if (cursor->allocated_size == 0) {
+            continue;
+        }
+        uint32_t bank = (cursor->address - HEAP_START) / BANK_BLOCK_SIZE;
+        for (uint32_t i = 0; i < cursor->bank_blocks; i++) {
+            struct guard_block* block = &guard->blocks[first + bank + i];
+            block->load = &vm->heap_banks[(bank + i) * BANK_BLOCK_SIZE];
+            block->store = block->load;
+            // Only the requested bytes of the last bank are valid, the checked path handles the rest
+            uint32_t used = cursor->allocated_size - i * BANK_BLOCK_SIZE;
+            block->limit = used < BANK_BLOCK_SIZE ? used : BANK_BLOCK_SIZE;
+        }
+    }
+}
+
+void guard_map(struct vm* vm) {
+    struct guard* guard = vm->guard;
+    for (uint32_t i = 0; i <= GUARD_BLOCK_NUM; i++) {
+        guard->blocks[i].load = guard->page;
+        guard->blocks[i].store = guard->page;
+        guard->blocks[i].limit = GUARD_BLOCK_SIZE;
+    }
+    for (uint32_t address = 0; address < INST_MEM_SIZE; address += GUARD_BLOCK_SIZE) {
+        // Instruction memory is read only, stores fault
+        guard->blocks[address >> GUARD_BLOCK_SHIFT].load = &vm->program->inst_mem[address];
+    }
+    for (uint32_t address = DATA_MEM_START; address <= DATA_MEM_END; address += GUARD_BLOCK_SIZE) {
+        struct guard_block* block = &guard->blocks[address >> GUARD_BLOCK_SHIFT];
+        block->load = &vm->memory.data_mem[address - DATA_MEM_START];
+        block->store = block->load;
+    }
+    // Virtual routines always take the checked path, which calls them, and so do addresses past the heap, which
+    // are either the input file or illegal
+    for (uint32_t address = VR_START; address <= VR_END; address += GUARD_BLOCK_SIZE) {
+        guard->blocks[address >> GUARD_BLOCK_SHIFT].limit = 0;
+    }
+    guard->blocks[GUARD_FAR_BLOCK].limit = 0;
+    guard_map_heap(vm);
+}
+
+void guard_signal(int sig, siginfo_t* info, void* context) {
+    struct guard* guard = active_guard;
+    unsigned char* at = (unsigned char*)info->si_addr;
+    if (guard && at >= guard->page && at < guard->page + guard->page_size) {
+        siglongjmp(guard->fault, 1);
+    }
+    // Not a guest access, returning runs the faulting instruction again under the previous action
+    sigaction(SIGSEGV, &previous_segv, NULL);
+}
+
+void install_handler(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guard_signal;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    guard_install_failed = sigaction(SIGSEGV, &action, &previous_segv) != 0;
+}
+
+int guard_install(void) {
+    pthread_once(&guard_installed, install_handler);
+    return !guard_install_failed;
+}
+
+int guard_start(struct vm* vm) {
+    if (!guard_install()) {
+        return 0;
+    }
+    struct guard* guard = (struct guard*)calloc(1, sizeof(struct guard));
+    if (guard == NULL) {
+        return 0;
+    }
+    guard->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    guard->page = (unsigned char*)mmap(NULL, guard->page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (guard->page == MAP_FAILED) {
+        free(guard);
+        return 0;
+    }
+    vm->guard = guard;
+    guard_map(vm);
+    return 1;
+}
+
+void guard_enter(struct guard* guard) {
+    guard->outer = active_guard;
+    active_guard = guard;
+}
+
+void guard_leave(struct vm* vm, struct guard* guard) {
+    if (guard == NULL) {
+        return;
+    }
+    vm->guard = guard;
+    active_guard = guard->outer;
+}
+
+void guard_retry(struct vm* vm, struct guard* guard) {
+    // The fault came before the instruction wrote a register or moved the pc, and its fetch was already counted
+    vm->guard = NULL;
+    finish_instruct(vm, fetch_instruct(vm));
+    vm->guard = guard;
+}
+
+void guard_free(struct vm* vm) {
+    struct guard* guard = vm->guard;
+    if (guard == NULL) {
+        return;
+    }
+    munmap(guard->page, guard->page_size);
+    free(guard);
+    vm->guard = NULL;
+}
@@ -0,0 +1,104 @@
+#ifndef VM_GUARD_H
+#define VM_GUARD_H
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_riskxvii.h"
+
+#define GUARD_BLOCK_SHIFT 6                            // One table entry per 64-byte block, a heap bank
+#define GUARD_BLOCK_SIZE (1 << GUARD_BLOCK_SHIFT)
+#define GUARD_BLOCK_NUM (HEAP_END / GUARD_BLOCK_SIZE)  // Blocks below the end of the heap
+#define GUARD_FAR_BLOCK GUARD_BLOCK_NUM                // The entry of every address past the heap
+
+struct guard_block {
+    unsigned char* load;   // Host address of the block's first byte for loads, in the guard page if they fault
+    unsigned char* store;  // Host address for stores, in the guard page for read only instruction memory
+    uint32_t limit;        // Bytes at the start of the block that are reached directly, the rest are checked
+};  // How guest addresses in one 64-byte block reach host memory
+
+struct guard {
+    struct guard_block blocks[GUARD_BLOCK_NUM + 1];
+    unsigned char* page;    // PROT_NONE host page that every illegal access lands in
+    size_t page_size;
+    sigjmp_buf fault;       // Where the SIGSEGV handler returns to, set by vm_run and vm_step
+    struct guard* outer;    // The guard that was active on this thread before this one
+};  // Host MMU protection of one vm, accesses go through the table without software checks
+
+// The entry of the block holding an address, addresses past the heap all share the last entry
+#define GUARD_BLOCK(guard, address) \
+    (&(guard)->blocks[(address) < HEAP_END ? (address) >> GUARD_BLOCK_SHIFT : GUARD_FAR_BLOCK])
+// Accesses that straddle two blocks, reach virtual routines or pass a partly allocated bank take the checked path
+#define GUARD_FITS(block, address, size) (((address) & (GUARD_BLOCK_SIZE - 1)) + (size) <= (block)->limit)
+#define GUARD_OFFSET(address) ((address) & (GUARD_BLOCK_SIZE - 1))
+
+/**
+ * Point every heap bank entry at the bank, or at the guard page if the bank is not allocated
+ * @param vm The vm, nothing is done if it is not guarded
+*/
+void guard_map_heap(struct vm* vm);
+
+/**
+ * Point every entry of the table at instruction, data and heap memory or at the guard page
+ * @param vm The vm
+*/
+void guard_map(struct vm* vm);
+
+/**
+ * Reserve the guard page, install the handler and map a vm's memory through a new guard
+ * @param vm The vm
+ * @return int 1 if successful, 0 if the host could not reserve the page or install the handler
+*/
+int guard_start(struct vm* vm);
+
+/**
+ * SIGSEGV handler, returns a fault in the guard page of the thread's running vm to guard->fault,
+ * any other fault gets the handler that was installed before
+ * @param sig The signal
+ * @param info Where the fault happened
+ * @param context The interrupted context
+*/
+void guard_signal(int sig, siginfo_t* info, void* context);
+
+/**
+ * Install guard_signal for SIGSEGV, keeping the previous action for faults that are not the guest's
+*/
+void install_handler(void);
+
+/**
+ * Install the SIGSEGV handler, once per process
+ * @return int 1 if the handler is installed, otherwise 0
+*/
+int guard_install(void);
+
+/**
+ * Make a guard the one the SIGSEGV handler answers for on this thread
+ * @param guard The guard
+*/
+void guard_enter(struct guard* guard);
+
+/**
+ * Undo guard_enter once the vm stops running
+ * @param vm The vm, its guard is restored if a retried instruction stopped it
+ * @param guard The guard, NULL if the vm is not guarded
+*/
+void guard_leave(struct vm* vm, struct guard* guard);
+
+/**
+ * Execute the instruction whose access hit the guard page again, on the checked path, which either
+ * completes a legal access or reports the illegal operation exactly as an unguarded vm does
+ * @param vm The vm
+ * @param guard The guard, detached from the vm while the instruction runs
+*/
+void guard_retry(struct vm* vm, struct guard* guard);
+
+/**
+ * Free the guard of a vm
+ * @param vm The vm
+*/
+void guard_free(struct vm* vm);
+
+#endif
@@ -0,0 +1,198 @@
+#define _POSIX_C_SOURCE 200809L  // For pthread_rwlock_t and recursive mutexes
+#include "vm_harts.h"
+#include "vm_guard.h"
+
+void hart_lock_console(struct vm* vm) {
+    struct hart_group* group = vm->harts;
+    if (group == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&group->console_lock);
+    vm->console_depth++;
+    // Nothing may follow the output of the hart that stopped the machine
+    if (atomic_load(&group->stopped)) {
+        vm_stop(vm, VM_HALTED);
+    }
+}
+
+void hart_unlock_console(struct vm* vm) {
+    struct hart_group* group = vm->harts;
+    if (group == NULL) {
+        return;
+    }
+    vm->console_depth--;
+    pthread_mutex_unlock(&group->console_lock);
+}
+
+void hart_lock_heap(struct vm* vm, int write) {
+    struct hart_group* group = vm->harts;
+    if (group == NULL) {
+        return;
+    }
+    if (write) {
+        pthread_rwlock_wrlock(&group->heap_lock);
+    } else {
+        pthread_rwlock_rdlock(&group->heap_lock);
+    }
+}
+
+void hart_unlock_heap(struct vm* vm) {
+    struct hart_group* group = vm->harts;
+    if (group == NULL) {
+        return;
+    }
+    pthread_rwlock_unlock(&group->heap_lock);
+}
+
+int hart_heap_address_valid(struct vm* vm, uint32_t address) {
+    struct vm* machine = MACHINE(vm);
+    // Other harts may change the list while this one walks it
+    pthread_rwlock_rdlock(&vm->harts->heap_lock);
+    int is_allocated = 0;
+    for (struct heap_node* cursor = &machine->head; cursor && !is_allocated; cursor = cursor->next) {
+        is_allocated = cursor->allocated_size > 0 && address >= cursor->address &&
+                       address < cursor->address + cursor->allocated_size;
+    }
+    pthread_rwlock_unlock(&vm->harts->heap_lock);
+    return is_allocated;
+}
+
+void hart_stop(struct vm* vm, enum vm_status status) {
+    struct hart_group* group = vm->harts;
+    if (vm->hart_id == 0 || status != VM_HALTED) {
+        stop_machine(group, vm, status);
+    }
+    // vm_stop jumps past the unlocks of the routine or dump that stopped the hart
+    while (vm->console_depth > 0) {
+        vm->console_depth--;
+        pthread_mutex_unlock(&group->console_lock);
+    }
+}
+
+void stop_machine(struct hart_group* group, struct vm* vm, enum vm_status status) {
+    if (atomic_exchange(&group->stopped, 1) == 0) {
+        // Read once the harts are joined
+        group->status = status;
+        group->stopper = vm->hart_id;
+    }
+}
+
+void hart_run(struct vm* vm) {
+    struct hart_group* group = vm->harts;
+    uint64_t limit = vm->instret + group->max_instructions;
+    for (;;) {
+        uint64_t slice = HART_SLICE;
+        if (group->max_instructions) {
+            if (vm->instret >= limit) {
+                vm->status = VM_BUDGET_EXCEEDED;
+                stop_machine(group, vm, VM_BUDGET_EXCEEDED);
+                return;
+            }
+            if (limit - vm->instret < slice) {
+                slice = limit - vm->instret;
+            }
+        }
+        enum vm_status status = vm_run(vm, slice);
+        if (status != VM_BUDGET_EXCEEDED) {
+            // Halts and faults went through hart_stop, running past the end of memory ends only hart 0 here
+            if (vm->hart_id == 0) {
+                stop_machine(group, vm, status);
+            }
+            return;
+        }
+        if (atomic_load_explicit(&group->stopped, memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+void* hart_main(void* context) {
+    hart_run((struct vm*)context);
+    return NULL;
+}
+
+struct vm* hart_create(struct vm* vm, struct hart_group* group, uint32_t hart_id) {
+    struct vm* hart = (struct vm*)malloc(sizeof(struct vm));
+    if (hart == NULL) {
+        return NULL;
+    }
+    // The copy owns nothing: heap nodes and symbols stay the vm's, and the tools only watch hart 0
+    memcpy(hart, vm, sizeof(struct vm));
+    memset(&hart->symbols, 0, sizeof(hart->symbols));
+    hart->head.next = NULL;
+    hart->profile = NULL;
+    hart->cache_sim = NULL;
+    hart->pipeline = NULL;
+    hart->guard = NULL;
+    hart->shadow = NULL;
+    hart->hart_id = hart_id;
+    hart->machine = vm;
+    hart->harts = group;
+    hart->console_depth = 0;
+    hart->reserved = 0;
+    return hart;
+}
+
+int harts_start(struct vm* vm, int hart_num, uint64_t max_instructions) {
+    struct hart_group* group = (struct hart_group*)calloc(1, sizeof(struct hart_group));
+    if (group == NULL) {
+        return 0;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    // Routines that fail dump the registers under the lock they already hold
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&group->console_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_rwlock_init(&group->heap_lock, NULL);
+    atomic_init(&group->stopped, 0);
+    group->hart_num = hart_num < HART_MAX ? hart_num : HART_MAX;
+    group->max_instructions = max_instructions;
+
+    // The guard table is one hart's view, and other harts would change the heap under it
+    guard_free(vm);
+    // With every page already dirty the harts never write the page tracker, and vm_reset still restores memory
+    mark_dirty_range(vm, DATA_MEM_START, DATA_MEM_SIZE);
+    mark_dirty_range(vm, HEAP_START, HEAP_BANK_NUM * BANK_BLOCK_SIZE);
+    // The harts fetch through one decode cache, a program the host wrote to is decoded before they share it
+    predecode_instructs(vm);
+    vm->harts = group;
+    group->harts[0] = vm;
+
+    int started = 1;
+    while (started < group->hart_num) {
+        struct vm* hart = hart_create(vm, group, (uint32_t)started);
+        if (hart == NULL) {
+            break;
+        }
+        if (pthread_create(&group->threads[started], NULL, hart_main, hart) != 0) {
+            free(hart);
+            break;
+        }
+        group->harts[started++] = hart;
+    }
+    return started;
+}
+
+void harts_finish(struct vm* vm, int started) {
+    struct hart_group* group = vm->harts;
+    for (int i = 1; i < started; i++) {
+        pthread_join(group->threads[i], NULL);
+    }
+    if (group->stopper != 0) {
+        // The fault description and the final registers are those of the hart that stopped the machine
+        struct vm* stopper = group->harts[group->stopper];
+        vm->pc = stopper->pc;
+        vm->inst_len = stopper->inst_len;
+        memcpy(vm->reg_bank, stopper->reg_bank, sizeof(vm->reg_bank));
+    }
+    vm->status = group->status;
+    for (int i = 1; i < started; i++) {
+        vm->read_host_clock |= group->harts[i]->read_host_clock;
+        free(group->harts[i]);
+    }
+    pthread_mutex_destroy(&group->console_lock);
+    pthread_rwlock_destroy(&group->heap_lock);
+    vm->harts = NULL;
+    free(group);
+}
@@ -0,0 +1,114 @@
+#ifndef VM_HARTS_H
+#define VM_HARTS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_riskxvii.h"
+
+#define HART_SLICE 4096  // Instructions a hart runs between checks whether the machine has stopped
+
+struct hart_group {
+    struct vm* harts[HART_MAX];  // Hart 0 is the vm itself, the others are copies of it
+    pthread_t threads[HART_MAX];  // The host thread of each hart but hart 0, which runs on the caller's
+    int hart_num;
+    uint64_t max_instructions;   // Instruction budget of each hart, 0 for no limit
+    pthread_mutex_t console_lock;  // Recursive, held by console routines and fault dumps
+    pthread_rwlock_t heap_lock;    // Written by the heap routines, read by heap address checks
+    _Atomic int stopped;           // Set once the machine stops, the other harts leave at their next slice
+    enum vm_status status;         // Why the machine stopped, set with stopped
+    uint32_t stopper;              // The hart that stopped the machine
+};  // Harts running one program on one vm's data memory, heap and console
+
+/**
+ * Take the console lock of a hart group, a hart that finds the machine stopped leaves quietly
+ * @param vm The hart, nothing is done if it runs alone
+*/
+void hart_lock_console(struct vm* vm);
+
+/**
+ * Release the console lock once
+ * @param vm The hart, nothing is done if it runs alone
+*/
+void hart_unlock_console(struct vm* vm);
+
+/**
+ * Take the heap lock of a hart group
+ * @param vm The hart, nothing is done if it runs alone
+ * @param write 1 to change the heap, 0 to look at it
+*/
+void hart_lock_heap(struct vm* vm, int write);
+
+/**
+ * Release the heap lock
+ * @param vm The hart, nothing is done if it runs alone
+*/
+void hart_unlock_heap(struct vm* vm);
+
+/**
+ * Check whether a heap address is in an allocated chunk of the heap the harts share
+ * @param vm The hart
+ * @param address The heap address
+ * @return int 1 if it is, otherwise 0
+*/
+int hart_heap_address_valid(struct vm* vm, uint32_t address);
+
+/**
+ * Stop the machine if a hart's stop ends it: any stop of hart 0, and faults of the others, whose
+ * halts only end themselves. Releases the console lock, called by vm_stop before it returns to vm_run
+ * @param vm The hart
+ * @param status Why the hart stopped
+*/
+void hart_stop(struct vm* vm, enum vm_status status);
+
+/**
+ * Mark the machine as stopped by a hart, unless another hart stopped it first
+ * @param group The hart group
+ * @param vm The hart
+ * @param status Why the machine stops
+*/
+void stop_machine(struct hart_group* group, struct vm* vm, enum vm_status status);
+
+/**
+ * Run a hart in slices until it stops, the machine stops or its budget runs out
+ * @param vm The hart
+*/
+void hart_run(struct vm* vm);
+
+/**
+ * Thread body of every hart but hart 0
+ * @param context The hart
+ * @return void* NULL
+*/
+void* hart_main(void* context);
+
+/**
+ * Copy a vm into a new hart that shares its data memory, heap and console, tools stay with hart 0
+ * @param vm The vm
+ * @param group The hart group
+ * @param hart_id The id of the new hart
+ * @return struct vm* The hart, or NULL if it could not be allocated
+*/
+struct vm* hart_create(struct vm* vm, struct hart_group* group, uint32_t hart_id);
+
+/**
+ * Start a vm's harts, hart 0 is the vm itself and is left for the caller to run
+ * @param vm The vm
+ * @param hart_num The number of harts, at most HART_MAX
+ * @param max_instructions The instruction budget of each hart, 0 for no limit
+ * @return int The number of harts started, hart 0 included, fewer if the host could not start them all,
+ *         0 if the hart group could not be allocated
+*/
+int harts_start(struct vm* vm, int hart_num, uint64_t max_instructions);
+
+/**
+ * Join the threads of the harts that were started and free their copies and the group
+ * @param vm The vm
+ * @param started The number of harts whose threads were started, hart 0 included
+*/
+void harts_finish(struct vm* vm, int started);
+
+#endif
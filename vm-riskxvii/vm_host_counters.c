@@ -0,0 +1,120 @@
+#define _DEFAULT_SOURCE  // For syscall
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "vm_host_counters.h"
+
+int host_counters_open(struct host_counters* counters, const char* output) {
+    const struct host_counter events[HOST_COUNTER_NUM] = {
+        {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1, 0, 0},
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1, 0, 0},
+        {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1, 0, 0},
+        {"L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+         PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), -1,
+         0, 0},
+    };
+    memcpy(counters->counters, events, sizeof(events));
+    counters->output = output;
+
+    int opened = 0;
+    for (int i = 0; i < HOST_COUNTER_NUM; i++) {
+        host_counter_open(&counters->counters[i]);
+        opened += counters->counters[i].fd >= 0;
+    }
+    return opened;
+}
+
+void host_counter_open(struct host_counter* counter) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter->type;
+    attr.config = counter->config;
+    attr.disabled = 1;
+    // User space only, which a perf_event_paranoid of 2 still allows, and the interpreter never leaves it to run
+    // an instruction
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Counters are not grouped, so one the CPU lacks does not take the others with it, but they may then be
+    // multiplexed, which the enabled and running times scale back
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    counter->fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    counter->error = counter->fd < 0 ? errno : 0;
+}
+
+void host_counters_start(struct host_counters* counters) {
+    for (int i = 0; i < HOST_COUNTER_NUM; i++) {
+        if (counters->counters[i].fd >= 0) {
+            ioctl(counters->counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void host_counters_stop(struct host_counters* counters) {
+    for (int i = 0; i < HOST_COUNTER_NUM; i++) {
+        if (counters->counters[i].fd >= 0) {
+            ioctl(counters->counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (int i = 0; i < HOST_COUNTER_NUM; i++) {
+        struct host_counter* counter = &counters->counters[i];
+        if (counter->fd < 0) {
+            continue;
+        }
+        uint64_t data[3];  // The count, then the times the counter was enabled and running
+        if (read(counter->fd, data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0) {
+            // Never on the hardware, the count says nothing
+            counter->error = EOPNOTSUPP;
+            close(counter->fd);
+            counter->fd = -1;
+            continue;
+        }
+        counter->value = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+    }
+}
+
+void host_counters_report(struct host_counters* counters, uint64_t guest_instructions) {
+    FILE* out = (strcmp(counters->output, "-") == 0) ? stdout : fopen(counters->output, "w");
+    if (out == NULL) {
+        perror("Error opening host counters report");
+        return;
+    }
+
+    fprintf(out, "Host counters, user space: %llu guest instructions\n", (unsigned long long)guest_instructions);
+    for (int i = 0; i < HOST_COUNTER_NUM; i++) {
+        struct host_counter* counter = &counters->counters[i];
+        if (counter->fd < 0) {
+            fprintf(out, "  %s: unavailable (%s)\n", counter->name, strerror(counter->error));
+        } else if (guest_instructions) {
+            fprintf(out, "  %s: %llu, %.4f per guest instruction\n", counter->name,
+                    (unsigned long long)counter->value, (double)counter->value / guest_instructions);
+        } else {
+            fprintf(out, "  %s: %llu\n", counter->name, (unsigned long long)counter->value);
+        }
+    }
+    struct host_counter* cycles = &counters->counters[HOST_CYCLES];
+    struct host_counter* instructions = &counters->counters[HOST_INSTRUCTIONS];
+    if (cycles->fd >= 0 && instructions->fd >= 0 && cycles->value) {
+        fprintf(out, "  host IPC: %.2f\n", (double)instructions->value / cycles->value);
+    } else {
+        fprintf(out, "  host IPC: unavailable\n");
+    }
+
+    if (out == stdout) {
+        fflush(out);
+    } else {
+        fclose(out);
+    }
+}
+
+void host_counters_close(struct host_counters* counters) {
+    for (int i = 0; i < HOST_COUNTER_NUM; i++) {
+        if (counters->counters[i].fd >= 0) {
+            close(counters->counters[i].fd);
+            counters->counters[i].fd = -1;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef VM_HOST_COUNTERS_H
+#define VM_HOST_COUNTERS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libriskxvii.h"
+
+enum HostCounter {
+    HOST_CYCLES,
+    HOST_INSTRUCTIONS,
+    HOST_BRANCH_MISSES,
+    HOST_L1D_MISSES,
+    HOST_COUNTER_NUM
+};  // The host hardware events counted around a run
+
+struct host_counter {
+    const char* name;  // How the report names the event
+    uint32_t type;     // The perf event type
+    uint64_t config;   // The perf event within its type
+    int fd;            // The open counter, -1 when the host does not provide it
+    int error;         // Why the counter could not be opened
+    uint64_t value;    // Events over the run, scaled up if the kernel shared the hardware counter with others
+};  // One host hardware event
+
+struct host_counters {
+    struct host_counter counters[HOST_COUNTER_NUM];
+    const char* output;  // Report file, - for stdout
+};  // Hardware counters of the interpreter thread, enabled only while the guest runs
+
+/**
+ * Open the host counters of the calling thread, disabled. Counters the host does not provide, because of the
+ * kernel, its perf_event_paranoid setting or a virtualised CPU, are left out of the report
+ * @param counters The counters
+ * @param output Report file, - for stdout
+ * @return int The number of counters opened
+*/
+int host_counters_open(struct host_counters* counters, const char* output);
+
+/**
+ * Open one host counter of the calling thread, disabled
+ * @param counter The counter, whose type and config are set
+*/
+void host_counter_open(struct host_counter* counter);
+
+/**
+ * Zero and enable every open counter, right before the run
+ * @param counters The counters
+*/
+void host_counters_start(struct host_counters* counters);
+
+/**
+ * Disable every open counter and read its value, right after the run
+ * @param counters The counters
+*/
+void host_counters_stop(struct host_counters* counters);
+
+/**
+ * Write the counters and what they mean per guest instruction
+ * @param counters The counters
+ * @param guest_instructions Instructions the guest retired over the run
+*/
+void host_counters_report(struct host_counters* counters, uint64_t guest_instructions);
+
+/**
+ * Close every open counter
+ * @param counters The counters
+*/
+void host_counters_close(struct host_counters* counters);
+
+#endif
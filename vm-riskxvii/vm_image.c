@@ -0,0 +1,297 @@
+#include "vm_image.h"
+#include "vm_program.h"
+
+uint32_t image_checksum(const unsigned char* data, size_t len) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (CRC32_POLY & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+int is_sectioned_image(const unsigned char* image, size_t size) {
+    return image != NULL && size >= IMAGE_HEADER_BYTES && memcmp(image, IMAGE_MAGIC, 4) == 0;
+}
+
+int load_memory_section(struct vm* vm, uint16_t type, uint32_t address, const unsigned char* payload, uint32_t len) {
+    uint32_t start;
+    uint32_t end;
+    unsigned char* region;
+    switch (type) {
+        case SECTION_CODE:
+            start = 0;
+            end = INST_MEM_SIZE;
+            region = vm->program->inst_mem;
+            break;
+        case SECTION_DATA:
+            start = DATA_MEM_START;
+            end = DATA_MEM_END + 1;
+            region = vm->memory.data_mem;
+            break;
+        default:
+            start = HEAP_START;
+            end = HEAP_END;
+            region = vm->heap_banks;
+            break;
+    }
+    if (address < start || address > end || len > end - address) {
+        return 0;
+    }
+    memcpy(region + (address - start), payload, len);
+    return 1;
+}
+
+int load_sections(struct vm* vm, const unsigned char* image, size_t size) {
+    if (get_le(image + 4, 2) != IMAGE_VERSION ||
+        get_le(image + 8, 4) != image_checksum(image + IMAGE_HEADER_BYTES, size - IMAGE_HEADER_BYTES)) {
+        return 0;
+    }
+
+    uint32_t section_num = (uint32_t)get_le(image + 6, 2);
+    size_t offset = IMAGE_HEADER_BYTES;
+    for (uint32_t i = 0; i < section_num; i++) {
+        if (size - offset < SECTION_HEADER_BYTES) {
+            return 0;
+        }
+        const unsigned char* header = image + offset;
+        uint16_t type = (uint16_t)get_le(header, 2);
+        uint16_t flags = (uint16_t)get_le(header + 2, 2);
+        uint32_t address = (uint32_t)get_le(header + 4, 4);
+        uint32_t len = (uint32_t)get_le(header + 8, 4);
+        offset += SECTION_HEADER_BYTES;
+        // No flags are defined yet, a set one means a newer writer relies on something this loader lacks
+        if (flags != 0 || len > size - offset) {
+            return 0;
+        }
+        const unsigned char* payload = image + offset;
+        offset += len;
+
+        switch (type) {
+            case SECTION_CODE:
+            case SECTION_DATA:
+            case SECTION_HEAP:
+                if (!load_memory_section(vm, type, address, payload, len)) {
+                    return 0;
+                }
+                break;
+            case SECTION_REGS:
+                if (len != REG_NUM * 4) {
+                    return 0;
+                }
+                // x0 stays hardwired to zero
+                for (int reg = 1; reg < REG_NUM; reg++) {
+                    vm->reg_bank[reg] = (uint32_t)get_le(payload + 4 * reg, 4);
+                }
+                break;
+            case SECTION_ENTRY:
+                if (len != 4) {
+                    return 0;
+                }
+                vm->pc = (uint32_t)get_le(payload, 4);
+                break;
+            case SECTION_SYMBOLS:
+                for (uint32_t pos = 0; pos < len;) {
+                    const unsigned char* name = NULL;
+                    if (len - pos > 4) {
+                        name = (const unsigned char*)memchr(payload + pos + 4, '\0', len - pos - 4);
+                    }
+                    if (name == NULL) {
+                        return 0;
+                    }
+                    add_symbol(&vm->symbols, (uint32_t)get_le(payload + pos, 4), (const char*)payload + pos + 4);
+                    pos = (uint32_t)(name - payload) + 1;
+                }
+                sort_symbols(&vm->symbols);
+                break;
+            default:
+                return 0;
+        }
+    }
+    return offset == size;
+}
+
+int is_elf_image(const unsigned char* image, size_t size) {
+    return image != NULL && size >= ELF_HEADER_BYTES && memcmp(image, ELF_MAGIC, 4) == 0;
+}
+
+int load_elf_segment(struct vm* vm, uint32_t address, const unsigned char* bytes, uint32_t file_len,
+                     uint32_t mem_len) {
+    uint64_t end = (uint64_t)address + mem_len;
+    if (file_len > mem_len) {
+        return 0;
+    }
+    // The vm starts zeroed, so the bytes past the file, like .bss, are only checked to fit
+    if (address >= HEAP_START) {
+        return end <= HEAP_END && load_memory_section(vm, SECTION_HEAP, address, bytes, file_len);
+    }
+    if (end > VM_IMAGE_SIZE) {
+        return 0;
+    }
+    // Text and data linked back to back may share one segment, which is split where data memory starts
+    uint32_t code_len = 0;
+    if (address < DATA_MEM_START) {
+        code_len = file_len < DATA_MEM_START - address ? file_len : DATA_MEM_START - address;
+        if (!load_memory_section(vm, SECTION_CODE, address, bytes, code_len)) {
+            return 0;
+        }
+    }
+    return code_len == file_len ||
+           load_memory_section(vm, SECTION_DATA, address + code_len, bytes + code_len, file_len - code_len);
+}
+
+int load_elf_symbols(struct vm* vm, const unsigned char* image, size_t size, const unsigned char* symtab) {
+    uint32_t shoff = (uint32_t)get_le(image + 32, 4);
+    uint32_t shnum = (uint32_t)get_le(image + 48, 2);
+    uint32_t offset = (uint32_t)get_le(symtab + 16, 4);
+    uint32_t len = (uint32_t)get_le(symtab + 20, 4);
+    uint32_t link = (uint32_t)get_le(symtab + 24, 4);
+    if (link >= shnum || offset > size || len > size - offset) {
+        return 0;
+    }
+    const unsigned char* strtab = image + shoff + (size_t)link * ELF_SHDR_BYTES;
+    uint32_t str_offset = (uint32_t)get_le(strtab + 16, 4);
+    uint32_t str_len = (uint32_t)get_le(strtab + 20, 4);
+    if (str_offset > size || str_len > size - str_offset) {
+        return 0;
+    }
+    const char* names = (const char*)image + str_offset;
+
+    // Entry 0 is the null symbol
+    for (uint32_t pos = ELF_SYM_BYTES; pos + ELF_SYM_BYTES <= len; pos += ELF_SYM_BYTES) {
+        const unsigned char* sym = image + offset + pos;
+        uint32_t name = (uint32_t)get_le(sym, 4);
+        uint32_t type = sym[12] & 0xF;
+        uint32_t shndx = (uint32_t)get_le(sym + 14, 2);
+        // Undefined and absolute symbols are not addresses in the program, '$' names are RISC-V mapping symbols
+        if (type > STT_FUNC || shndx == 0 || shndx >= SHN_LORESERVE || name >= str_len || names[name] == '\0' ||
+            names[name] == '$' || memchr(names + name, '\0', str_len - name) == NULL) {
+            continue;
+        }
+        add_symbol(&vm->symbols, (uint32_t)get_le(sym + 4, 4), names + name);
+    }
+    sort_symbols(&vm->symbols);
+    return 1;
+}
+
+int load_elf(struct vm* vm, const unsigned char* image, size_t size) {
+    if (image[4] != ELFCLASS32 || image[5] != ELFDATA2LSB || get_le(image + 16, 2) != ET_EXEC ||
+        get_le(image + 18, 2) != EM_RISCV) {
+        return 0;
+    }
+    uint32_t entry = (uint32_t)get_le(image + 24, 4);
+    uint32_t phoff = (uint32_t)get_le(image + 28, 4);
+    uint32_t shoff = (uint32_t)get_le(image + 32, 4);
+    uint32_t phnum = (uint32_t)get_le(image + 44, 2);
+    uint32_t shnum = (uint32_t)get_le(image + 48, 2);
+    if (entry >= INST_MEM_SIZE || get_le(image + 42, 2) != ELF_PHDR_BYTES || phoff > size ||
+        (size_t)phnum * ELF_PHDR_BYTES > size - phoff) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < phnum; i++) {
+        const unsigned char* phdr = image + phoff + i * ELF_PHDR_BYTES;
+        uint32_t offset = (uint32_t)get_le(phdr + 4, 4);
+        uint32_t file_len = (uint32_t)get_le(phdr + 16, 4);
+        uint32_t mem_len = (uint32_t)get_le(phdr + 20, 4);
+        if (get_le(phdr, 4) != PT_LOAD || mem_len == 0) {
+            continue;
+        }
+        if (offset > size || file_len > size - offset ||
+            !load_elf_segment(vm, (uint32_t)get_le(phdr + 8, 4), image + offset, file_len, mem_len)) {
+            return 0;
+        }
+    }
+    vm->pc = entry;
+
+    // Section headers are optional in an executable, stripped files simply have no symbols
+    if (shnum == 0 || get_le(image + 46, 2) != ELF_SHDR_BYTES || shoff > size ||
+        (size_t)shnum * ELF_SHDR_BYTES > size - shoff) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < shnum; i++) {
+        const unsigned char* shdr = image + shoff + i * ELF_SHDR_BYTES;
+        if (get_le(shdr + 4, 4) == SHT_SYMTAB) {
+            return load_elf_symbols(vm, image, size, shdr);
+        }
+    }
+    return 1;
+}
+
+void append_section(struct byte_buffer* out, uint16_t type, uint32_t address, const void* payload, uint32_t len) {
+    unsigned char header[SECTION_HEADER_BYTES];
+    put_le(header, type, 2);
+    put_le(header + 2, 0, 2);
+    put_le(header + 4, address, 4);
+    put_le(header + 8, len, 4);
+    buffer_append(out, header, sizeof(header));
+    buffer_append(out, payload, len);
+    // The section count lives in the image header
+    put_le(out->data + 6, get_le(out->data + 6, 2) + 1, 2);
+}
+
+void append_memory_sections(struct byte_buffer* out, uint16_t type, uint32_t address, const unsigned char* bytes,
+                            uint32_t len) {
+    uint32_t pos = 0;
+    while (pos < len) {
+        while (pos < len && bytes[pos] == 0) {
+            pos++;
+        }
+        if (pos == len) {
+            break;
+        }
+        // Extend the stretch over short zero runs, a section header costs more than they do
+        uint32_t end = pos;
+        uint32_t zeros = 0;
+        for (uint32_t i = pos; i < len && zeros < IMAGE_ZERO_GAP; i++) {
+            zeros = bytes[i] ? 0 : zeros + 1;
+            if (bytes[i]) {
+                end = i + 1;
+            }
+        }
+        append_section(out, type, address + pos, bytes + pos, end - pos);
+        pos = end;
+    }
+}
+
+void save_sectioned_image(const struct vm* vm, struct byte_buffer* out) {
+    buffer_clear(out);
+    unsigned char header[IMAGE_HEADER_BYTES] = {0};
+    memcpy(header, IMAGE_MAGIC, 4);
+    put_le(header + 4, IMAGE_VERSION, 2);
+    buffer_append(out, header, sizeof(header));
+
+    append_memory_sections(out, SECTION_CODE, 0, vm->program->inst_mem, INST_MEM_SIZE);
+    append_memory_sections(out, SECTION_DATA, DATA_MEM_START, vm->memory.data_mem, DATA_MEM_SIZE);
+    append_memory_sections(out, SECTION_HEAP, HEAP_START, vm->heap_banks, HEAP_BANK_NUM * BANK_BLOCK_SIZE);
+
+    unsigned char regs[REG_NUM * 4];
+    int any_reg = 0;
+    for (int reg = 0; reg < REG_NUM; reg++) {
+        put_le(regs + 4 * reg, vm->reg_bank[reg], 4);
+        any_reg |= vm->reg_bank[reg] != 0;
+    }
+    if (any_reg) {
+        append_section(out, SECTION_REGS, 0, regs, sizeof(regs));
+    }
+    if (vm->pc != 0) {
+        unsigned char entry[4];
+        put_le(entry, vm->pc, 4);
+        append_section(out, SECTION_ENTRY, 0, entry, sizeof(entry));
+    }
+    if (vm->symbols.count > 0) {
+        struct byte_buffer names = {0};
+        for (int i = 0; i < vm->symbols.count; i++) {
+            unsigned char address[4];
+            put_le(address, vm->symbols.symbols[i].address, 4);
+            buffer_append(&names, address, sizeof(address));
+            buffer_append(&names, vm->symbols.symbols[i].name, strlen(vm->symbols.symbols[i].name) + 1);
+        }
+        append_section(out, SECTION_SYMBOLS, 0, names.data, (uint32_t)names.len);
+        free(names.data);
+    }
+
+    put_le(out->data + 8, image_checksum(out->data + IMAGE_HEADER_BYTES, out->len - IMAGE_HEADER_BYTES), 4);
+}
@@ -0,0 +1,147 @@
+#ifndef VM_IMAGE_H
+#define VM_IMAGE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_riskxvii.h"
+#include "vm_buffer.h"
+
+#define IMAGE_MAGIC "RXVI"
+#define IMAGE_VERSION 1
+#define IMAGE_HEADER_BYTES 12      // Magic, 2-byte version, 2-byte section count and 4-byte checksum
+#define SECTION_HEADER_BYTES 12    // 2-byte type, 2-byte flags, 4-byte address and 4-byte length
+#define IMAGE_MAX_BYTES (1 << 20)  // Longest image file read
+#define IMAGE_ZERO_GAP 16          // Zero runs at least this long are left out of memory sections
+#define CRC32_POLY 0xEDB88320u
+
+#define ELF_MAGIC "\x7f" "ELF"
+#define ELF_HEADER_BYTES 52   // ELF32 file header
+#define ELF_PHDR_BYTES 32     // ELF32 program header
+#define ELF_SHDR_BYTES 40     // ELF32 section header
+#define ELF_SYM_BYTES 16      // ELF32 symbol table entry
+#define ELFCLASS32 1
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define EM_RISCV 243
+#define PT_LOAD 1
+#define SHT_SYMTAB 2
+#define SHN_LORESERVE 0xff00  // Section indexes from here on are special, e.g. absolute symbols
+#define STT_FUNC 2            // Symbol types up to this one name code or data, the later ones are not kept
+
+enum SectionType {
+    SECTION_CODE = 1,     // Instruction memory bytes at the section address
+    SECTION_DATA = 2,     // Data memory bytes at the section address
+    SECTION_HEAP = 3,     // Initial heap bank contents at the section address
+    SECTION_REGS = 4,     // 32 little endian registers, x0 is ignored
+    SECTION_ENTRY = 5,    // The little endian entry pc
+    SECTION_SYMBOLS = 6   // Pairs of a little endian address and a NUL terminated name
+};  // What a section of a sectioned image holds, memory not covered by any section is zero
+
+/**
+ * Compute the CRC-32 of a byte range, as used by zlib
+ * @param data The bytes
+ * @param len The number of bytes
+ * @return uint32_t The checksum
+*/
+uint32_t image_checksum(const unsigned char* data, size_t len);
+
+/**
+ * Check whether image bytes start with the sectioned image header rather than a legacy memory dump
+ * @param image The image bytes
+ * @param size The number of bytes
+ * @return int 1 if the image is sectioned, otherwise 0
+*/
+int is_sectioned_image(const unsigned char* image, size_t size);
+
+/**
+ * Copy a code, data or heap section into memory
+ * @param vm The vm
+ * @param type The section type
+ * @param address The guest address of the first byte
+ * @param payload The bytes
+ * @param len The number of bytes
+ * @return int 1 if the section fits in its memory region, otherwise 0
+*/
+int load_memory_section(struct vm* vm, uint16_t type, uint32_t address, const unsigned char* payload, uint32_t len);
+
+/**
+ * Load a sectioned image into a freshly reset vm, only the bytes held in sections are written
+ * @param vm The vm
+ * @param image The image bytes
+ * @param size The number of bytes
+ * @return int 1 if successful, 0 if the version, checksum or any section is invalid
+*/
+int load_sections(struct vm* vm, const unsigned char* image, size_t size);
+
+/**
+ * Check whether image bytes start with an ELF header rather than a legacy memory dump
+ * @param image The image bytes
+ * @param size The number of bytes
+ * @return int 1 if the image is an ELF file, otherwise 0
+*/
+int is_elf_image(const unsigned char* image, size_t size);
+
+/**
+ * Copy a loadable ELF segment into memory, a segment may run from instruction into data memory
+ * @param vm The vm
+ * @param address The guest address of the segment
+ * @param bytes The bytes held in the file
+ * @param file_len The number of bytes held in the file
+ * @param mem_len The size of the segment in memory, the bytes past file_len are zero
+ * @return int 1 if the whole segment fits in instruction and data memory or in the heap, otherwise 0
+*/
+int load_elf_segment(struct vm* vm, uint32_t address, const unsigned char* bytes, uint32_t file_len,
+                     uint32_t mem_len);
+
+/**
+ * Load the function and object names of an ELF symbol table into the vm's symbols
+ * @param vm The vm
+ * @param image The ELF bytes
+ * @param size The number of bytes
+ * @param symtab The section header of the symbol table
+ * @return int 1 if successful, 0 if the table or its string table is outside the file
+*/
+int load_elf_symbols(struct vm* vm, const unsigned char* image, size_t size, const unsigned char* symtab);
+
+/**
+ * Load a riscv32 ELF executable into a freshly reset vm: the PT_LOAD segments go to memory at their
+ * addresses, the entry pc is the ELF entry and the symbol table, if any, names the code
+ * @param vm The vm
+ * @param image The ELF bytes
+ * @param size The number of bytes
+ * @return int 1 if successful, 0 if the file is not a little endian riscv32 executable or a segment
+ *         does not fit the address map
+*/
+int load_elf(struct vm* vm, const unsigned char* image, size_t size);
+
+/**
+ * Append one section to an image being built
+ * @param out The image
+ * @param type The section type
+ * @param address The section address, 0 for sections that are not memory
+ * @param payload The section bytes
+ * @param len The number of bytes
+*/
+void append_section(struct byte_buffer* out, uint16_t type, uint32_t address, const void* payload, uint32_t len);
+
+/**
+ * Append a memory region as sections of its non-zero stretches, splitting at long runs of zeros
+ * @param out The image
+ * @param type The section type
+ * @param address The guest address of the region
+ * @param bytes The region contents
+ * @param len The region size
+*/
+void append_memory_sections(struct byte_buffer* out, uint16_t type, uint32_t address, const unsigned char* bytes,
+                            uint32_t len);
+
+/**
+ * Build a sectioned image of the memory, registers, pc and symbols of a vm that has not run
+ * @param vm The vm
+ * @param out The buffer the image is written into, replacing its contents
+*/
+void save_sectioned_image(const struct vm* vm, struct byte_buffer* out);
+
+#endif
@@ -0,0 +1,105 @@
+#define _POSIX_C_SOURCE 200809L  // For fstat and mmap
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "vm_input.h"
+
+int input_map(struct vm* vm, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    if ((uint64_t)st.st_size > INPUT_WINDOW_SIZE) {
+        close(fd);
+        errno = EFBIG;
+        return 0;
+    }
+    struct input_device* input = (struct input_device*)calloc(1, sizeof(struct input_device));
+    if (input == NULL) {
+        close(fd);
+        return 0;
+    }
+    input->len = (uint32_t)st.st_size;
+    // An empty file cannot be mapped and has nothing to read anyway
+    if (input->len > 0) {
+        void* data = mmap(NULL, input->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            free(input);
+            close(fd);
+            return 0;
+        }
+        input->data = (const unsigned char*)data;
+    }
+    // The mapping outlives the descriptor
+    close(fd);
+    input_free(vm);
+    vm->input = input;
+    return 1;
+}
+
+void input_free(struct vm* vm) {
+    struct input_device* input = vm->input;
+    if (input == NULL) {
+        return;
+    }
+    if (input->data) {
+        munmap((void*)input->data, input->len);
+    }
+    free(input);
+    vm->input = NULL;
+}
+
+uint32_t input_load(struct vm* vm, uint32_t address, uint32_t size, union instruction instruct) {
+    const unsigned char* p = input_range(vm, address, size);
+    if (p == NULL) {
+        illegal_operation(vm, instruct);
+    }
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        value |= (uint32_t)p[i] << (i * 8);
+    }
+    return value;
+}
+
+const unsigned char* input_range(struct vm* vm, uint32_t address, uint64_t len) {
+    struct input_device* input = vm->input;
+    uint64_t offset = address - INPUT_WINDOW_START;
+    if (input == NULL || offset + len > input->len) {
+        return NULL;
+    }
+    return input->data + offset;
+}
+
+uint32_t input_read_routine(struct vm* vm, uint32_t address) {
+    struct input_device* input = vm->input;
+    if (input == NULL) {
+        // Without a file the device reads as an empty one
+        return address == VR_INPUT_READ_CHAR ? 0xFFFFFFFF : 0;
+    }
+    switch (address) {
+        case VR_INPUT_LENGTH:
+            return input->len;
+        case VR_INPUT_CURSOR:
+            return input->cursor;
+        default:
+            if (input->cursor >= input->len) {
+                return 0xFFFFFFFF;
+            }
+            return input->data[input->cursor++];
+    }
+}
+
+void input_seek(struct vm* vm, uint32_t cursor) {
+    struct input_device* input = vm->input;
+    if (input == NULL) {
+        return;
+    }
+    input->cursor = cursor < input->len ? cursor : input->len;
+}
@@ -0,0 +1,64 @@
+#ifndef VM_INPUT_H
+#define VM_INPUT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_riskxvii.h"
+
+struct input_device {
+    const unsigned char* data;  // The file mapped read only, NULL if it is empty
+    uint32_t len;               // Bytes in the window, the file's size
+    uint32_t cursor;            // Offset the guest reads next through VR_INPUT_READ_CHAR, kept for it otherwise
+};  // A host file mapped into the guest address space at INPUT_WINDOW_START
+
+/**
+ * Map a host file read only into a vm's input window, replacing any file mapped before
+ * @param vm The vm
+ * @param path The file
+ * @return int 1 if successful, 0 if the file could not be opened, mapped or is larger than the window
+*/
+int input_map(struct vm* vm, const char* path);
+
+/**
+ * Unmap the input file of a vm
+ * @param vm The vm, nothing is done if no file is mapped
+*/
+void input_free(struct vm* vm);
+
+/**
+ * Read 1, 2 or 4 little endian bytes of the input window, every byte must be in the file
+ * @param vm The vm
+ * @param address The guest address, at least INPUT_WINDOW_START
+ * @param size The number of bytes
+ * @param instruct The instruction, an illegal operation if a byte is past the end of the file
+ * @return uint32_t The bytes
+*/
+uint32_t input_load(struct vm* vm, uint32_t address, uint32_t size, union instruction instruct);
+
+/**
+ * Find the host memory behind a range of the input window, for vector instructions
+ * @param vm The vm
+ * @param address The guest address, at least INPUT_WINDOW_START
+ * @param len The number of bytes, at least 1
+ * @return const unsigned char* Host address of the first byte, NULL if the range is not all in the file
+*/
+const unsigned char* input_range(struct vm* vm, uint32_t address, uint64_t len);
+
+/**
+ * Read one of the input device routines
+ * @param vm The vm
+ * @param address VR_INPUT_LENGTH, VR_INPUT_CURSOR or VR_INPUT_READ_CHAR
+ * @return uint32_t The file length, the cursor, or the byte at the cursor, which moves on, 0xFFFFFFFF past the end
+*/
+uint32_t input_read_routine(struct vm* vm, uint32_t address);
+
+/**
+ * Move the cursor, a write to VR_INPUT_CURSOR
+ * @param vm The vm
+ * @param cursor The new cursor, kept at most at the file length
+*/
+void input_seek(struct vm* vm, uint32_t cursor);
+
+#endif
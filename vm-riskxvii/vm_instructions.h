@@ -0,0 +1,110 @@
+#ifndef VM_INSTRUCTIONS_H
+#define VM_INSTRUCTIONS_H
+
+// The opcodes the vm decodes, with the func3 and func7 bits that tell their instructions apart
+// name, func3 mask, func7 mask
+#define OPCODE_TABLE(X)          \
+    X(R_TYPE, 0x7, 0x7F)         \
+    X(I_TYPE_ONE, 0x7, 0x0)      \
+    X(I_TYPE_TWO, 0x7, 0x0)      \
+    X(I_TYPE_THREE, 0x7, 0x0)    \
+    X(S_TYPE, 0x7, 0x0)          \
+    X(SB_TYPE, 0x7, 0x0)         \
+    X(U_TYPE, 0x0, 0x0)          \
+    X(UJ_TYPE, 0x0, 0x0)          \
+    X(AMO_TYPE, 0x7, 0x7C)       \
+    X(CUSTOM_0, 0x7, 0x7F)       \
+    X(CUSTOM_1, 0x7, 0x3)
+
+// Every instruction the vm executes, the single source of the decoder, the handlers and the disassembler.
+// The semantics are C statements over the operand vocabulary defined next to execute_instruct:
+// RD, RS1, RS2, RS3 and IMM, the signed SRS1, SRS2 and SIMM, the effective address ADDR, and the pc updates
+// NEXT, BRANCH(taken) and LINK_AND_JUMP(target), AMO(operation) on the word at rs1 with rs2, and
+// PACKED(operation, lane_bits) on the lanes of rs1 and rs2.
+// mnemonic, format, opcode, func3, func7, required extensions, semantics
+#define INSTRUCTION_TABLE(X)                                                                                 \
+    X(add, R, R_TYPE, 0b000, 0b0000000, 0, RD = RS1 + RS2; NEXT)                                           \
+    X(sub, R, R_TYPE, 0b000, 0b0100000, 0, RD = RS1 - RS2; NEXT)                                           \
+    X(xor, R, R_TYPE, 0b100, 0b0000000, 0, RD = RS1 ^ RS2; NEXT)                                           \
+    X(or, R, R_TYPE, 0b110, 0b0000000, 0, RD = RS1 | RS2; NEXT)                                            \
+    X(and, R, R_TYPE, 0b111, 0b0000000, 0, RD = RS1 & RS2; NEXT)                                           \
+    X(sll, R, R_TYPE, 0b001, 0b0000000, 0, RD = RS1 << RS2; NEXT)                                          \
+    X(srl, R, R_TYPE, 0b101, 0b0000000, 0, RD = RS1 >> RS2; NEXT)                                          \
+    /* sra rotates right rather than shifting in sign bits */                                               \
+    X(sra, R, R_TYPE, 0b101, 0b0100000, 0,                                                                 \
+      RD = (RS1 >> (RS2 % WORD_BITS)) | (RS1 << (WORD_BITS - RS2 % WORD_BITS)); NEXT)                      \
+    X(slt, R, R_TYPE, 0b010, 0b0000000, 0, RD = (SRS1 < SRS2) ? 1 : 0; NEXT)                               \
+    X(sltu, R, R_TYPE, 0b011, 0b0000000, 0, RD = (RS1 < RS2) ? 1 : 0; NEXT)                                \
+    /* Division by zero and signed overflow never trap, the results follow the RISC-V spec */              \
+    X(mul, R, R_TYPE, 0b000, 0b0000001, EXT_M, RD = RS1 * RS2; NEXT)                                       \
+    X(mulh, R, R_TYPE, 0b001, 0b0000001, EXT_M, RD = (uint32_t)(((int64_t)SRS1 * (int64_t)SRS2) >> 32); NEXT) \
+    X(mulhsu, R, R_TYPE, 0b010, 0b0000001, EXT_M,                                                          \
+      RD = (uint32_t)(((int64_t)SRS1 * (int64_t)RS2) >> 32); NEXT)                                         \
+    X(mulhu, R, R_TYPE, 0b011, 0b0000001, EXT_M,                                                           \
+      RD = (uint32_t)(((uint64_t)RS1 * (uint64_t)RS2) >> 32); NEXT)                                        \
+    X(div, R, R_TYPE, 0b100, 0b0000001, EXT_M,                                                             \
+      RD = (SRS2 == 0) ? 0xFFFFFFFF                                                                        \
+           : (SRS1 == INT32_MIN && SRS2 == -1) ? (uint32_t)INT32_MIN : (uint32_t)(SRS1 / SRS2); NEXT)       \
+    X(divu, R, R_TYPE, 0b101, 0b0000001, EXT_M, RD = (RS2 == 0) ? 0xFFFFFFFF : RS1 / RS2; NEXT)            \
+    X(rem, R, R_TYPE, 0b110, 0b0000001, EXT_M,                                                             \
+      RD = (SRS2 == 0) ? RS1 : (SRS1 == INT32_MIN && SRS2 == -1) ? 0 : (uint32_t)(SRS1 % SRS2); NEXT)      \
+    X(remu, R, R_TYPE, 0b111, 0b0000001, EXT_M, RD = (RS2 == 0) ? RS1 : RS1 % RS2; NEXT)                   \
+    X(addi, I, I_TYPE_ONE, 0b000, 0, 0, RD = RS1 + IMM; NEXT)                                              \
+    X(xori, I, I_TYPE_ONE, 0b100, 0, 0, RD = RS1 ^ IMM; NEXT)                                              \
+    X(ori, I, I_TYPE_ONE, 0b110, 0, 0, RD = RS1 | IMM; NEXT)                                               \
+    X(andi, I, I_TYPE_ONE, 0b111, 0, 0, RD = RS1 & IMM; NEXT)                                              \
+    X(slti, I, I_TYPE_ONE, 0b010, 0, 0, RD = (SRS1 < SIMM) ? 1 : 0; NEXT)                                  \
+    X(sltiu, I, I_TYPE_ONE, 0b011, 0, 0, RD = (RS1 < IMM) ? 1 : 0; NEXT)                                   \
+    X(lb, LOAD, I_TYPE_TWO, 0b000, 0, 0, RD = (uint32_t)(int32_t)(int8_t)load_byte(vm, ADDR, instruct); NEXT) \
+    X(lh, LOAD, I_TYPE_TWO, 0b001, 0, 0,                                                                   \
+      RD = (uint32_t)(int32_t)(int16_t)load_half_word(vm, ADDR, instruct); NEXT)                           \
+    X(lw, LOAD, I_TYPE_TWO, 0b010, 0, 0, RD = load_word(vm, ADDR, instruct); NEXT)                         \
+    X(lbu, LOAD, I_TYPE_TWO, 0b100, 0, 0, RD = (uint32_t)load_byte(vm, ADDR, instruct); NEXT)              \
+    X(lhu, LOAD, I_TYPE_TWO, 0b101, 0, 0, RD = (uint32_t)load_half_word(vm, ADDR, instruct); NEXT)         \
+    /* The link is written before rs1 is read, so jalr ra, 0(ra) jumps past itself */                       \
+    X(jalr, JALR, I_TYPE_THREE, 0b000, 0, 0, LINK_AND_JUMP(ADDR); PROFILE_CALL; PROFILE_RETURN)            \
+    X(sb, S, S_TYPE, 0b000, 0, 0, store_byte(vm, ADDR, (uint8_t)RS2, instruct); NEXT)                      \
+    X(sh, S, S_TYPE, 0b001, 0, 0, store_half_word(vm, ADDR, (uint16_t)RS2, instruct); NEXT)                \
+    X(sw, S, S_TYPE, 0b010, 0, 0, store_word(vm, ADDR, RS2, instruct); NEXT)                               \
+    X(beq, SB, SB_TYPE, 0b000, 0, 0, BRANCH(RS1 == RS2))                                                   \
+    X(bne, SB, SB_TYPE, 0b001, 0, 0, BRANCH(RS1 != RS2))                                                   \
+    X(blt, SB, SB_TYPE, 0b100, 0, 0, BRANCH(SRS1 < SRS2))                                                  \
+    X(bge, SB, SB_TYPE, 0b101, 0, 0, BRANCH(SRS1 >= SRS2))                                                 \
+    X(bltu, SB, SB_TYPE, 0b110, 0, 0, BRANCH(RS1 < RS2))                                                   \
+    X(bgeu, SB, SB_TYPE, 0b111, 0, 0, BRANCH(RS1 >= RS2))                                                  \
+    X(lui, U, U_TYPE, 0, 0, 0, RD = IMM; NEXT)                                                             \
+    X(jal, UJ, UJ_TYPE, 0, 0, 0, LINK_AND_JUMP(vm->pc + IMM); PROFILE_CALL)                                \
+    /* func7 is funct5 then the aq and rl bits, which are ignored as every atomic is sequentially consistent */ \
+    X(lr_w, LR, AMO_TYPE, 0b010, 0b0001000, EXT_A, RD = load_reserved(vm, RS1, instruct); NEXT)           \
+    X(sc_w, AMO, AMO_TYPE, 0b010, 0b0001100, EXT_A, RD = store_conditional(vm, RS1, RS2, instruct); NEXT) \
+    X(amoswap_w, AMO, AMO_TYPE, 0b010, 0b0000100, EXT_A, RD = AMO(ATOMIC_SWAP); NEXT)                      \
+    X(amoadd_w, AMO, AMO_TYPE, 0b010, 0b0000000, EXT_A, RD = AMO(ATOMIC_ADD); NEXT)                        \
+    X(amoxor_w, AMO, AMO_TYPE, 0b010, 0b0010000, EXT_A, RD = AMO(ATOMIC_XOR); NEXT)                        \
+    X(amoand_w, AMO, AMO_TYPE, 0b010, 0b0110000, EXT_A, RD = AMO(ATOMIC_AND); NEXT)                        \
+    X(amoor_w, AMO, AMO_TYPE, 0b010, 0b0100000, EXT_A, RD = AMO(ATOMIC_OR); NEXT)                          \
+    X(amomin_w, AMO, AMO_TYPE, 0b010, 0b1000000, EXT_A, RD = AMO(ATOMIC_MIN); NEXT)                        \
+    X(amomax_w, AMO, AMO_TYPE, 0b010, 0b1010000, EXT_A, RD = AMO(ATOMIC_MAX); NEXT)                        \
+    X(amominu_w, AMO, AMO_TYPE, 0b010, 0b1100000, EXT_A, RD = AMO(ATOMIC_MINU); NEXT)                      \
+    X(amomaxu_w, AMO, AMO_TYPE, 0b010, 0b1110000, EXT_A, RD = AMO(ATOMIC_MAXU); NEXT)                      \
+    /* Packed lanes in a register, func3 picks the operation and func7 the lane width */                     \
+    X(add8, R, CUSTOM_0, 0b000, 0b0000000, EXT_XSIMD, RD = PACKED(PACKED_ADD, 8); NEXT)                     \
+    X(sub8, R, CUSTOM_0, 0b001, 0b0000000, EXT_XSIMD, RD = PACKED(PACKED_SUB, 8); NEXT)                     \
+    X(smin8, R, CUSTOM_0, 0b010, 0b0000000, EXT_XSIMD, RD = PACKED(PACKED_SMIN, 8); NEXT)                   \
+    X(smax8, R, CUSTOM_0, 0b011, 0b0000000, EXT_XSIMD, RD = PACKED(PACKED_SMAX, 8); NEXT)                   \
+    X(umin8, R, CUSTOM_0, 0b100, 0b0000000, EXT_XSIMD, RD = PACKED(PACKED_UMIN, 8); NEXT)                   \
+    X(umax8, R, CUSTOM_0, 0b101, 0b0000000, EXT_XSIMD, RD = PACKED(PACKED_UMAX, 8); NEXT)                   \
+    X(add16, R, CUSTOM_0, 0b000, 0b0000001, EXT_XSIMD, RD = PACKED(PACKED_ADD, 16); NEXT)                   \
+    X(sub16, R, CUSTOM_0, 0b001, 0b0000001, EXT_XSIMD, RD = PACKED(PACKED_SUB, 16); NEXT)                   \
+    X(smin16, R, CUSTOM_0, 0b010, 0b0000001, EXT_XSIMD, RD = PACKED(PACKED_SMIN, 16); NEXT)                 \
+    X(smax16, R, CUSTOM_0, 0b011, 0b0000001, EXT_XSIMD, RD = PACKED(PACKED_SMAX, 16); NEXT)                 \
+    X(umin16, R, CUSTOM_0, 0b100, 0b0000001, EXT_XSIMD, RD = PACKED(PACKED_UMIN, 16); NEXT)                 \
+    X(umax16, R, CUSTOM_0, 0b101, 0b0000001, EXT_XSIMD, RD = PACKED(PACKED_UMAX, 16); NEXT)                 \
+    /* Words over memory: rd, rs1 and rs2 hold the addresses of the result and the operands, rs3 the count */ \
+    X(vadd_w, R4, CUSTOM_1, 0b000, 0b00, EXT_XSIMD,                                                        \
+      vector_memory_operation(vm, VECTOR_ADD, RD, RS1, RS2, RS3, instruct); NEXT)                          \
+    X(vsub_w, R4, CUSTOM_1, 0b001, 0b00, EXT_XSIMD,                                                        \
+      vector_memory_operation(vm, VECTOR_SUB, RD, RS1, RS2, RS3, instruct); NEXT)                          \
+    /* vdot.w writes the sum of the products to rd instead */                                               \
+    X(vdot_w, R4, CUSTOM_1, 0b010, 0b00, EXT_XSIMD, RD = vector_dot_product(vm, RS1, RS2, RS3, instruct); NEXT)
+
+#endif
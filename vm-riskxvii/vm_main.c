@@ -0,0 +1,313 @@
+#include <errno.h>
+#include "vm_riskxvii.h"
+#include "vm_profile.h"
+#include "vm_cache.h"
+#include "vm_pipeline.h"
+#include "vm_symbols.h"
+#include "vm_decode.h"
+#include "vm_server.h"
+#include "vm_result_cache.h"
+#include "vm_async_io.h"
+#include "vm_shadow.h"
+#include "vm_host_counters.h"
+
+int main(int argc, char* argv[]) {
+    const char* image = NULL;
+    const char* isa = NULL;
+    const char* profile = NULL;
+    const char* symbol_file = NULL;
+    uint32_t interval = PROFILE_DEFAULT_INTERVAL;
+    const char* icache = NULL;
+    const char* dcache = NULL;
+    const char* cache_output = "-";
+    const char* heap_report = NULL;
+    const char* pipeline = NULL;
+    const char* pipeline_output = "-";
+    const char* serve_socket = NULL;
+    const char* connect_socket = NULL;
+    int workers = SERVE_DEFAULT_WORKERS;
+    uint64_t budget = 0;
+    const char* cache_dir = NULL;
+    int disasm = 0;
+    int async_io = 0;
+    int guard_pages = 0;
+    int harts = 1;
+    const char* input_file = NULL;
+    uint64_t shadow = 0;
+    const char* host_counters = NULL;
+    int repeat = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--isa=", 6) == 0) {
+            isa = argv[i] + 6;
+            if (parse_isa(isa) < 0) {
+                printf("Unsupported ISA: %s\n", isa);
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profile = argv[i] + 10;
+        } else if (strncmp(argv[i], "--profile-interval=", 19) == 0) {
+            interval = (uint32_t)strtoul(argv[i] + 19, NULL, 0);
+        } else if (strncmp(argv[i], "--symbols=", 10) == 0) {
+            symbol_file = argv[i] + 10;
+        } else if (strncmp(argv[i], "--icache=", 9) == 0) {
+            icache = argv[i] + 9;
+        } else if (strncmp(argv[i], "--dcache=", 9) == 0) {
+            dcache = argv[i] + 9;
+        } else if (strncmp(argv[i], "--cache-report=", 15) == 0) {
+            cache_output = argv[i] + 15;
+        } else if (strncmp(argv[i], "--pipeline=", 11) == 0) {
+            pipeline = argv[i] + 11;
+        } else if (strncmp(argv[i], "--pipeline-report=", 18) == 0) {
+            pipeline_output = argv[i] + 18;
+        } else if (strncmp(argv[i], "--heap-stats=", 13) == 0) {
+            heap_report = argv[i] + 13;
+        } else if (strncmp(argv[i], "--budget=", 9) == 0) {
+            budget = strtoull(argv[i] + 9, NULL, 0);
+        } else if (strncmp(argv[i], "--cache-dir=", 12) == 0) {
+            cache_dir = argv[i] + 12;
+        } else if (strcmp(argv[i], "--guard-pages") == 0) {
+            guard_pages = 1;
+        } else if (strncmp(argv[i], "--harts=", 8) == 0) {
+            harts = atoi(argv[i] + 8);
+            if (harts < 1 || harts > HART_MAX) {
+                printf("Invalid hart count, expected 1 to %d\n", HART_MAX);
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "--input-file=", 13) == 0) {
+            input_file = argv[i] + 13;
+        } else if (strcmp(argv[i], "--shadow") == 0) {
+            shadow = SHADOW_DEFAULT_INTERVAL;
+        } else if (strncmp(argv[i], "--shadow=", 9) == 0) {
+            shadow = strtoull(argv[i] + 9, NULL, 0);
+            if (shadow == 0) {
+                printf("Invalid shadow interval, expected at least 1 instruction\n");
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "--host-counters=", 16) == 0) {
+            host_counters = argv[i] + 16;
+        } else if (strcmp(argv[i], "--async-io") == 0) {
+            async_io = 1;
+        } else if (strcmp(argv[i], "--disasm") == 0) {
+            disasm = 1;
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            serve_socket = argv[i] + 8;
+        } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+            workers = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+            repeat = atoi(argv[i] + 9);
+            if (repeat < 1) {
+                printf("Invalid repeat count, expected at least 1\n");
+                exit(1);
+            }
+        } else if (strncmp(argv[i], "--connect=", 10) == 0) {
+            connect_socket = argv[i] + 10;
+        } else {
+            image = argv[i];
+        }
+    }
+    if (serve_socket) {
+        return serve(serve_socket, workers);
+    }
+    if (image == NULL) {
+        printf("Usage: %s [--isa=rv32i[m][a][c][_xsimd]] [--profile=<file>] [--profile-interval=<n>] [--symbols=<file>] "
+               "[--icache=<size:line:ways>] [--dcache=<size:line:ways>] [--cache-report=<file>] "
+               "[--pipeline=<predictor[:load-use:penalty]>] [--pipeline-report=<file>] "
+               "[--heap-stats=<file>] [--budget=<n>] [--cache-dir=<dir>] [--async-io] [--guard-pages] [--harts=<n>] [--input-file=<file>] [--shadow[=<n>]] [--host-counters=<file>] [--connect=<socket> [--repeat=<n>]] <memory_image_binary>\n"
+               "       %s --disasm [--isa=rv32i[m][a][c][_xsimd]] [--symbols=<file>] <memory_image_binary>\n"
+               "       %s --serve=<socket> [--workers=<n>]\n", argv[0], argv[0], argv[0]);
+        exit(1);
+    }
+    if (connect_socket) {
+        // Only the image and stdin go to the daemon
+        if (input_file) {
+            printf("--input-file needs a local run\n");
+            exit(1);
+        }
+        if (shadow) {
+            printf("--shadow needs a local run\n");
+            exit(1);
+        }
+        if (host_counters) {
+            printf("--host-counters needs a local run\n");
+            exit(1);
+        }
+        struct run_stop stop;
+        if (!connect_run(connect_socket, image, isa, budget, repeat, &stop)) {
+            exit(1);
+        }
+        // Stderr reads as it would for a local run
+        if (stop.status == VM_INPUT_ERROR) {
+            errno = 0;  // The input ran out rather than failing
+            perror("Error scanf");
+        } else if (stop.status == VM_BUDGET_EXCEEDED) {
+            fprintf(stderr, "Error: %s\n", vm_status_name(stop.status));
+        } else if (stop.status == VM_ILLEGAL_OPERATION || stop.status == VM_NOT_IMPLEMENTED) {
+            size_t image_size;
+            unsigned char* image_bytes = read_memory_image(image, &image_size);
+            describe_image_stop(&stop, image_bytes, image_size, isa, symbol_file, stderr);
+            free(image_bytes);
+        }
+        return vm_exit_code(stop.status);
+    }
+
+    if (repeat > 1) {
+        printf("--repeat needs --connect\n");
+        exit(1);
+    }
+
+    // The reference steps a single hart
+    if (shadow && harts > 1) {
+        printf("--shadow runs a single hart\n");
+        exit(1);
+    }
+    // The counters follow the interpreter thread only
+    if (host_counters && harts > 1) {
+        printf("--host-counters runs a single hart\n");
+        exit(1);
+    }
+
+    // Initialze vm and start running
+    size_t image_size;
+    unsigned char* image_bytes = read_memory_image(image, &image_size);
+    if (image_bytes == NULL) {
+        perror("Error reading image");
+        exit(1);
+    }
+
+    // Reports need the run itself, harts interleave differently every run and the input file is not part of
+    // the key, so only plain runs go through the result cache
+    struct recording recording = {{0}};
+    uint64_t image_key = 0;
+    if (profile || heap_report || icache || dcache || pipeline || disasm || harts > 1 || input_file || shadow ||
+        host_counters) {
+        cache_dir = NULL;
+    }
+    if (cache_dir) {
+        // The whole input is needed up front to tell whether a cached run examined the same bytes
+        buffer_read_file(stdin, &recording.input);
+        image_key = result_image_key(image_bytes, image_size, isa, budget);
+        struct run_stop stop;
+        if (result_lookup(cache_dir, image_key, &recording.input, &recording.output, &stop)) {
+            fwrite(recording.output.data, 1, recording.output.len, stdout);
+            if (stop.status == VM_INPUT_ERROR) {
+                errno = 0;  // The input ran out rather than failing
+                perror("Error scanf");
+            } else if (stop.status == VM_BUDGET_EXCEEDED) {
+                fprintf(stderr, "Error: %s\n", vm_status_name(stop.status));
+            } else {
+                describe_image_stop(&stop, image_bytes, image_size, isa, symbol_file, stderr);
+            }
+            free(recording.output.data);
+            free(recording.input.data);
+            free(image_bytes);
+            return vm_exit_code(stop.status);
+        }
+        errno = 0;  // A missing cache directory is not a console error
+    }
+
+    struct vm* vm = vm_create(image_bytes, image_size);
+    free(image_bytes);
+    if (vm == NULL) {
+        printf("Invalid memory image: %s\n", image);
+        exit(1);
+    }
+    if (isa) {
+        vm_set_isa(vm, isa);
+    }
+    if (input_file && !vm_map_input(vm, input_file)) {
+        perror("Error mapping input file");
+        exit(1);
+    }
+    if (guard_pages && !vm_enable_guard(vm)) {
+        perror("Error reserving guard page");
+        exit(1);
+    }
+    if (cache_dir) {
+        struct vm_console console = {record_read_char, record_read_int, record_write, &recording};
+        vm_set_console(vm, &console);
+    }
+
+    if (symbol_file && !load_symbols(symbol_file, &vm->symbols)) {
+        perror("Error reading symbols");
+        exit(1);
+    }
+    if (disasm) {
+        disassemble_image(vm, stdout);
+        vm_destroy(vm);
+        return 0;
+    }
+    if (profile) {
+        profile_start(vm, profile, interval);
+    }
+    if (heap_report) {
+        heap_stats_start(vm, heap_report);
+    }
+    if ((icache || dcache) && !cache_start(vm, icache, dcache, cache_output)) {
+        printf("Invalid cache configuration, expected <size:line:ways> with power of two lines and sets\n");
+        exit(1);
+    }
+    if (pipeline && !pipeline_start(vm, pipeline, pipeline_output)) {
+        printf("Invalid pipeline configuration, expected <not-taken|btfn|2bit>[:<load-use>:<penalty>]\n");
+        exit(1);
+    }
+
+    // The result cache already reads all of stdin up front
+    struct async_console* async = NULL;
+    if (async_io && !cache_dir) {
+        async = async_console_start();
+        if (async == NULL) {
+            perror("Error starting console threads");
+            exit(1);
+        }
+        struct vm_console console = {async_read_char, async_read_int, async_write, async};
+        vm_set_console(vm, &console);
+    }
+
+    // The reference copies the vm as it is now, with its console wrapped
+    if (shadow && !vm_enable_shadow(vm, shadow)) {
+        perror("Error starting shadow");
+        exit(1);
+    }
+    struct host_counters counters;
+    if (host_counters) {
+        host_counters_open(&counters, host_counters);
+        host_counters_start(&counters);
+    }
+    enum vm_status status = shadow ? vm_run_shadow(vm, budget) : vm_run_harts(vm, harts, budget);
+    struct run_stop stop;
+    record_stop(vm, status, &stop);
+    if (host_counters) {
+        host_counters_stop(&counters);
+    }
+    if (async) {
+        // Everything the guest wrote, up to the halt message, comes before the messages and reports below
+        async_console_stop(async);
+    }
+    if (status == VM_INPUT_ERROR) {
+        perror("Error scanf");
+    } else if (status == VM_BUDGET_EXCEEDED) {
+        fprintf(stderr, "Error: %s\n", vm_status_name(status));
+    } else if (status == VM_ILLEGAL_OPERATION || status == VM_NOT_IMPLEMENTED) {
+        // The dump on stdout keeps its format, the readable form goes next to it
+        describe_stop(&stop, vm->isa_extensions, &vm->symbols, stderr);
+    }
+    // Runs that read the host clock can print something different next time
+    if (cache_dir && !vm->read_host_clock) {
+        result_store(cache_dir, image_key, &recording.input, &recording.output, &stop);
+    }
+    free(recording.output.data);
+    free(recording.input.data);
+
+    // Reports come after everything the guest printed
+    cache_report(vm);
+    pipeline_report(vm);
+    heap_stats_report(vm);
+    profile_write(vm);
+    if (host_counters) {
+        host_counters_report(&counters, vm_get_instret(vm));
+        host_counters_close(&counters);
+    }
+
+    vm_destroy(vm);
+    return vm_exit_code(status);
+}
@@ -0,0 +1,81 @@
+#include "vm_image.h"
+#include "vm_program.h"
+
+int main(int argc, char* argv[]) {
+    const char* input = NULL;
+    const char* output = NULL;
+    const char* symbol_file = NULL;
+    int legacy = 0;
+    int set_entry = 0;
+    uint32_t entry = 0;
+    int reg_num = 0;
+    uint32_t reg_index[REG_NUM];
+    uint32_t reg_value[REG_NUM];
+    for (int i = 1; i < argc; i++) {
+        unsigned int reg;
+        unsigned int value;
+        if (strncmp(argv[i], "--entry=", 8) == 0) {
+            entry = (uint32_t)strtoul(argv[i] + 8, NULL, 0);
+            set_entry = 1;
+        } else if (sscanf(argv[i], "--reg=x%u=%i", &reg, &value) == 2 && reg > 0 && reg < REG_NUM) {
+            reg_index[reg_num] = reg;
+            reg_value[reg_num++] = value;
+        } else if (strncmp(argv[i], "--symbols=", 10) == 0) {
+            symbol_file = argv[i] + 10;
+        } else if (strcmp(argv[i], "--legacy") == 0) {
+            legacy = 1;
+        } else if (input == NULL) {
+            input = argv[i];
+        } else {
+            output = argv[i];
+        }
+        if (reg_num == REG_NUM) {
+            break;
+        }
+    }
+    if (input == NULL || output == NULL) {
+        printf("Usage: %s [--entry=<pc>] [--reg=x<n>=<value>] [--symbols=<file>] [--legacy] "
+               "<memory_image_binary> <output_image>\n", argv[0]);
+        exit(1);
+    }
+
+    size_t image_size;
+    unsigned char* image_bytes = read_memory_image(input, &image_size);
+    if (image_bytes == NULL) {
+        perror("Error reading image");
+        exit(1);
+    }
+    struct vm* vm = vm_create(image_bytes, image_size);
+    free(image_bytes);
+    if (vm == NULL) {
+        printf("Invalid memory image: %s\n", input);
+        exit(1);
+    }
+    if (set_entry) {
+        vm->pc = entry;
+    }
+    for (int i = 0; i < reg_num; i++) {
+        vm->reg_bank[reg_index[i]] = reg_value[i];
+    }
+    if (symbol_file && !load_symbols(symbol_file, &vm->symbols)) {
+        perror("Error reading symbols");
+        exit(1);
+    }
+
+    struct byte_buffer out = {0};
+    if (legacy) {
+        // Only instruction and data memory fit, the rest of the state is dropped
+        buffer_append(&out, vm->program->inst_mem, INST_MEM_SIZE);
+        buffer_append(&out, vm->memory.data_mem, DATA_MEM_SIZE);
+    } else {
+        save_sectioned_image(vm, &out);
+    }
+    FILE* fp = fopen(output, "wb");
+    if (fp == NULL || fwrite(out.data, 1, out.len, fp) != out.len || fclose(fp) != 0) {
+        perror("Error writing image");
+        exit(1);
+    }
+    free(out.data);
+    vm_destroy(vm);
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include "vm_pipeline.h"
+#include "vm_decode.h"
+
+const char* predictor_names[] = {"not-taken", "btfn", "2bit"};
+
+int pipeline_configure(const char* config, struct pipeline* pipeline) {
+    char name[PREDICTOR_NAME_LEN];
+    unsigned int load_use = PIPELINE_LOAD_USE_DEFAULT;
+    unsigned int penalty = PIPELINE_PENALTY_DEFAULT;
+    int fields = sscanf(config, "%15[^:]:%u:%u", name, &load_use, &penalty);
+    if (fields != 1 && fields != 3) {
+        return 0;
+    }
+
+    int found = 0;
+    for (int i = 0; i < (int)(sizeof(predictor_names) / sizeof(predictor_names[0])); i++) {
+        if (strcmp(name, predictor_names[i]) == 0) {
+            pipeline->predictor = (enum PredictorKind)i;
+            found = 1;
+        }
+    }
+    if (!found) {
+        return 0;
+    }
+    pipeline->load_use_stall = load_use;
+    pipeline->branch_penalty = penalty;
+    memset(pipeline->counters, PREDICTOR_WEAKLY_TAKEN - 1, sizeof(pipeline->counters));
+    return 1;
+}
+
+int pipeline_start(struct vm* vm, const char* config, const char* report) {
+    struct pipeline* pipeline = (struct pipeline*)calloc(1, sizeof(struct pipeline));
+    vm->pipeline = pipeline;
+    pipeline->output = report;
+    pipeline->pcs = (struct branch_stats*)calloc(INST_MEM_SIZE, sizeof(struct branch_stats));
+    return pipeline_configure(config, pipeline);
+}
+
+void pipeline_branch(struct pipeline* pipeline, uint32_t pc, uint32_t offset, int taken) {
+    int predicted;
+    uint8_t* counter = &pipeline->counters[(pc / COMPRESSED_BYTES) % PREDICTOR_ENTRIES];
+    switch (pipeline->predictor) {
+        case PREDICT_BTFN:
+            predicted = (int32_t)offset < 0;
+            break;
+        case PREDICT_TWO_BIT:
+            predicted = *counter >= PREDICTOR_WEAKLY_TAKEN;
+            if (taken && *counter < PREDICTOR_STRONGLY_TAKEN) {
+                (*counter)++;
+            } else if (!taken && *counter > 0) {
+                (*counter)--;
+            }
+            break;
+        default:
+            predicted = 0;
+            break;
+    }
+
+    struct branch_stats* at_pc = &pipeline->pcs[pc % INST_MEM_SIZE];
+    pipeline->branches.executed++;
+    at_pc->executed++;
+    if (taken) {
+        pipeline->branches.taken++;
+        at_pc->taken++;
+    }
+    // A correctly predicted taken branch redirects fetch in decode with no bubble
+    if (predicted != taken) {
+        pipeline->branches.mispredicted++;
+        at_pc->mispredicted++;
+        pipeline->branch_cycles += pipeline->branch_penalty;
+    }
+}
+
+void pipeline_retire(struct pipeline* pipeline, uint32_t isa_extensions, union instruction instruct) {
+    const struct instruction_spec* spec = decode_instruct(isa_extensions, instruct);
+    struct operands op = decode_operands(instruct, spec->format);
+    int reads_rs1 = 0;
+    int reads_rs2 = 0;
+    int reads_rs3 = 0;
+    switch (spec->format) {
+        case FORMAT_R:
+        case FORMAT_S:
+        case FORMAT_SB:
+        case FORMAT_AMO:
+            reads_rs2 = 1;
+            reads_rs1 = 1;
+            break;
+        case FORMAT_R4:
+            reads_rs3 = 1;
+            reads_rs2 = 1;
+            reads_rs1 = 1;
+            break;
+        case FORMAT_I:
+        case FORMAT_LOAD:
+        case FORMAT_JALR:
+        case FORMAT_LR:
+            reads_rs1 = 1;
+            break;
+        default:
+            break;
+    }
+
+    // Forwarding covers every other hazard, a loaded value is only ready after the memory stage
+    if (pipeline->load_rd != 0 &&
+        ((reads_rs1 && op.rs1 == pipeline->load_rd) || (reads_rs2 && op.rs2 == pipeline->load_rd) ||
+         (reads_rs3 && op.rs3 == pipeline->load_rd))) {
+        pipeline->load_use_cycles += pipeline->load_use_stall;
+    }
+    int loads = spec->format == FORMAT_LOAD || spec->format == FORMAT_LR || spec->format == FORMAT_AMO;
+    pipeline->load_rd = loads ? op.rd : 0;
+
+    if (spec->format == FORMAT_UJ) {
+        pipeline->jump_cycles += PIPELINE_JAL_PENALTY;
+    } else if (spec->format == FORMAT_JALR) {
+        pipeline->jump_cycles += pipeline->branch_penalty;
+    }
+    pipeline->instructions++;
+}
+
+uint64_t pipeline_cycles(const struct pipeline* pipeline) {
+    if (pipeline->instructions == 0) {
+        return 0;
+    }
+    return pipeline->instructions + (PIPELINE_STAGES - 1) + pipeline->load_use_cycles + pipeline->branch_cycles +
+           pipeline->jump_cycles;
+}
+
+void pipeline_report(struct vm* vm) {
+    struct pipeline* pipeline = vm->pipeline;
+    if (pipeline == NULL) {
+        return;
+    }
+    FILE* out = (strcmp(pipeline->output, "-") == 0) ? stdout : fopen(pipeline->output, "w");
+    if (out == NULL) {
+        perror("Error opening pipeline report");
+        return;
+    }
+
+    uint64_t cycles = pipeline_cycles(pipeline);
+    fprintf(out, "Pipeline %d stages, %s predictor, load-use %u, penalty %u: %llu cycles, %llu instructions, CPI %.3f\n",
+            PIPELINE_STAGES, predictor_names[pipeline->predictor], pipeline->load_use_stall, pipeline->branch_penalty,
+            (unsigned long long)cycles, (unsigned long long)pipeline->instructions,
+            pipeline->instructions ? (double)cycles / pipeline->instructions : 0.0);
+    fprintf(out, "  load-use stalls: %llu cycles\n", (unsigned long long)pipeline->load_use_cycles);
+    fprintf(out, "  branch mispredictions: %llu cycles\n", (unsigned long long)pipeline->branch_cycles);
+    fprintf(out, "  jumps: %llu cycles\n", (unsigned long long)pipeline->jump_cycles);
+    struct branch_stats* all = &pipeline->branches;
+    fprintf(out, "  branches: %llu executed, %llu taken, %llu mispredicted (%.2f%%)\n",
+            (unsigned long long)all->executed, (unsigned long long)all->taken, (unsigned long long)all->mispredicted,
+            all->executed ? 100.0 * all->mispredicted / all->executed : 0.0);
+
+    // Branches, the most mispredicted first
+    uint32_t order[INST_MEM_SIZE];
+    uint32_t order_num = 0;
+    for (uint32_t i = 0; i < INST_MEM_SIZE; i++) {
+        if (pipeline->pcs[i].executed) {
+            uint32_t j = order_num++;
+            while (j > 0 && pipeline->pcs[order[j - 1]].mispredicted < pipeline->pcs[i].mispredicted) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+    }
+    for (uint32_t i = 0; i < order_num; i++) {
+        struct branch_stats* stats = &pipeline->pcs[order[i]];
+        fprintf(out, "  pc 0x%08x: %llu executed, %llu taken, %llu mispredicted (%.2f%%)\n", order[i],
+                (unsigned long long)stats->executed, (unsigned long long)stats->taken,
+                (unsigned long long)stats->mispredicted, 100.0 * stats->mispredicted / stats->executed);
+    }
+
+    if (out == stdout) {
+        fflush(out);
+    } else {
+        fclose(out);
+    }
+}
+
+void pipeline_free(struct vm* vm) {
+    struct pipeline* pipeline = vm->pipeline;
+    if (pipeline == NULL) {
+        return;
+    }
+    free(pipeline->pcs);
+    free(pipeline);
+    vm->pipeline = NULL;
+}
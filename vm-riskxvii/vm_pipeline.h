@@ -0,0 +1,99 @@
+#ifndef VM_PIPELINE_H
+#define VM_PIPELINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_riskxvii.h"
+
+#define PIPELINE_STAGES 5             // Fetch, decode, execute, memory and write back
+#define PIPELINE_LOAD_USE_DEFAULT 1   // Bubbles when an instruction reads the register the previous load writes
+#define PIPELINE_PENALTY_DEFAULT 2    // Bubbles for a mispredicted branch or jalr, resolved in execute
+#define PIPELINE_JAL_PENALTY 1        // Bubbles for jal, whose target is known in decode
+#define PREDICTOR_ENTRIES 64          // 2-bit counters, indexed by halfword pc
+#define PREDICTOR_WEAKLY_TAKEN 2      // Counters at or above this predict taken
+#define PREDICTOR_STRONGLY_TAKEN 3
+#define PREDICTOR_NAME_LEN 16
+
+enum PredictorKind {
+    PREDICT_NOT_TAKEN,  // Static, every branch falls through
+    PREDICT_BTFN,       // Static, backward branches are taken and forward ones fall through
+    PREDICT_TWO_BIT     // Dynamic, a table of 2-bit saturating counters
+};  // How the pipeline guesses the direction of a conditional branch
+
+struct branch_stats {
+    uint64_t executed;
+    uint64_t taken;
+    uint64_t mispredicted;
+};  // Outcomes of the branches at one pc, or of all of them
+
+struct pipeline {
+    enum PredictorKind predictor;
+    uint32_t load_use_stall;   // Bubbles after a load whose result is read by the next instruction
+    uint32_t branch_penalty;   // Bubbles after a mispredicted branch or a jalr
+    uint8_t counters[PREDICTOR_ENTRIES];  // 2-bit predictor state, weakly not taken at start
+    uint32_t load_rd;          // Register the last retired instruction loaded, 0 if it was not a load
+    uint64_t instructions;     // Instructions retired through the pipeline
+    uint64_t load_use_cycles;  // Bubbles from load-use hazards
+    uint64_t branch_cycles;    // Bubbles from mispredicted branches
+    uint64_t jump_cycles;      // Bubbles from jal and jalr
+    struct branch_stats branches;  // All conditional branches
+    struct branch_stats* pcs;      // Indexed by the pc of the branch
+    const char* output;            // Where the report is written
+};  // The timing model of a classic in-order 5-stage pipeline with forwarding, for one vm
+
+/**
+ * Parse a pipeline configuration of the form predictor[:load-use:penalty], e.g. 2bit:1:2
+ * @param config The configuration, the predictor is not-taken, btfn or 2bit
+ * @param pipeline The pipeline to configure
+ * @return int 1 if the configuration is valid, otherwise 0
+*/
+int pipeline_configure(const char* config, struct pipeline* pipeline);
+
+/**
+ * Attach the timing model to a vm, the report is written by pipeline_report
+ * @param vm The vm
+ * @param config The pipeline configuration
+ * @param report The file for the report, "-" for stdout
+ * @return int 1 if successful, 0 if the configuration is invalid
+*/
+int pipeline_start(struct vm* vm, const char* config, const char* report);
+
+/**
+ * Predict a conditional branch, then train the predictor with its outcome and charge a misprediction
+ * @param pipeline The pipeline
+ * @param pc The pc of the branch
+ * @param offset The branch offset in bytes
+ * @param taken Whether the branch is taken
+*/
+void pipeline_branch(struct pipeline* pipeline, uint32_t pc, uint32_t offset, int taken);
+
+/**
+ * Account an executed instruction, charging load-use and jump bubbles
+ * @param pipeline The pipeline
+ * @param isa_extensions The enabled ISA extensions
+ * @param instruct The instruction, already expanded if it was compressed
+*/
+void pipeline_retire(struct pipeline* pipeline, uint32_t isa_extensions, union instruction instruct);
+
+/**
+ * Estimated cycles of the run so far, including filling the pipeline
+ * @param pipeline The pipeline
+ * @return uint64_t The cycle count
+*/
+uint64_t pipeline_cycles(const struct pipeline* pipeline);
+
+/**
+ * Write the cycle count, CPI, stall breakdown and per branch misprediction rates
+ * @param vm The vm, nothing is written if it has no pipeline
+*/
+void pipeline_report(struct vm* vm);
+
+/**
+ * Free the timing model of a vm
+ * @param vm The vm
+*/
+void pipeline_free(struct vm* vm);
+
+#endif
@@ -0,0 +1,169 @@
+#include "vm_profile.h"
+#include "vm_riskxvii.h"
+#include "vm_symbols.h"
+
+void profile_start(struct vm* vm, const char* output, uint32_t interval) {
+    struct profile* profile = (struct profile*)calloc(1, sizeof(struct profile));
+    profile->output = output;
+    profile->interval = interval ? interval : PROFILE_DEFAULT_INTERVAL;
+    profile->countdown = profile->interval;
+    profile->slot_num = PROFILE_INITIAL_SLOTS;
+    profile->slots = (struct profile_stack**)calloc(profile->slot_num, sizeof(struct profile_stack*));
+    vm->profile = profile;
+}
+
+void profile_call(struct profile* profile, uint32_t target) {
+    if (profile->shadow_depth < PROFILE_MAX_DEPTH) {
+        profile->shadow_stack[profile->shadow_depth++] = target;
+    } else {
+        profile->shadow_overflow++;
+    }
+}
+
+void profile_return(struct profile* profile) {
+    // Returns without a recorded call, e.g. from the entry code, leave the stack alone
+    if (profile->shadow_overflow > 0) {
+        profile->shadow_overflow--;
+    } else if (profile->shadow_depth > 0) {
+        profile->shadow_depth--;
+    }
+}
+
+uint32_t profile_function(struct vm* vm, uint32_t address) {
+    const struct symbol* sym = find_symbol(&vm->symbols, address);
+    return sym ? sym->address : address;
+}
+
+uint32_t hash_stack(const uint32_t* frames, int depth) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ frames[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void grow_profile_slots(struct profile* profile) {
+    uint32_t old_num = profile->slot_num;
+    struct profile_stack** old_slots = profile->slots;
+    profile->slot_num *= 2;
+    profile->slots = (struct profile_stack**)calloc(profile->slot_num, sizeof(struct profile_stack*));
+    for (uint32_t i = 0; i < old_num; i++) {
+        if (old_slots[i]) {
+            uint32_t slot = hash_stack(old_slots[i]->frames, old_slots[i]->depth) & (profile->slot_num - 1);
+            while (profile->slots[slot]) {
+                slot = (slot + 1) & (profile->slot_num - 1);
+            }
+            profile->slots[slot] = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+void profile_sample(struct vm* vm) {
+    struct profile* profile = vm->profile;
+    profile->countdown = profile->interval;
+
+    // Root is the entry function, then every call on the shadow stack, then the function holding pc
+    uint32_t frames[PROFILE_MAX_DEPTH + 2];
+    int depth = 0;
+    frames[depth++] = profile_function(vm, 0);
+    for (int i = 0; i < profile->shadow_depth; i++) {
+        frames[depth++] = profile_function(vm, profile->shadow_stack[i]);
+    }
+    // Without symbols there is no way to tell which function pc is in, so the leaf is the last call
+    if (vm->symbols.count > 0) {
+        uint32_t leaf = profile_function(vm, vm->pc);
+        if (leaf != frames[depth - 1]) {
+            frames[depth++] = leaf;
+        }
+    }
+
+    uint32_t slot = hash_stack(frames, depth) & (profile->slot_num - 1);
+    while (profile->slots[slot]) {
+        struct profile_stack* stack = profile->slots[slot];
+        if (stack->depth == depth && memcmp(stack->frames, frames, depth * sizeof(uint32_t)) == 0) {
+            stack->count++;
+            return;
+        }
+        slot = (slot + 1) & (profile->slot_num - 1);
+    }
+
+    struct profile_stack* stack = (struct profile_stack*)malloc(sizeof(struct profile_stack));
+    memcpy(stack->frames, frames, depth * sizeof(uint32_t));
+    stack->depth = depth;
+    stack->count = 1;
+    profile->slots[slot] = stack;
+    if (++profile->stack_num * 2 > profile->slot_num) {
+        grow_profile_slots(profile);
+    }
+}
+
+int compare_lines(const void* lhs, const void* rhs) {
+    return strcmp(*(char* const*)lhs, *(char* const*)rhs);
+}
+
+void profile_write(struct vm* vm) {
+    struct profile* profile = vm->profile;
+    if (profile == NULL) {
+        return;
+    }
+    FILE* out = (strcmp(profile->output, "-") == 0) ? stdout : fopen(profile->output, "w");
+    if (out == NULL) {
+        perror("Error opening profile");
+        return;
+    }
+
+    char** lines = (char**)malloc((profile->stack_num + 1) * sizeof(char*));
+    uint32_t line_num = 0;
+    for (uint32_t i = 0; i < profile->slot_num; i++) {
+        struct profile_stack* stack = profile->slots[i];
+        if (!stack) {
+            continue;
+        }
+        // Every frame is a symbol name or an 0x00000000 address, plus the separator
+        size_t size = 32;
+        for (int j = 0; j < stack->depth; j++) {
+            const struct symbol* sym = find_symbol(&vm->symbols, stack->frames[j]);
+            size += (sym && sym->address == stack->frames[j]) ? strlen(sym->name) + 1 : 11;
+        }
+        char* line = (char*)malloc(size);
+        size_t len = 0;
+        for (int j = 0; j < stack->depth; j++) {
+            const struct symbol* sym = find_symbol(&vm->symbols, stack->frames[j]);
+            const char* separator = j ? ";" : "";
+            if (sym && sym->address == stack->frames[j]) {
+                len += sprintf(line + len, "%s%s", separator, sym->name);
+            } else {
+                len += sprintf(line + len, "%s0x%08x", separator, stack->frames[j]);
+            }
+        }
+        sprintf(line + len, " %llu", (unsigned long long)stack->count);
+        lines[line_num++] = line;
+    }
+
+    qsort(lines, line_num, sizeof(char*), compare_lines);
+    for (uint32_t i = 0; i < line_num; i++) {
+        fprintf(out, "%s\n", lines[i]);
+        free(lines[i]);
+    }
+    free(lines);
+
+    if (out == stdout) {
+        fflush(out);
+    } else {
+        fclose(out);
+    }
+}
+
+void profile_free(struct vm* vm) {
+    struct profile* profile = vm->profile;
+    if (profile == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < profile->slot_num; i++) {
+        free(profile->slots[i]);
+    }
+    free(profile->slots);
+    free(profile);
+    vm->profile = NULL;
+}
@@ -0,0 +1,105 @@
+#ifndef VM_PROFILE_H
+#define VM_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_MAX_DEPTH 256
+#define PROFILE_DEFAULT_INTERVAL 100
+#define PROFILE_INITIAL_SLOTS 256
+#define RETURN_ADDRESS_REG 1  // ra, the link register of calls and returns
+
+struct profile_stack {
+    uint32_t frames[PROFILE_MAX_DEPTH + 2];  // Function addresses from the root to the leaf
+    int depth;
+    uint64_t count;  // Samples taken with exactly this stack
+};  // A sampled guest call stack
+
+struct profile {
+    uint32_t countdown;  // Instructions until the next sample
+    uint32_t interval;   // Instructions between samples
+    const char* output;  // Where the folded stacks are written
+
+    uint32_t shadow_stack[PROFILE_MAX_DEPTH];  // Called function addresses, outermost first
+    int shadow_depth;                          // Calls currently on the shadow stack
+    uint32_t shadow_overflow;                  // Calls deeper than the shadow stack, not recorded
+
+    struct profile_stack** slots;  // Open addressing hash table of the distinct sampled stacks
+    uint32_t slot_num;
+    uint32_t stack_num;
+};  // The call graph profiler state of one vm
+
+struct vm;
+
+/**
+ * Start sampling the guest call stack of a vm, the folded stacks are written by profile_write
+ * @param vm The vm
+ * @param output The file for the folded stacks, "-" for stdout
+ * @param interval Sample every this many instructions
+*/
+void profile_start(struct vm* vm, const char* output, uint32_t interval);
+
+/**
+ * Record a call on the shadow stack, for jal and jalr that link into ra
+ * @param profile The profiler
+ * @param target The address of the called function
+*/
+void profile_call(struct profile* profile, uint32_t target);
+
+/**
+ * Record a return on the shadow stack, for jalr x0, 0(ra)
+ * @param profile The profiler
+*/
+void profile_return(struct profile* profile);
+
+/**
+ * Hash a stack of function addresses (FNV-1a)
+ * @param frames The function addresses
+ * @param depth The number of frames
+ * @return uint32_t The hash
+*/
+uint32_t hash_stack(const uint32_t* frames, int depth);
+
+/**
+ * Double the sampled stack hash table, called once it is half full
+ * @param profile The profiler
+*/
+void grow_profile_slots(struct profile* profile);
+
+/**
+ * Take a sample of the shadow stack and the current pc, then restart the countdown
+ * @param vm The vm
+*/
+void profile_sample(struct vm* vm);
+
+/**
+ * Resolve an address to the start of the function holding it, the address itself without symbols
+ * @param vm The vm
+ * @param address The guest address
+ * @return uint32_t The function address
+*/
+uint32_t profile_function(struct vm* vm, uint32_t address);
+
+/**
+ * Order folded stack lines alphabetically so the output is stable
+ * @param lhs The first line
+ * @param rhs The second line
+ * @return int Negative, zero or positive as for qsort
+*/
+int compare_lines(const void* lhs, const void* rhs);
+
+/**
+ * Write the samples as folded stacks (frame;frame;frame count), one line per distinct stack
+ * @param vm The vm, nothing is written if it is not profiled
+*/
+void profile_write(struct vm* vm);
+
+/**
+ * Free the profiler of a vm
+ * @param vm The vm
+*/
+void profile_free(struct vm* vm);
+
+#endif
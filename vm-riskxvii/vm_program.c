@@ -0,0 +1,144 @@
+#include "vm_program.h"
+#include "vm_guard.h"
+
+pthread_mutex_t program_lock = PTHREAD_MUTEX_INITIALIZER;  // Guards the program cache and every reference count
+struct program* programs = NULL;                           // Every shared program of the process
+
+uint64_t program_key(const unsigned char* image, size_t size) {
+    uint64_t key = PROGRAM_KEY_BASIS;
+    for (size_t i = 0; i < size; i++) {
+        key = (key ^ image[i]) * PROGRAM_KEY_PRIME;
+    }
+    return key;
+}
+
+struct program* program_create(uint64_t key) {
+    struct program* program = (struct program*)calloc(1, sizeof(struct program));
+    if (program == NULL) {
+        return NULL;
+    }
+    program->key = key;
+    program->refs = 1;
+    return program;
+}
+
+void program_retain(struct program* program) {
+    pthread_mutex_lock(&program_lock);
+    program->refs++;
+    pthread_mutex_unlock(&program_lock);
+}
+
+void program_release(struct program* program) {
+    if (program == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&program_lock);
+    if (--program->refs > 0) {
+        pthread_mutex_unlock(&program_lock);
+        return;
+    }
+    if (program->shared) {
+        struct program** link = &programs;
+        while (*link != program) {
+            link = &(*link)->next;
+        }
+        *link = program->next;
+    }
+    pthread_mutex_unlock(&program_lock);
+    program_release(program->origin);
+    free(program);
+}
+
+void program_share(struct vm* vm) {
+    struct program* program = vm->program;
+    program->isa_extensions = vm->isa_extensions;
+    // Decoding every slot now means a vm never writes the cache it shares
+    predecode_instructs(vm);
+
+    pthread_mutex_lock(&program_lock);
+    struct program* cached = programs;
+    // The key only finds candidates, the contents decide
+    while (cached && (cached->key != program->key || cached->isa_extensions != program->isa_extensions ||
+                      memcmp(cached->inst_mem, program->inst_mem, INST_MEM_SIZE) != 0 ||
+                      memcmp(cached->data_mem, program->data_mem, DATA_MEM_SIZE) != 0 ||
+                      memcmp(cached->heap_banks, program->heap_banks, sizeof(program->heap_banks)) != 0)) {
+        cached = cached->next;
+    }
+    if (cached) {
+        cached->refs++;
+    } else {
+        program->shared = 1;
+        program->next = programs;
+        programs = program;
+    }
+    pthread_mutex_unlock(&program_lock);
+    if (cached) {
+        program_use(vm, cached);
+    }
+}
+
+void program_use(struct vm* vm, struct program* program) {
+    struct program* previous = vm->program;
+    vm->program = program;
+    program_release(previous);
+    if (vm->guard) {
+        guard_map(vm);
+    }
+}
+
+int program_unshare(struct vm* vm) {
+    struct program* program = vm->program;
+    if (!program->shared) {
+        return 1;
+    }
+    struct program* copy = program_create(program->key);
+    if (copy == NULL) {
+        return 0;
+    }
+    memcpy(copy->inst_mem, program->inst_mem, INST_MEM_SIZE);
+    memcpy(copy->decode_cache, program->decode_cache, sizeof(copy->decode_cache));
+    memcpy(copy->data_mem, program->data_mem, DATA_MEM_SIZE);
+    memcpy(copy->heap_banks, program->heap_banks, sizeof(copy->heap_banks));
+    copy->isa_extensions = program->isa_extensions;
+    // The copy keeps the vm's reference to the program, for vm_reset to go back to
+    copy->origin = program;
+    vm->program = copy;
+    if (vm->guard) {
+        guard_map(vm);
+    }
+    return 1;
+}
+
+int program_set_isa(struct vm* vm) {
+    struct program* program = vm->program;
+    if (program->isa_extensions == vm->isa_extensions) {
+        return 1;
+    }
+    if (!program->shared) {
+        // Slots decoded under the previous ISA may now decode differently
+        memset(program->decode_cache, 0, sizeof(program->decode_cache));
+        program->isa_extensions = vm->isa_extensions;
+        return 1;
+    }
+    struct program* copy = program_create(program->key);
+    if (copy == NULL) {
+        return 0;
+    }
+    memcpy(copy->inst_mem, program->inst_mem, INST_MEM_SIZE);
+    memcpy(copy->data_mem, program->data_mem, DATA_MEM_SIZE);
+    memcpy(copy->heap_banks, program->heap_banks, sizeof(copy->heap_banks));
+    program_use(vm, copy);
+    program_share(vm);
+    return 1;
+}
+
+void program_revert(struct vm* vm) {
+    struct program* origin = vm->program->origin;
+    if (origin == NULL) {
+        return;
+    }
+    // Freeing the copy drops its reference to the origin, the vm takes one of its own first
+    program_retain(origin);
+    program_use(vm, origin);
+    program_set_isa(vm);
+}
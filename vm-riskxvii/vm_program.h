@@ -0,0 +1,89 @@
+#ifndef VM_PROGRAM_H
+#define VM_PROGRAM_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_riskxvii.h"
+
+#define PROGRAM_KEY_BASIS 0xcbf29ce484222325ull  // FNV-1a 64-bit offset basis
+#define PROGRAM_KEY_PRIME 0x100000001b3ull       // FNV-1a 64-bit prime
+
+struct program {
+    unsigned char inst_mem[INST_MEM_SIZE];  // Instruction memory, first so a fetch at the last halfword stays inside
+    struct decoded_instruct decode_cache[INST_MEM_SIZE / COMPRESSED_BYTES];  // Decoded instructions by halfword slot
+    unsigned char data_mem[DATA_MEM_SIZE];                      // Data memory as loaded, restored by vm_reset
+    unsigned char heap_banks[HEAP_BANK_NUM * BANK_BLOCK_SIZE];  // Heap banks as loaded, restored by vm_reset
+    uint64_t key;             // Hash of the image the program was loaded from
+    uint32_t isa_extensions;  // The ISA the decode cache is for
+    int shared;               // Set once in the program cache, nothing writes a shared program
+    int refs;                 // Vms using the program, under program_lock
+    struct program* origin;   // The shared program a private copy was made from, which vm_reset returns to
+    struct program* next;     // Next program in the cache
+};  // The read only part of a loaded image, shared by every vm of the same image and ISA
+
+/**
+ * Hash image bytes into the key programs are cached under
+ * @param image The image bytes
+ * @param size The number of bytes
+ * @return uint64_t The key
+*/
+uint64_t program_key(const unsigned char* image, size_t size);
+
+/**
+ * Allocate a private program for an image being loaded
+ * @param key The hash of the image
+ * @return struct program* The program, zero filled with one reference, or NULL if it could not be allocated
+*/
+struct program* program_create(uint64_t key);
+
+/**
+ * Take another reference to a program, for a vm copied from one that uses it
+ * @param program The program
+*/
+void program_retain(struct program* program);
+
+/**
+ * Drop a reference to a program, the last one removes it from the cache and frees it
+ * @param program The program, nothing is done if it is NULL
+*/
+void program_release(struct program* program);
+
+/**
+ * Move a vm's freshly loaded program into the cache. Its data memory and heap become what vm_reset restores,
+ * and a C program is predecoded first so its decode cache is never written again. If the cache already
+ * holds the same program for the same ISA, the vm uses that one and its own is freed
+ * @param vm The vm, whose program is private
+*/
+void program_share(struct vm* vm);
+
+/**
+ * Point a vm at another program, dropping its reference to the one it had and remapping its guard page
+ * @param vm The vm
+ * @param program The program, whose reference the vm takes over
+*/
+void program_use(struct vm* vm, struct program* program);
+
+/**
+ * Give a vm a private copy of its program before the host writes its instruction memory
+ * @param vm The vm, nothing is done if its program is already private
+ * @return int 1 if the program is private, 0 if the copy could not be allocated
+*/
+int program_unshare(struct vm* vm);
+
+/**
+ * Switch a vm to the program decoded for its ISA, sharing a cached one if there is one
+ * @param vm The vm, whose isa_extensions were just changed
+ * @return int 1 if successful, 0 if a program could not be allocated
+*/
+int program_set_isa(struct vm* vm);
+
+/**
+ * Return a vm whose instruction memory the host wrote to the shared program it was copied from
+ * @param vm The vm, nothing is done if its program is not a copy
+*/
+void program_revert(struct vm* vm);
+
+#endif
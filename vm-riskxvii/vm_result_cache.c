@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L  // For mkdir, getpid and directory listing
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "vm_result_cache.h"
+
+uint64_t fnv_hash(uint64_t hash, const void* data, size_t len) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * FNV64_PRIME;
+    }
+    return hash;
+}
+
+uint64_t result_image_key(const unsigned char* image, size_t size, const char* isa, uint64_t budget) {
+    uint64_t hash = fnv_hash(FNV64_OFFSET, image, size);
+    hash = fnv_hash(hash, isa ? isa : "rv32i", strlen(isa ? isa : "rv32i"));
+    return fnv_hash(hash, &budget, sizeof(budget));
+}
+
+int result_lookup(const char* dir, uint64_t image_key, const struct byte_buffer* input, struct byte_buffer* output,
+                  struct run_stop* stop) {
+    char path[RESULT_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%016llx", dir, (unsigned long long)image_key);
+    DIR* runs = opendir(path);
+    if (runs == NULL) {
+        return 0;
+    }
+
+    // Every run of the image is a candidate, the examined input is only known once a run is read
+    int hit = 0;
+    struct dirent* entry;
+    while (!hit && (entry = readdir(runs)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char run_path[RESULT_PATH_LEN];
+        int path_len = snprintf(run_path, sizeof(run_path), "%s/%s", path, entry->d_name);
+        FILE* fp = path_len < (int)sizeof(run_path) ? fopen(run_path, "rb") : NULL;
+        if (fp == NULL) {
+            continue;
+        }
+
+        unsigned char header[RESULT_HEADER_BYTES];
+        if (fread(header, 1, sizeof(header), fp) == sizeof(header) && memcmp(header, RESULT_MAGIC, 4) == 0 &&
+            get_le(header + 4, 4) == RESULT_VERSION) {
+            uint32_t run_status = (uint32_t)get_le(header + 8, 4);
+            int at_end = (int)get_le(header + 12, 4);
+            uint64_t input_len = get_le(header + 24, 8);
+            uint64_t output_len = get_le(header + 32, 8);
+            // A run that saw the end of its input only matches input of exactly that length
+            int fits = at_end ? input_len == input->len : input_len <= input->len;
+            if (fits) {
+                struct byte_buffer examined = {0};
+                buffer_read_file(fp, &examined);
+                if (examined.len == input_len + output_len &&
+                    (input_len == 0 || memcmp(examined.data, input->data, input_len) == 0)) {
+                    buffer_clear(output);
+                    buffer_append(output, examined.data + input_len, output_len);
+                    stop->status = (enum vm_status)run_status;
+                    stop->pc = (uint32_t)get_le(header + 16, 4);
+                    stop->instruct = (uint32_t)get_le(header + 20, 4);
+                    hit = 1;
+                }
+                free(examined.data);
+            }
+        }
+        fclose(fp);
+    }
+    closedir(runs);
+    return hit;
+}
+
+void result_store(const char* dir, uint64_t image_key, const struct byte_buffer* input,
+                  const struct byte_buffer* output, const struct run_stop* stop) {
+    char path[RESULT_PATH_LEN];
+    mkdir(dir, 0777);
+    snprintf(path, sizeof(path), "%s/%016llx", dir, (unsigned long long)image_key);
+    mkdir(path, 0777);
+
+    // Runs are named by what they examined, so the same prefix replaces rather than duplicates
+    uint64_t input_key = fnv_hash(FNV64_OFFSET, input->data, input->examined);
+    input_key = fnv_hash(input_key, &input->at_end, sizeof(input->at_end));
+    char run_path[RESULT_PATH_LEN];
+    char temp_path[RESULT_PATH_LEN];
+    if (snprintf(run_path, sizeof(run_path), "%s/%016llx", path, (unsigned long long)input_key) >=
+            (int)sizeof(run_path) ||
+        snprintf(temp_path, sizeof(temp_path), "%s.%ld.tmp", run_path, (long)getpid()) >= (int)sizeof(temp_path)) {
+        return;
+    }
+
+    FILE* fp = fopen(temp_path, "wb");
+    if (fp == NULL) {
+        return;  // The cache is an optimisation, a read only directory just means no caching
+    }
+    unsigned char header[RESULT_HEADER_BYTES];
+    memcpy(header, RESULT_MAGIC, 4);
+    put_le(header + 4, RESULT_VERSION, 4);
+    put_le(header + 8, (uint64_t)stop->status, 4);
+    put_le(header + 12, (uint64_t)input->at_end, 4);
+    put_le(header + 16, stop->pc, 4);
+    put_le(header + 20, stop->instruct, 4);
+    put_le(header + 24, input->examined, 8);
+    put_le(header + 32, output->len, 8);
+    int ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header) &&
+             fwrite(input->data, 1, input->examined, fp) == input->examined &&
+             fwrite(output->data, 1, output->len, fp) == output->len;
+    ok = (fclose(fp) == 0) && ok;
+    // Readers never see a partly written run
+    if (!ok || rename(temp_path, run_path) != 0) {
+        remove(temp_path);
+    }
+}
+
+int record_read_char(void* context) {
+    return buffer_read_char(&((struct recording*)context)->input);
+}
+
+int record_read_int(void* context, int32_t* value) {
+    return buffer_read_int(&((struct recording*)context)->input, value);
+}
+
+void record_write(void* context, const char* data, size_t len) {
+    fwrite(data, 1, len, stdout);
+    buffer_append(&((struct recording*)context)->output, data, len);
+}
@@ -0,0 +1,89 @@
+#ifndef VM_RESULT_CACHE_H
+#define VM_RESULT_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libriskxvii.h"
+#include "vm_buffer.h"
+#include "vm_decode.h"
+
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+#define RESULT_MAGIC "RXRC"
+#define RESULT_VERSION 2
+#define RESULT_HEADER_BYTES 40  // Magic, version, status, at end flag, stop pc and instruction, input and output lengths
+#define RESULT_PATH_LEN 4096
+
+struct recording {
+    struct byte_buffer input;   // The whole console input, reads record how much of it was examined
+    struct byte_buffer output;  // Everything the guest wrote
+};  // Console callbacks context for a run whose result is cached
+
+/**
+ * Continue an FNV-1a hash over more bytes
+ * @param hash The hash so far, FNV64_OFFSET to start
+ * @param data The bytes
+ * @param len The number of bytes
+ * @return uint64_t The hash
+*/
+uint64_t fnv_hash(uint64_t hash, const void* data, size_t len);
+
+/**
+ * Hash everything besides console input that decides the result of a run
+ * @param image The image bytes
+ * @param size The image size
+ * @param isa The ISA string, NULL for rv32i
+ * @param budget The instruction budget, 0 for no limit
+ * @return uint64_t The image key, naming the cache directory of the image
+*/
+uint64_t result_image_key(const unsigned char* image, size_t size, const char* isa, uint64_t budget);
+
+/**
+ * Find a cached run of an image whose examined input matches the given input
+ * @param dir The cache directory
+ * @param image_key The image key
+ * @param input The whole console input
+ * @param output Set to the cached output
+ * @param stop Set to how the cached run stopped
+ * @return int 1 on a hit, otherwise 0
+*/
+int result_lookup(const char* dir, uint64_t image_key, const struct byte_buffer* input, struct byte_buffer* output,
+                  struct run_stop* stop);
+
+/**
+ * Store a finished run, keyed on only the part of the input it examined
+ * @param dir The cache directory, created if needed
+ * @param image_key The image key
+ * @param input The console input, with how much was examined and whether the end was reached
+ * @param output The console output
+ * @param stop How the run stopped
+*/
+void result_store(const char* dir, uint64_t image_key, const struct byte_buffer* input,
+                  const struct byte_buffer* output, const struct run_stop* stop);
+
+/**
+ * Console read character callback over recorded input
+ * @param context The recording
+ * @return int The character, or -1 at the end of the input
+*/
+int record_read_char(void* context);
+
+/**
+ * Console read integer callback over recorded input
+ * @param context The recording
+ * @param value Set to the integer
+ * @return int 1 if an integer was read, otherwise 0
+*/
+int record_read_int(void* context, int32_t* value);
+
+/**
+ * Console write callback, writes to stdout and records the output
+ * @param context The recording
+ * @param data The bytes written by the guest
+ * @param len The number of bytes
+*/
+void record_write(void* context, const char* data, size_t len);
+
+#endif
@@ -1,450 +1,535 @@
+#define _POSIX_C_SOURCE 200809L  // For clock_gettime, sigjmp_buf and pthread_rwlock_t
+#include <time.h>
 #include "vm_riskxvii.h"
-
-uint32_t pc;                 // Program counter
-uint32_t reg_bank[REG_NUM];  // Register array
-unsigned char virtual_routines[VR_END - VR_START + 1];  // Virtual routines space
-unsigned char heap_banks[HEAP_BANK_NUM * BANK_BLOCK_SIZE];  // Heap banks space
-
-struct heap_node head;  // The head node of the linked list for heap management
-
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        printf("Usage: %s <memory_image_binary>\n", argv[0]);
-        exit(1);
+#include "vm_profile.h"
+#include "vm_pipeline.h"
+#include "vm_guard.h"
+#include "vm_cache.h"
+#include "vm_image.h"
+#include "vm_decode.h"
+#include "vm_harts.h"
+#include "vm_input.h"
+#include "vm_program.h"
+
+int parse_isa(const char* isa) {
+    // The base integer ISA is always required
+    if (strncmp(isa, "rv32i", 5) != 0) {
+        return -1;
     }
 
-    // Initialze vm and start running
-    struct blob vm_memory;
-    read_memory_image(argv[1], &vm_memory);
-    
-    init_heap();
-
-    running_vm(&vm_memory);
-
-    return 0;
+    int extensions = 0;
+    for (const char* ext = isa + 5; *ext; ext++) {
+        switch (*ext) {
+            case 'm':
+                extensions |= EXT_M;
+                break;
+            case 'c':
+                extensions |= EXT_C;
+                break;
+            case 'a':
+                extensions |= EXT_A;
+                break;
+            case '_':
+                // Non-standard extensions follow the single letter ones, e.g. rv32im_xsimd
+                if (strcmp(ext + 1, "xsimd") != 0) {
+                    return -1;
+                }
+                return extensions | EXT_XSIMD;
+            default:
+                return -1;
+        }
+    }
+    return extensions;
 }
 
-void read_memory_image(const char* filename, struct blob* vm_memory) {
+unsigned char* read_memory_image(const char* filename, size_t* size) {
     FILE* fp = fopen(filename, "rb");
     if (fp == NULL) {
-        perror("Error opening file");
-        exit(1);
+        return NULL;
     }
 
-    // Store instructions into instruct memory
-    size_t inst_ret = fread(vm_memory->inst_mem, 1, INST_MEM_SIZE, fp);
-    if (!inst_ret) {
-        perror("Error reading instruct");
-        exit(1);
+    unsigned char* image = (unsigned char*)malloc(IMAGE_MAX_BYTES);
+    *size = fread(image, 1, IMAGE_MAX_BYTES, fp);
+    fclose(fp);
+    if (*size == 0) {
+        free(image);
+        return NULL;
     }
-
-    // Store data into data memory
-    size_t data_ret = fread(vm_memory->data_mem, 1, DATA_MEM_SIZE, fp);
-    if (!data_ret) {
-        perror("Error reading data");
-        exit(1);
+    // A legacy image is instruction memory followed by data memory, anything past them is ignored
+    if (!is_sectioned_image(image, *size) && !is_elf_image(image, *size) && *size > VM_IMAGE_SIZE) {
+        *size = VM_IMAGE_SIZE;
     }
-    fclose(fp);
+    return image;
 }
 
-union instruction fetch_instruct(struct blob* vm_memory) {
+union instruction fetch_instruct(struct vm* vm) {
     union instruction instruct;
-    instruct.raw_instruct = *((uint32_t*)(vm_memory->inst_mem + pc));
-
-    return instruct;
-}
-
-void execute_instruct(union instruction instruct, struct blob* vm_memory) {
-    enum Opcode opcode = (enum Opcode)(instruct.raw_instruct & 0x7F);  // Use bitmask to get the last 7 bits
-    //printf("%08x\n", instruct.raw_instruct);
-        switch (opcode) {
-            case R_TYPE:
-                handle_R_instruct(instruct);
-                break;
-
-            case I_TYPE_ONE:
-                handle_I1_instruct(instruct);
-                break;
-
-            case I_TYPE_TWO:
-                handle_I2_instruct(instruct, vm_memory);
-                break;
-
-            case I_TYPE_THREE:
-                handle_I3_instruct(instruct);
-                break;
-
-            case S_TYPE:
-                handle_S_instruct(instruct, vm_memory);
-                break;
-
-            case SB_TYPE:
-                handle_SB_instruct(instruct);
-                break;
+    if (!(vm->isa_extensions & EXT_C)) {
+        instruct.raw_instruct = *((uint32_t*)(vm->program->inst_mem + vm->pc));
+        vm->inst_len = INSTRUCT_BYTES;
+        return instruct;
+    }
 
-            case U_TYPE:
-                handle_U_instruct(instruct);
-                break;
+    // Instruction memory is read only, so each slot is decoded once and then served from the cache
+    struct decoded_instruct* cached = &vm->program->decode_cache[vm->pc / COMPRESSED_BYTES];
+    if (cached->length && !(vm->pc & 1)) {
+        vm->inst_len = cached->length;
+        return cached->instruct;
+    }
 
-            case UJ_TYPE:
-                handle_UJ_instruct(instruct);
-                break;
+    uint32_t raw;
+    memcpy(&raw, vm->program->inst_mem + vm->pc, sizeof(raw));
+    // The lowest two bits are 0b11 for all 32-bit instructions
+    if ((raw & 0x3) == 0x3) {
+        instruct.raw_instruct = raw;
+        vm->inst_len = INSTRUCT_BYTES;
+    } else {
+        instruct.raw_instruct = expand_compressed((uint16_t)raw);
+        vm->inst_len = COMPRESSED_BYTES;
+    }
 
-            default:
-                instruct_not_implement(instruct);
-                break;
-        }
-    // Guarantee the zero register
-    reg_bank[0] = 0;
+    // A jalr may land on an odd address, which has no cache slot of its own
+    if (!(vm->pc & 1)) {
+        cached->instruct = instruct;
+        cached->length = vm->inst_len;
+    }
+    return instruct;
 }
 
-void running_vm(struct blob* vm_memory) {
-    // Initialze the registers, program counter, virtual routine space
-    for (int i = 0; i < REG_NUM; i++) {
-        reg_bank[i] = 0;
-    }
-    pc = 0;
-    for (int j = 0; j <= VR_END - VR_START; j++) {
-        virtual_routines[j] = 0;
+void predecode_instructs(struct vm* vm) {
+    if (!(vm->isa_extensions & EXT_C)) {
+        return;  // Only mixed length code goes through the decode cache
     }
-
-    while (pc < INST_MEM_SIZE) {
-        // Fetch instruction and execute until all finished
-        union instruction instruct = fetch_instruct(vm_memory);
-        //printf("%08x\n", instruct.raw_instruct);
-        execute_instruct(instruct, vm_memory);
+    uint32_t saved_pc = vm->pc;
+    for (uint32_t address = 0; address < INST_MEM_SIZE; address += COMPRESSED_BYTES) {
+        vm->pc = address;
+        fetch_instruct(vm);
     }
+    vm->pc = saved_pc;
 }
 
-void increment_pc() {
-    pc += INSTRUCT_BYTES;  // Update program counter
+uint32_t encode_SB_instruct(uint32_t func3, uint32_t rs1, uint32_t rs2, int32_t offset) {
+    union instruction instruct;
+    uint32_t imm = (uint32_t)offset;
+    instruct.raw_instruct = 0;
+    instruct.SB_type.opcode = SB_TYPE;
+    instruct.SB_type.func3 = func3;
+    instruct.SB_type.rs1 = rs1;
+    instruct.SB_type.rs2 = rs2;
+    instruct.SB_type.imm4_1 = (imm >> 1) & 0xF;
+    instruct.SB_type.imm10_5 = (imm >> 5) & 0x3F;
+    instruct.SB_type.imm11 = (imm >> 11) & 0x1;
+    instruct.SB_type.imm12 = (imm >> 12) & 0x1;
+    return instruct.raw_instruct;
 }
 
-void handle_R_instruct(union instruction instruct) {
-    uint8_t rd = instruct.R_type.rd;
-    uint8_t func3 = instruct.R_type.func3;
-    uint8_t rs1 = instruct.R_type.rs1;
-    uint8_t rs2 = instruct.R_type.rs2;
-    uint8_t func7 = instruct.R_type.func7;
-
-    // Check the instruction
-    // add: R[rd] = R[rs1] + R[rs2]
-    if (func3 == 0b000 && func7 == 0b0000000) {
-        reg_bank[rd] = reg_bank[rs1] + reg_bank[rs2];
-    }
-    // sub: R[rd] = R[rs1] - R[rs2]
-    else if (func3 == 0b000 && func7 == 0b0100000) {
-        reg_bank[rd] = reg_bank[rs1] - reg_bank[rs2];
-    }
-    // xor: R[rd] = R[rs1] ˆ R[rs2]
-    else if (func3 == 0b100 && func7 == 0b0000000) {
-        reg_bank[rd] = reg_bank[rs1] ^ reg_bank[rs2];
-    }
-    // or: R[rd] = R[rs1] | R[rs2]
-    else if (func3 == 0b110 && func7 == 0b0000000) {
-        reg_bank[rd] = reg_bank[rs1] | reg_bank[rs2];
-    }
-    // and: R[rd] = R[rs1] & R[rs2]
-    else if (func3 == 0b111 && func7 == 0b0000000) {
-        reg_bank[rd] = reg_bank[rs1] & reg_bank[rs2];
-    }
-    // sll: R[rd] = R[rs1] « R[rs2]
-    else if (func3 == 0b001 && func7 == 0b0000000) {
-        reg_bank[rd] = reg_bank[rs1] << reg_bank[rs2];
-    }
-    // srl: R[rd] = R[rs1] » R[rs2]
-    else if (func3 == 0b101 && func7 == 0b0000000) {
-        reg_bank[rd] = reg_bank[rs1] >> reg_bank[rs2];
-    }
-    // sra: R[rd] = R[rs1] » R[rs2]
-    else if (func3 == 0b101 && func7 == 0b0100000) {
-        // Shifting bits should be less than register size (word size 32)
-        uint32_t shifting_bits = reg_bank[rs2] % (WORD_BITS);
-        // Rotate right shifting
-        // Reference:
-        // https://stackoverflow.com/questions/28303232/rotate-right-using-bit-operation-in-c
-        reg_bank[rd] = (reg_bank[rs1] >> shifting_bits) |
-                       (reg_bank[rs1] << (WORD_BITS - shifting_bits));
-    }
-    // slt: R[rd] = (R[rs1] < R[rs2]) ? 1 : 0
-    else if (func3 == 0b010 && func7 == 0b0000000) {
-        reg_bank[rd] = ((int32_t)reg_bank[rs1] < (int32_t)reg_bank[rs2]) ? 1 : 0;
-    }
-    // sltu: R[rd] = (R[rs1] < R[rs2]) ? 1 : 0
-    else if (func3 == 0b011 && func7 == 0b0000000) {
-        reg_bank[rd] = (reg_bank[rs1] < reg_bank[rs2]) ? 1 : 0;
-    } else {
-        instruct_not_implement(instruct);
-    }
-
-    increment_pc();
+uint32_t encode_UJ_instruct(uint32_t rd, int32_t offset) {
+    union instruction instruct;
+    uint32_t imm = (uint32_t)offset;
+    instruct.raw_instruct = 0;
+    instruct.UJ_type.opcode = UJ_TYPE;
+    instruct.UJ_type.rd = rd;
+    instruct.UJ_type.imm10_1 = (imm >> 1) & 0x3FF;
+    instruct.UJ_type.imm11 = (imm >> 11) & 0x1;
+    instruct.UJ_type.imm19_12 = (imm >> 12) & 0xFF;
+    instruct.UJ_type.imm20 = (imm >> 20) & 0x1;
+    return instruct.raw_instruct;
 }
 
-void handle_I1_instruct(union instruction instruct) {
-    uint8_t rd = instruct.I_type.rd;
-    uint8_t func3 = instruct.I_type.func3;
-    uint8_t rs1 = instruct.I_type.rs1;
-    uint32_t imm = instruct.I_type.imm;
-    // Check sign bit, 1 or 0
-    if (imm & 0x800) {
-        imm |= 0xFFFFF000;  // Extend 12 bits to 32
+uint32_t expand_compressed(uint16_t half) {
+    union instruction instruct;
+    instruct.raw_instruct = 0;
+
+    uint32_t quadrant = half & 0x3;
+    uint32_t func3 = (half >> 13) & 0x7;
+    uint32_t rd = (half >> 7) & 0x1F;             // Full register fields, also rs1
+    uint32_t rs2 = (half >> 2) & 0x1F;
+    uint32_t rd_prime = ((half >> 2) & 0x7) + 8;  // Compressed register fields map to x8 - x15
+    uint32_t rs1_prime = ((half >> 7) & 0x7) + 8;
+    // The 6-bit signed immediate shared by c.addi, c.li, c.andi and c.lui
+    int32_t imm6 = (int32_t)((((half >> 12) & 0x1) << 5) | ((half >> 2) & 0x1F));
+    if (imm6 & 0x20) {
+        imm6 -= 0x40;
     }
 
-
-    // Check the instruction
-    switch (func3) {
-        // addi: R[rd] = R[rs1] + imm
-        case 0b000:
-            reg_bank[rd] = reg_bank[rs1] + imm;
-            break;
-
-        // xori: R[rd] = R[rs1] ˆ imm
-        case 0b100:
-            reg_bank[rd] = reg_bank[rs1] ^ imm;
+    switch ((quadrant << 3) | func3) {
+        // c.addi4spn: addi rd', x2, nzuimm
+        case 0b00000: {
+            uint32_t nzuimm = (((half >> 11) & 0x3) << 4) | (((half >> 7) & 0xF) << 6) |
+                              (((half >> 6) & 0x1) << 2) | (((half >> 5) & 0x1) << 3);
+            if (nzuimm == 0) {
+                return half;
+            }
+            instruct.I_type.opcode = I_TYPE_ONE;
+            instruct.I_type.rd = rd_prime;
+            instruct.I_type.rs1 = 2;
+            instruct.I_type.imm = nzuimm;
             break;
+        }
 
-        // ori: R[rd] = R[rs1] | imm
-        case 0b110:
-            reg_bank[rd] = reg_bank[rs1] | imm;
+        // c.lw: lw rd', uimm(rs1')
+        case 0b00010:
+        // c.sw: sw rs2', uimm(rs1')
+        case 0b00110: {
+            uint32_t uimm = (((half >> 10) & 0x7) << 3) | (((half >> 6) & 0x1) << 2) |
+                            (((half >> 5) & 0x1) << 6);
+            if (func3 == 0b010) {
+                instruct.I_type.opcode = I_TYPE_TWO;
+                instruct.I_type.rd = rd_prime;
+                instruct.I_type.func3 = 0b010;
+                instruct.I_type.rs1 = rs1_prime;
+                instruct.I_type.imm = uimm;
+            } else {
+                instruct.S_type.opcode = S_TYPE;
+                instruct.S_type.func3 = 0b010;
+                instruct.S_type.rs1 = rs1_prime;
+                instruct.S_type.rs2 = rd_prime;
+                instruct.S_type.imm4_0 = uimm & 0x1F;
+                instruct.S_type.imm11_5 = uimm >> 5;
+            }
             break;
+        }
 
-        // andi: R[rd] = R[rs1] & imm
-        case 0b111:
-            reg_bank[rd] = reg_bank[rs1] & imm;
+        // c.addi: addi rd, rd, imm (c.nop when rd is x0)
+        case 0b01000:
+        // c.li: addi rd, x0, imm
+        case 0b01010:
+            instruct.I_type.opcode = I_TYPE_ONE;
+            instruct.I_type.rd = rd;
+            instruct.I_type.rs1 = (func3 == 0b000) ? rd : 0;
+            instruct.I_type.imm = (uint32_t)imm6 & 0xFFF;
             break;
 
-        // slti: R[rd] = (R[rs1] < imm) ? 1 : 0
-        case 0b010:
-            reg_bank[rd] = ((int32_t)reg_bank[rs1] < (int32_t)imm) ? 1 : 0;
-            break;
+        // c.jal: jal x1, offset
+        case 0b01001:
+        // c.j: jal x0, offset
+        case 0b01101: {
+            int32_t offset = (int32_t)((((half >> 12) & 0x1) << 11) | (((half >> 11) & 0x1) << 4) |
+                                       (((half >> 9) & 0x3) << 8) | (((half >> 8) & 0x1) << 10) |
+                                       (((half >> 7) & 0x1) << 6) | (((half >> 6) & 0x1) << 7) |
+                                       (((half >> 3) & 0x7) << 1) | (((half >> 2) & 0x1) << 5));
+            if (offset & 0x800) {
+                offset -= 0x1000;
+            }
+            return encode_UJ_instruct((func3 == 0b001) ? 1 : 0, offset);
+        }
 
-        // sltiu: R[rd] = (R[rs1] < imm) ? 1 : 0
-        case 0b011:
-            reg_bank[rd] = (reg_bank[rs1] < imm) ? 1 : 0;
+        // c.addi16sp: addi x2, x2, nzimm; c.lui: lui rd, nzimm
+        case 0b01011:
+            if (rd == 2) {
+                int32_t nzimm = (int32_t)((((half >> 12) & 0x1) << 9) | (((half >> 6) & 0x1) << 4) |
+                                          (((half >> 5) & 0x1) << 6) | (((half >> 3) & 0x3) << 7) |
+                                          (((half >> 2) & 0x1) << 5));
+                if (nzimm & 0x200) {
+                    nzimm -= 0x400;
+                }
+                if (nzimm == 0) {
+                    return half;
+                }
+                instruct.I_type.opcode = I_TYPE_ONE;
+                instruct.I_type.rd = 2;
+                instruct.I_type.rs1 = 2;
+                instruct.I_type.imm = (uint32_t)nzimm & 0xFFF;
+            } else {
+                if (imm6 == 0 || rd == 0) {
+                    return half;
+                }
+                instruct.U_type.opcode = U_TYPE;
+                instruct.U_type.rd = rd;
+                instruct.U_type.imm31_12 = (uint32_t)imm6 & 0xFFFFF;
+            }
             break;
 
-        default:
-            instruct_not_implement(instruct);
+        // c.srli, c.srai, c.andi, c.sub, c.xor, c.or, c.and, all on rd' = rs1'
+        case 0b01100:
+            switch ((half >> 10) & 0x3) {
+                // c.srli: srli rd', rd', shamt
+                case 0b00:
+                // c.srai: srai rd', rd', shamt
+                case 0b01:
+                    if ((half >> 12) & 0x1) {
+                        return half;  // Shift amounts of 32 and above are reserved on RV32
+                    }
+                    instruct.I_type.opcode = I_TYPE_ONE;
+                    instruct.I_type.rd = rs1_prime;
+                    instruct.I_type.func3 = 0b101;
+                    instruct.I_type.rs1 = rs1_prime;
+                    instruct.I_type.imm = (((half >> 10) & 0x1) << 10) | ((uint32_t)imm6 & 0x3F);
+                    break;
+
+                // c.andi: andi rd', rd', imm
+                case 0b10:
+                    instruct.I_type.opcode = I_TYPE_ONE;
+                    instruct.I_type.rd = rs1_prime;
+                    instruct.I_type.func3 = 0b111;
+                    instruct.I_type.rs1 = rs1_prime;
+                    instruct.I_type.imm = (uint32_t)imm6 & 0xFFF;
+                    break;
+
+                // c.sub, c.xor, c.or, c.and: op rd', rd', rs2'
+                default: {
+                    if ((half >> 12) & 0x1) {
+                        return half;  // The RV64 only c.subw and c.addw
+                    }
+                    // Indexed by bits 6:5 of the compressed instruction
+                    const uint32_t func3_by_op[4] = {0b000, 0b100, 0b110, 0b111};
+                    uint32_t op = (half >> 5) & 0x3;
+                    instruct.R_type.opcode = R_TYPE;
+                    instruct.R_type.rd = rs1_prime;
+                    instruct.R_type.func3 = func3_by_op[op];
+                    instruct.R_type.rs1 = rs1_prime;
+                    instruct.R_type.rs2 = rd_prime;
+                    instruct.R_type.func7 = (op == 0) ? 0b0100000 : 0b0000000;
+                    break;
+                }
+            }
             break;
-    }
-
-    increment_pc();
-}
-
-void handle_I2_instruct(union instruction instruct, struct blob* vm_memory) {
-    uint8_t rd = instruct.I_type.rd;
-    uint8_t func3 = instruct.I_type.func3;
-    uint8_t rs1 = instruct.I_type.rs1;
-    uint32_t imm = instruct.I_type.imm;
-    // Check sign bit, 1 or 0
-    if (imm & 0x800) {
-        imm |= 0xFFFFF000;
-    }
 
-    // Check the instruction
-    switch (func3) {
-        // lb: R[rd] = sext(M[R[rs1] + imm])
-        case 0b000:
-            // Get the sign extended value
-            int8_t value_byte = (int8_t)load_byte((int32_t)reg_bank[rs1] + (int32_t)imm, vm_memory, instruct);
-            // Load it into register rd
-            reg_bank[rd] = (int32_t)value_byte;
-            break;
+        // c.beqz: beq rs1', x0, offset
+        case 0b01110:
+        // c.bnez: bne rs1', x0, offset
+        case 0b01111: {
+            int32_t offset = (int32_t)((((half >> 12) & 0x1) << 8) | (((half >> 10) & 0x3) << 3) |
+                                       (((half >> 5) & 0x3) << 6) | (((half >> 3) & 0x3) << 1) |
+                                       (((half >> 2) & 0x1) << 5));
+            if (offset & 0x100) {
+                offset -= 0x200;
+            }
+            return encode_SB_instruct(func3 & 0x1, rs1_prime, 0, offset);
+        }
 
-        // lh: R[rd] = sext(M[R[rs1] + imm])
-        case 0b001:
-            // Get the sign extended value
-            int16_t value_half = (int16_t)load_half_word((int32_t)reg_bank[rs1] + (int32_t)imm, vm_memory, instruct);
-            // Load it into register rd
-            reg_bank[rd] = (int32_t)value_half;
+        // c.slli: slli rd, rd, shamt
+        case 0b10000:
+            if ((half >> 12) & 0x1) {
+                return half;  // Shift amounts of 32 and above are reserved on RV32
+            }
+            instruct.I_type.opcode = I_TYPE_ONE;
+            instruct.I_type.rd = rd;
+            instruct.I_type.func3 = 0b001;
+            instruct.I_type.rs1 = rd;
+            instruct.I_type.imm = (uint32_t)imm6 & 0x3F;
             break;
 
-        // lw: R[rd] = M[R[rs1] + imm]
-        case 0b010:
-            reg_bank[rd] = load_word((int32_t)reg_bank[rs1] + (int32_t)imm, vm_memory, instruct);
+        // c.lwsp: lw rd, uimm(x2)
+        case 0b10010:
+            if (rd == 0) {
+                return half;
+            }
+            instruct.I_type.opcode = I_TYPE_TWO;
+            instruct.I_type.rd = rd;
+            instruct.I_type.func3 = 0b010;
+            instruct.I_type.rs1 = 2;
+            instruct.I_type.imm = (((half >> 12) & 0x1) << 5) | (((half >> 4) & 0x7) << 2) |
+                                  (((half >> 2) & 0x3) << 6);
             break;
 
-        // lbu: R[rd] = M[R[rs1] + imm]
-        case 0b100:
-            reg_bank[rd] = (uint32_t)load_byte((int32_t)reg_bank[rs1] + (int32_t)imm, vm_memory, instruct);
+        // c.jr, c.mv, c.ebreak, c.jalr, c.add
+        case 0b10100:
+            if (rs2 == 0) {
+                if (rd == 0) {
+                    // c.ebreak expands to ebreak, which is not implemented
+                    return ((half >> 12) & 0x1) ? 0x00100073 : half;
+                }
+                // c.jr: jalr x0, 0(rs1); c.jalr: jalr x1, 0(rs1)
+                instruct.I_type.opcode = I_TYPE_THREE;
+                instruct.I_type.rd = (half >> 12) & 0x1;
+                instruct.I_type.rs1 = rd;
+            } else {
+                // c.mv: add rd, x0, rs2; c.add: add rd, rd, rs2
+                instruct.R_type.opcode = R_TYPE;
+                instruct.R_type.rd = rd;
+                instruct.R_type.rs1 = ((half >> 12) & 0x1) ? rd : 0;
+                instruct.R_type.rs2 = rs2;
+            }
             break;
 
-        // lhu: R[rd] = M[R[rs1] + imm]
-        case 0b101:
-            reg_bank[rd] = (uint32_t)load_half_word((int32_t)reg_bank[rs1] + (int32_t)imm, vm_memory, instruct);
+        // c.swsp: sw rs2, uimm(x2)
+        case 0b10110: {
+            uint32_t uimm = (((half >> 9) & 0xF) << 2) | (((half >> 7) & 0x3) << 6);
+            instruct.S_type.opcode = S_TYPE;
+            instruct.S_type.func3 = 0b010;
+            instruct.S_type.rs1 = 2;
+            instruct.S_type.rs2 = rs2;
+            instruct.S_type.imm4_0 = uimm & 0x1F;
+            instruct.S_type.imm11_5 = uimm >> 5;
             break;
+        }
 
+        // The floating point loads and stores, and reserved encodings
         default:
-            instruct_not_implement(instruct);
-            break;
+            return half;
     }
 
-    increment_pc();
+    return instruct.raw_instruct;
 }
 
-void handle_I3_instruct(union instruction instruct) {
-    uint8_t rd = instruct.I_type.rd;
-    uint8_t func3 = instruct.I_type.func3;
-    uint8_t rs1 = instruct.I_type.rs1;
-    uint32_t imm = instruct.I_type.imm;
-    // Check sign bit, 1 or 0
-    if (imm & 0x800) {
-        imm |= 0xFFFFF000;
-    }
+void execute_instruct(struct vm* vm, union instruction instruct) {
+    // One indexed lookup replaces decoding by opcode, then func3, then func7
+    decode_instruct(vm->isa_extensions, instruct)->execute(vm, instruct);
+    // Guarantee the zero register
+    vm->reg_bank[0] = 0;
+}
 
-    // Check the instruction
-    // jalr: R[rd] = PC + 4; PC = R[rs1] + imm
-    if (func3 == 0b000) {
-        reg_bank[rd] = pc + INSTRUCT_BYTES;
-        pc = (int32_t)reg_bank[rs1] + (int32_t)imm;
-    } else {
-        instruct_not_implement(instruct);
+void reset_vm(struct vm* vm) {
+    // Initialze the registers, program counter, virtual routine space and counters
+    for (int i = 0; i < REG_NUM; i++) {
+        vm->reg_bank[i] = 0;
     }
+    vm->pc = 0;
+    for (int j = 0; j <= VR_END - VR_START; j++) {
+        vm->virtual_routines[j] = 0;
+    }
+    vm->instret = 0;
+    clock_gettime(CLOCK_MONOTONIC, &vm->start_time);
 }
 
-void handle_S_instruct(union instruction instruct, struct blob* vm_memory) {
-    uint8_t func3 = instruct.S_type.func3;
-    uint8_t rs1 = instruct.S_type.rs1;
-    uint8_t rs2 = instruct.S_type.rs2;
-    uint32_t imm4_0 = instruct.S_type.imm4_0;
-    uint32_t imm11_5 = instruct.S_type.imm11_5;
-    uint32_t imm = (imm11_5 << 5) | imm4_0;
-    // Check sign bit, 1 or 0
-    if (imm & 0x800) {
-        imm |= 0xFFFFF000;
+void step_instruct(struct vm* vm) {
+    union instruction instruct = fetch_instruct(vm);
+    if (vm->cache_sim) {
+        cache_fetch(vm->cache_sim, vm->pc, vm->inst_len);
     }
+    finish_instruct(vm, instruct);
+}
 
-    // Check the instruction
-    switch (func3) {
-        // sb: M[R[rs1] + imm] = R[rs2]
-        case 0b000:
-            store_byte((int32_t)reg_bank[rs1] + (int32_t)imm, (uint8_t)reg_bank[rs2], vm_memory, instruct);
-            break;
-
-        // sh: M[R[rs1] + imm] = R[rs2]
-        case 0b001:
-            store_half_word((int32_t)reg_bank[rs1] + (int32_t)imm, (uint16_t)reg_bank[rs2], vm_memory, instruct);
-            break;
-
-        // sw: M[R[rs1] + imm] = R[rs2]
-        case 0b010:
-            store_word((int32_t)reg_bank[rs1] + (int32_t)imm, reg_bank[rs2], vm_memory, instruct);
-            break;
-
-        default:
-            instruct_not_implement(instruct);
-            break;
+void finish_instruct(struct vm* vm, union instruction instruct) {
+    execute_instruct(vm, instruct);
+    if (vm->pipeline) {
+        pipeline_retire(vm->pipeline, vm->isa_extensions, instruct);
+    }
+    vm->instret++;
+    if (vm->profile && --vm->profile->countdown == 0) {
+        profile_sample(vm);
     }
-
-    increment_pc();
 }
 
-void handle_SB_instruct(union instruction instruct) {
-    uint32_t imm11 = instruct.SB_type.imm11;
-    uint32_t imm4_1 = instruct.SB_type.imm4_1;
-    uint8_t func3 = instruct.SB_type.func3;
-    uint8_t rs1 = instruct.SB_type.rs1;
-    uint8_t rs2 = instruct.SB_type.rs2;
-    uint32_t imm10_5 = instruct.SB_type.imm10_5;
-    uint32_t imm12 = instruct.SB_type.imm12;
-    // Concatinate imm
-    uint32_t imm = (imm12 << 11) | (imm11 << 10) | (imm10_5 << 4) | imm4_1;
-
-    // Check the sign bit, o or 1
-    if (imm & 0x800) {
-        imm |= 0xFFFFF000;
+void vm_stop(struct vm* vm, enum vm_status status) {
+    vm->status = status;
+    if (vm->harts) {
+        hart_stop(vm, status);
     }
-    // Check instruction
-    int is_branch = 0;  // The flag to record whether it shoule be a branch
-    switch (func3) {
-        // beq: if(R[rs1] == R[rs2]) then PC = PC + (imm « 1)
-        case 0b000:
-            is_branch = (reg_bank[rs1] == reg_bank[rs2]);
-            break;
-        // bne: if(R[rs1] != R[rs2]) then PC = PC + (imm « 1)
-        case 0b001:
-            is_branch = (reg_bank[rs1] != reg_bank[rs2]);
-            break;
-        // blt: if(R[rs1] < R[rs2]) then PC = PC + (imm « 1)
-        case 0b100:
-            is_branch = ((int32_t)reg_bank[rs1] < (int32_t)reg_bank[rs2]);
-            break;
-        // bltu: if(R[rs1] < R[rs2]) then PC = PC + (imm « 1)
-        case 0b110:
-            is_branch = (reg_bank[rs1] < reg_bank[rs2]);
-            break;
-        // bge: if(R[rs1] >= R[rs2]) then PC = PC + (imm « 1)
-        case 0b101:
-            is_branch = ((int32_t)reg_bank[rs1] >= (int32_t)reg_bank[rs2]);
-            break;
-        // bgeu: if(R[rs1] >= R[rs2]) then PC = PC + (imm « 1)
-        case 0b111:
-            is_branch = (reg_bank[rs1] >= reg_bank[rs2]);
-            break;
-        default:
-            instruct_not_implement(instruct);
-            break;
+    longjmp(vm->stop, 1);
+}
+
+void vm_vprintf(struct vm* vm, const char* format, va_list args) {
+    char buffer[VM_PRINT_BUFFER];
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    if (len > 0) {
+        // Longer output is cut off, no single routine writes anywhere near that much
+        size_t size = (size_t)len < sizeof(buffer) ? (size_t)len : sizeof(buffer) - 1;
+        vm->console.write(vm->console.context, buffer, size);
     }
+}
 
-    if (is_branch) {
-        pc += (int32_t)(imm << 1);
+void vm_printf(struct vm* vm, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vm_vprintf(vm, format, args);
+    va_end(args);
+}
+
+void report_printf(struct vm* vm, FILE* out, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (out) {
+        vfprintf(out, format, args);
     } else {
-        increment_pc();
+        vm_vprintf(vm, format, args);
     }
+    va_end(args);
 }
 
-void handle_U_instruct(union instruction instruct) {
-    uint8_t rd = instruct.U_type.rd;
-    uint32_t imm31_12 = instruct.U_type.imm31_12;
+int stdio_read_char(void* context) {
+    return getchar();
+}
 
-    // lui: R[rd] = {31:12 = imm | 11:0 = 0
-    uint32_t imm = imm31_12 << 12;
-    reg_bank[rd] = imm;
+int stdio_read_int(void* context, int32_t* value) {
+    int sint;
+    if (scanf("%d", &sint) != 1) {
+        return 0;
+    }
+    *value = (int32_t)sint;
+    return 1;
+}
 
-    increment_pc();
+void stdio_write(void* context, const char* data, size_t len) {
+    fwrite(data, 1, len, stdout);
 }
 
-void handle_UJ_instruct(union instruction instruct) {
-    uint8_t rd = instruct.UJ_type.rd;
-    uint32_t imm19_12 = instruct.UJ_type.imm19_12;
-    uint32_t imm11 = instruct.UJ_type.imm11;
-    uint32_t imm10_1 = instruct.UJ_type.imm10_1;
-    uint32_t imm20 = instruct.UJ_type.imm20;
-    // Concatinate imm
-    uint32_t imm = (imm20 << 19) | (imm19_12 << 11) | (imm11 << 10) | imm10_1;
+void increment_pc(struct vm* vm) {
+    vm->pc += vm->inst_len;  // Update program counter
+}
 
-    // jal: R[rd] = PC + 4; PC = PC + (imm « 1)
-    imm <<= 1;
-    // Check sign bit, 1 or 0
-    if (imm & 0x80000) {
-        imm |= 0xFFF00000;
+// Operand vocabulary of the semantics in INSTRUCTION_TABLE
+#define RD vm->reg_bank[op.rd]
+#define RS1 vm->reg_bank[op.rs1]
+#define RS2 vm->reg_bank[op.rs2]
+#define RS3 vm->reg_bank[op.rs3]
+#define IMM op.imm
+#define SRS1 ((int32_t)RS1)
+#define SRS2 ((int32_t)RS2)
+#define SIMM ((int32_t)IMM)
+#define ADDR ((uint32_t)(SRS1 + SIMM))
+#define NEXT increment_pc(vm)
+#define AMO(operation) atomic_memory_operation(vm, RS1, RS2, operation, instruct)
+#define PACKED(operation, lane_bits) packed_operation(RS1, RS2, operation, lane_bits)
+#define BRANCH(condition)                                  \
+    int taken = (condition);                               \
+    if (vm->pipeline) {                                    \
+        pipeline_branch(vm->pipeline, vm->pc, IMM, taken); \
+    }                                                      \
+    if (taken) {                                           \
+        vm->pc += IMM;                                     \
+    } else {                                               \
+        increment_pc(vm);                                  \
+    }
+// The link skips 2 bytes after a compressed jump
+#define LINK_AND_JUMP(target)             \
+    RD = vm->pc + vm->inst_len;           \
+    vm->pc = (target)
+// Calls link into ra and returns jump through it
+#define PROFILE_CALL                                      \
+    if (vm->profile && op.rd == RETURN_ADDRESS_REG) {     \
+        profile_call(vm->profile, vm->pc);                \
+    }
+#define PROFILE_RETURN                                                          \
+    if (vm->profile && op.rd == 0 && op.rs1 == RETURN_ADDRESS_REG) {            \
+        profile_return(vm->profile);                                            \
     }
 
-    reg_bank[rd] = pc + INSTRUCT_BYTES;
-    pc += (int32_t)imm;
-}
-
-void instruct_not_implement(union instruction instruct) {
-    printf("Instruction Not Implemented: 0x%08x\n", instruct.raw_instruct);
-    register_dump();
-    exit(1);
+#define EXECUTE_DEFINITION(mnemonic, format, opcode, func3, func7, extensions, ...)   \
+    void execute_##mnemonic(struct vm* vm, union instruction instruct) {            \
+        struct operands op = decode_operands(instruct, FORMAT_##format);            \
+        __VA_ARGS__;                                                                \
+    }
+INSTRUCTION_TABLE(EXECUTE_DEFINITION)
+#undef EXECUTE_DEFINITION
+
+void instruct_not_implement(struct vm* vm, union instruction instruct) {
+    hart_lock_console(vm);  // Released by vm_stop
+    vm_printf(vm, "Instruction Not Implemented: 0x%08x\n", instruct.raw_instruct);
+    register_dump(vm);
+    vm_stop(vm, VM_NOT_IMPLEMENTED);
 }
 
-void register_dump() {
-    printf("PC = 0x%08x;\n", pc);
+void register_dump(struct vm* vm) {
+    vm_printf(vm, "PC = 0x%08x;\n", vm->pc);
     for (int i = 0; i < REG_NUM; i++) {
-        printf("R[%d] = 0x%08x;\n", i, reg_bank[i]);
+        vm_printf(vm, "R[%d] = 0x%08x;\n", i, vm->reg_bank[i]);
     }
 }
 
-int is_valid_address(uint32_t address) {
+int is_valid_address(struct vm* vm, uint32_t address) {
     // From instruction menory start to virtual routine end addresses, 0 ~ 0x8ff
     if (address <= VIRTUAL_ROUTINE_END) {
         return 1;
     }
 
+    if (vm->harts) {
+        return hart_heap_address_valid(vm, address);
+    }
+
     // Check whether it is the allocated address in heap block
-    struct heap_node* cursor = &head;
+    struct heap_node* cursor = &vm->head;
     while (cursor) {
         if ((cursor->allocated_size > 0) && (address >= cursor->address) &&
             (address <(cursor->address + cursor->allocated_size))) {
@@ -456,77 +541,143 @@ int is_valid_address(uint32_t address) {
     return 0;
 }
 
-void illegal_operation(union instruction instruct) {
-    printf("Illegal Operation: 0x%08x\n", instruct.raw_instruct);
-    register_dump();
-    exit(1);
+void illegal_operation(struct vm* vm, union instruction instruct) {
+    hart_lock_console(vm);  // Released by vm_stop
+    vm_printf(vm, "Illegal Operation: 0x%08x\n", instruct.raw_instruct);
+    register_dump(vm);
+    vm_stop(vm, VM_ILLEGAL_OPERATION);
 }
 
-uint8_t load_byte(uint32_t address, struct blob* vm_memory, union instruction instruct) {
-    if (!is_valid_address(address)) {
-        illegal_operation(instruct);
+uint8_t load_byte(struct vm* vm, uint32_t address, union instruction instruct) {
+    if (vm->guard) {
+        // Illegal addresses fault in the guard page and the instruction is retried on the checked path below
+        struct guard_block* block = GUARD_BLOCK(vm->guard, address);
+        if (GUARD_FITS(block, address, 1)) {
+            uint8_t b = block->load[GUARD_OFFSET(address)];
+            // Instruction memory is fetched through the I-cache, only data and heap loads go through this one
+            if (vm->cache_sim && address >= DATA_MEM_START) {
+                cache_data_access(vm->cache_sim, address, 1, vm->pc);
+            }
+            return b;
+        }
+    }
+    struct vm* machine = MACHINE(vm);  // Data memory and heap are shared between harts
+    if (!is_valid_address(vm, address)) {
+        // Nothing past the heap is memory but the input file, read in place and not cached
+        if (address >= INPUT_WINDOW_START) {
+            return (uint8_t)input_load(vm, address, 1, instruct);
+        }
+        illegal_operation(vm, instruct);
     }
 
     uint8_t b;
     if (address >= DATA_MEM_START && address <= DATA_MEM_END) {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 1, vm->pc);
+        }
         // Data area
-        b = (uint8_t)vm_memory->data_mem[address - DATA_MEM_START];
+        b = (uint8_t)machine->memory.data_mem[address - DATA_MEM_START];
     } else if (address <= INST_MEM_END) {
         // Instruction area
-        b = (uint8_t)vm_memory->inst_mem[address];
+        b = (uint8_t)vm->program->inst_mem[address];
     } else if (address >= VR_START && address <= VR_END) {
         // Virtual routines for read type
-        b = (uint8_t)console_read_routine(address, vm_memory);
+        hart_lock_console(vm);
+        b = (uint8_t)console_read_routine(vm, address);
+        hart_unlock_console(vm);
     } else {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 1, vm->pc);
+        }
         // Heap area
-        b = (uint8_t)heap_banks[address - HEAP_START];
+        b = (uint8_t)machine->heap_banks[address - HEAP_START];
     }
     return b;
 }
 
-uint16_t load_half_word(uint32_t address, struct blob* vm_memory, union instruction instruct) {
+uint16_t load_half_word(struct vm* vm, uint32_t address, union instruction instruct) {
+    if (vm->guard) {
+        struct guard_block* block = GUARD_BLOCK(vm->guard, address);
+        if (GUARD_FITS(block, address, 2)) {
+            const unsigned char* p = block->load + GUARD_OFFSET(address);
+            uint16_t half_word = (uint16_t)(p[0] | (p[1] << 8));
+            // Instruction memory is fetched through the I-cache, only data and heap loads go through this one
+            if (vm->cache_sim && address >= DATA_MEM_START) {
+                cache_data_access(vm->cache_sim, address, 2, vm->pc);
+            }
+            return half_word;
+        }
+    }
     // Check illegal address for both first byte and second byte
-    if (!is_valid_address(address) || !is_valid_address(address+1)) {
-        illegal_operation(instruct);
+    struct vm* machine = MACHINE(vm);  // Data memory and heap are shared between harts
+    if (!is_valid_address(vm, address) || !is_valid_address(vm, address+1)) {
+        if (address >= INPUT_WINDOW_START) {
+            return (uint16_t)input_load(vm, address, 2, instruct);
+        }
+        illegal_operation(vm, instruct);
     }
 
     uint16_t half_word;
     uint16_t first_byte;
     uint16_t second_byte;
     if (address >= DATA_MEM_START && address < DATA_MEM_END) {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 2, vm->pc);
+        }
         // Data mem
         // Get the two bytes
-        first_byte = (uint16_t)vm_memory->data_mem[address - DATA_MEM_START];
-        second_byte = (uint16_t)vm_memory->data_mem[address + 1 - DATA_MEM_START];
+        first_byte = (uint16_t)machine->memory.data_mem[address - DATA_MEM_START];
+        second_byte = (uint16_t)machine->memory.data_mem[address + 1 - DATA_MEM_START];
         // Concatenating two bytes together
         half_word = first_byte | (second_byte << 8);
     } else if (address < INST_MEM_END) {
         // Inst men
         // Get the two bytes
-        first_byte = (uint16_t)vm_memory->inst_mem[address];
-        second_byte = (uint16_t)vm_memory->inst_mem[address + 1];
+        first_byte = (uint16_t)vm->program->inst_mem[address];
+        second_byte = (uint16_t)vm->program->inst_mem[address + 1];
         // Concatenating two bytes together
         half_word = first_byte | (second_byte << 8);
     } else if (address >= VR_START && address <= VR_END) {
         // Virtual routines for read type
-        half_word = (uint16_t)console_read_routine(address, vm_memory);
+        hart_lock_console(vm);
+        half_word = (uint16_t)console_read_routine(vm, address);
+        hart_unlock_console(vm);
     } else {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 2, vm->pc);
+        }
         // Heap area
-        first_byte = (uint16_t)heap_banks[address - HEAP_START];
-        second_byte = (uint16_t)heap_banks[address - HEAP_START + 1];
+        first_byte = (uint16_t)machine->heap_banks[address - HEAP_START];
+        second_byte = (uint16_t)machine->heap_banks[address - HEAP_START + 1];
         // Concatenating two bytes together
         half_word = first_byte | (second_byte << 8);
     }
     return half_word;
 }
 
-uint32_t load_word(uint32_t address, struct blob* vm_memory, union instruction instruct) {
+uint32_t load_word(struct vm* vm, uint32_t address, union instruction instruct) {
+    if (vm->guard) {
+        struct guard_block* block = GUARD_BLOCK(vm->guard, address);
+        if (GUARD_FITS(block, address, 4)) {
+            const unsigned char* p = block->load + GUARD_OFFSET(address);
+            uint32_t word = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+            // Instruction memory is fetched through the I-cache, only data and heap loads go through this one
+            if (vm->cache_sim && address >= DATA_MEM_START) {
+                cache_data_access(vm->cache_sim, address, 4, vm->pc);
+            }
+            return word;
+        }
+    }
     // Check invalid address for all four bytes
-    if (!is_valid_address(address) || 
-        !is_valid_address(address+1) || 
-        !is_valid_address(address+2) || 
-        !is_valid_address(address+3)) {
-        illegal_operation(instruct);
+    struct vm* machine = MACHINE(vm);  // Data memory and heap are shared between harts
+    if (!is_valid_address(vm, address) || 
+        !is_valid_address(vm, address+1) || 
+        !is_valid_address(vm, address+2) || 
+        !is_valid_address(vm, address+3)) {
+        if (address >= INPUT_WINDOW_START) {
+            return input_load(vm, address, 4, instruct);
+        }
+        illegal_operation(vm, instruct);
     }
 
     uint32_t word;
@@ -535,139 +686,260 @@ uint32_t load_word(uint32_t address, struct blob* vm_memory, union instruction i
     uint32_t third_byte;
     uint32_t fourth_byte;
     if (address >= DATA_MEM_START && address <= (DATA_MEM_END - 3)) {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 4, vm->pc);
+        }
         // Data mem
         // Get the four bytes
-        first_byte = (uint32_t)vm_memory->data_mem[address - DATA_MEM_START];
-        second_byte = (uint32_t)vm_memory->data_mem[address + 1 - DATA_MEM_START];
-        third_byte = (uint32_t)vm_memory->data_mem[address + 2 - DATA_MEM_START];
-        fourth_byte = (uint32_t)vm_memory->data_mem[address + 3 - DATA_MEM_START];
+        first_byte = (uint32_t)machine->memory.data_mem[address - DATA_MEM_START];
+        second_byte = (uint32_t)machine->memory.data_mem[address + 1 - DATA_MEM_START];
+        third_byte = (uint32_t)machine->memory.data_mem[address + 2 - DATA_MEM_START];
+        fourth_byte = (uint32_t)machine->memory.data_mem[address + 3 - DATA_MEM_START];
         // Concatenating four bytes together
         word = first_byte | (second_byte << 8) | (third_byte << 16) | (fourth_byte << 24);
     } else if (address <= (INST_MEM_END - 3)) {
         // Inst mem
         // Get the four bytes
-        first_byte = (uint32_t)vm_memory->inst_mem[address];
-        second_byte = (uint32_t)vm_memory->inst_mem[address + 1];
-        third_byte = (uint32_t)vm_memory->inst_mem[address + 2];
-        fourth_byte = (uint32_t)vm_memory->inst_mem[address + 3];
+        first_byte = (uint32_t)vm->program->inst_mem[address];
+        second_byte = (uint32_t)vm->program->inst_mem[address + 1];
+        third_byte = (uint32_t)vm->program->inst_mem[address + 2];
+        fourth_byte = (uint32_t)vm->program->inst_mem[address + 3];
         // Concatenating four bytes together
         word = first_byte | (second_byte << 8) | (third_byte << 16) | (fourth_byte << 24);
     } else if (address >= VR_START && address <= VR_END) {
         // Virtual routines for read type
-        word = console_read_routine(address, vm_memory);
+        hart_lock_console(vm);
+        word = console_read_routine(vm, address);
+        hart_unlock_console(vm);
     } else {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 4, vm->pc);
+        }
         // Heap
-        first_byte = (uint32_t)heap_banks[address - HEAP_START];
-        second_byte = (uint32_t)heap_banks[address + 1 - HEAP_START];
-        third_byte = (uint32_t)heap_banks[address + 2 - HEAP_START];
-        fourth_byte = (uint32_t)heap_banks[address + 3 - HEAP_START];
+        first_byte = (uint32_t)machine->heap_banks[address - HEAP_START];
+        second_byte = (uint32_t)machine->heap_banks[address + 1 - HEAP_START];
+        third_byte = (uint32_t)machine->heap_banks[address + 2 - HEAP_START];
+        fourth_byte = (uint32_t)machine->heap_banks[address + 3 - HEAP_START];
         // Concatenating four bytes together
         word = first_byte | (second_byte << 8) | (third_byte << 16) | (fourth_byte << 24);
     }
     return word;
 }
 
-void store_byte(uint32_t address, uint8_t value, struct blob* vm_memory, union instruction instruct) {
+void store_byte(struct vm* vm, uint32_t address, uint8_t value, union instruction instruct) {
+    if (vm->guard) {
+        // A store to instruction memory marks a page it never writes, the run stops at the fault anyway
+        struct guard_block* block = GUARD_BLOCK(vm->guard, address);
+        if (GUARD_FITS(block, address, 1)) {
+            mark_dirty(vm, address);
+            block->store[GUARD_OFFSET(address)] = value;
+            if (vm->cache_sim) {
+                cache_data_access(vm->cache_sim, address, 1, vm->pc);
+            }
+            return;
+        }
+    }
     // Check invalid address
-    if (!is_valid_address(address)) {
-        illegal_operation(instruct);
+    struct vm* machine = MACHINE(vm);  // Data memory and heap are shared between harts
+    if (!is_valid_address(vm, address)) {
+        illegal_operation(vm, instruct);
     }
 
     if (address >= DATA_MEM_START && address <= DATA_MEM_END) {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 1, vm->pc);
+        }
         // Data mem
-        vm_memory->data_mem[address - DATA_MEM_START] = value;
+        mark_dirty(vm, address);
+        machine->memory.data_mem[address - DATA_MEM_START] = value;
     } else if (address <= INST_MEM_END) {
         // Inst mem, read only
-        illegal_operation(instruct);
+        illegal_operation(vm, instruct);
     } else if (address >= VR_START && address <= VR_END) {
         // Virtual routines write type
-        int is_routine = console_write_routine(address, (uint32_t)value, vm_memory, instruct);
+        hart_lock_console(vm);
+        int is_routine = console_write_routine(vm, address, (uint32_t)value, instruct);
+        hart_unlock_console(vm);
         // Not routine
         if (!is_routine) {
-            illegal_operation(instruct);
+            illegal_operation(vm, instruct);
         }
     } else {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 1, vm->pc);
+        }
         // Heap area
-        heap_banks[address - HEAP_START] = value;
+        mark_dirty(vm, address);
+        machine->heap_banks[address - HEAP_START] = value;
     }
 }
 
-void store_half_word(uint32_t address, uint16_t value, struct blob* vm_memory, union instruction instruct) {
+void store_half_word(struct vm* vm, uint32_t address, uint16_t value, union instruction instruct) {
+    if (vm->guard) {
+        struct guard_block* block = GUARD_BLOCK(vm->guard, address);
+        if (GUARD_FITS(block, address, 2)) {
+            unsigned char* p = block->store + GUARD_OFFSET(address);
+            mark_dirty(vm, address);
+            p[0] = (uint8_t)(value & 0xFF);
+            p[1] = (uint8_t)((value >> 8) & 0xFF);
+            if (vm->cache_sim) {
+                cache_data_access(vm->cache_sim, address, 2, vm->pc);
+            }
+            return;
+        }
+    }
     // Check invalid address for both first byte and second byte
-    if (!is_valid_address(address) || !is_valid_address(address+1)) {
-        illegal_operation(instruct);
+    struct vm* machine = MACHINE(vm);  // Data memory and heap are shared between harts
+    if (!is_valid_address(vm, address) || !is_valid_address(vm, address+1)) {
+        illegal_operation(vm, instruct);
     }
 
     if (address >= DATA_MEM_START && address < DATA_MEM_END) {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 2, vm->pc);
+        }
+        mark_dirty(vm, address);
+        mark_dirty(vm, address + 1);
         // Store the lower 8 bits
-        vm_memory->data_mem[address - DATA_MEM_START] = (uint8_t)(value & 0xFF);
+        machine->memory.data_mem[address - DATA_MEM_START] = (uint8_t)(value & 0xFF);
         // Store the higher 8 bits
-        vm_memory->data_mem[address + 1 - DATA_MEM_START] = (uint8_t)((value >> 8) & 0xFF);
+        machine->memory.data_mem[address + 1 - DATA_MEM_START] = (uint8_t)((value >> 8) & 0xFF);
     } else if (address <= INST_MEM_END) {
         // Inst mem, read only
-        illegal_operation(instruct);
+        illegal_operation(vm, instruct);
     } else if (address >= VR_START && address <= VR_END) {
         // Virtual routines write type
-        int is_routine = console_write_routine(address, (uint32_t)value, vm_memory, instruct);
+        hart_lock_console(vm);
+        int is_routine = console_write_routine(vm, address, (uint32_t)value, instruct);
+        hart_unlock_console(vm);
         // Not routine
         if (!is_routine) {
-            illegal_operation(instruct);
+            illegal_operation(vm, instruct);
         }
     } else {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 2, vm->pc);
+        }
         // Heap area
-        heap_banks[address - HEAP_START] = (uint8_t)(value & 0xFF);
-        heap_banks[address + 1 - HEAP_START] = (uint8_t)((value >> 8) & 0xFF);
+        mark_dirty(vm, address);
+        mark_dirty(vm, address + 1);
+        machine->heap_banks[address - HEAP_START] = (uint8_t)(value & 0xFF);
+        machine->heap_banks[address + 1 - HEAP_START] = (uint8_t)((value >> 8) & 0xFF);
     }
 }
 
-void store_word(uint32_t address, uint32_t value, struct blob* vm_memory, union instruction instruct) {
+void store_word(struct vm* vm, uint32_t address, uint32_t value, union instruction instruct) {
+    if (vm->guard) {
+        // The block holds the whole word, so it is a single dirty page
+        struct guard_block* block = GUARD_BLOCK(vm->guard, address);
+        if (GUARD_FITS(block, address, 4)) {
+            unsigned char* p = block->store + GUARD_OFFSET(address);
+            mark_dirty(vm, address);
+            p[0] = (uint8_t)(value & 0xFF);
+            p[1] = (uint8_t)((value >> 8) & 0xFF);
+            p[2] = (uint8_t)((value >> 16) & 0xFF);
+            p[3] = (uint8_t)((value >> 24) & 0xFF);
+            if (vm->cache_sim) {
+                cache_data_access(vm->cache_sim, address, 4, vm->pc);
+            }
+            return;
+        }
+    }
     // Check invalid address for all four bytes
-    if (!is_valid_address(address) ||
-        !is_valid_address(address+1) ||
-        !is_valid_address(address+2) ||
-        !is_valid_address(address+3)) {
-        illegal_operation(instruct);
+    struct vm* machine = MACHINE(vm);  // Data memory and heap are shared between harts
+    if (!is_valid_address(vm, address) ||
+        !is_valid_address(vm, address+1) ||
+        !is_valid_address(vm, address+2) ||
+        !is_valid_address(vm, address+3)) {
+        illegal_operation(vm, instruct);
     }
 
     if (address >= DATA_MEM_START && address <= DATA_MEM_END - 3) {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 4, vm->pc);
+        }
+        // An unaligned word may straddle two pages
+        mark_dirty(vm, address);
+        mark_dirty(vm, address + 3);
         // Store the 4 bytes respectively
-        vm_memory->data_mem[address - DATA_MEM_START] = (uint8_t)(value & 0xFF);
-        vm_memory->data_mem[address + 1 - DATA_MEM_START] = (uint8_t)((value >> 8) & 0xFF);
-        vm_memory->data_mem[address + 2 - DATA_MEM_START] = (uint8_t)((value >> 16) & 0xFF);
-        vm_memory->data_mem[address + 3 - DATA_MEM_START] = (uint8_t)((value >> 24) & 0xFF);
+        machine->memory.data_mem[address - DATA_MEM_START] = (uint8_t)(value & 0xFF);
+        machine->memory.data_mem[address + 1 - DATA_MEM_START] = (uint8_t)((value >> 8) & 0xFF);
+        machine->memory.data_mem[address + 2 - DATA_MEM_START] = (uint8_t)((value >> 16) & 0xFF);
+        machine->memory.data_mem[address + 3 - DATA_MEM_START] = (uint8_t)((value >> 24) & 0xFF);
     } else if (address <= INST_MEM_END) {
         // Inst mem, read only
-        illegal_operation(instruct);
+        illegal_operation(vm, instruct);
     } else if (address >= VR_START && address <= VR_END) {
         // Virtual routines write type
-        int is_routine = console_write_routine(address, value, vm_memory, instruct);
+        hart_lock_console(vm);
+        int is_routine = console_write_routine(vm, address, value, instruct);
+        hart_unlock_console(vm);
         // Not routine
         if (!is_routine) {
-            illegal_operation(instruct);
+            illegal_operation(vm, instruct);
         }
     } else {
+        if (vm->cache_sim) {
+            cache_data_access(vm->cache_sim, address, 4, vm->pc);
+        }
         // Heap area
-        heap_banks[address - HEAP_START] = (uint8_t)(value & 0xFF);
-        heap_banks[address + 1 - HEAP_START] = (uint8_t)((value >> 8) & 0xFF);
-        heap_banks[address + 2 - HEAP_START] = (uint8_t)((value >> 16) & 0xFF);
-        heap_banks[address + 3 - HEAP_START] = (uint8_t)((value >> 24) & 0xFF);
+        mark_dirty(vm, address);
+        mark_dirty(vm, address + 3);
+        machine->heap_banks[address - HEAP_START] = (uint8_t)(value & 0xFF);
+        machine->heap_banks[address + 1 - HEAP_START] = (uint8_t)((value >> 8) & 0xFF);
+        machine->heap_banks[address + 2 - HEAP_START] = (uint8_t)((value >> 16) & 0xFF);
+        machine->heap_banks[address + 3 - HEAP_START] = (uint8_t)((value >> 24) & 0xFF);
     }
 }
 
-uint32_t console_read_routine(uint32_t address, struct blob* vm_memory) {
+uint64_t elapsed_micros(struct vm* vm) {
+    vm->read_host_clock = 1;  // The run now depends on more than its image and input
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t micros = (int64_t)(now.tv_sec - vm->start_time.tv_sec) * 1000000 +
+                     (now.tv_nsec - vm->start_time.tv_nsec) / 1000;
+    return (uint64_t)micros;
+}
+
+uint32_t console_read_routine(struct vm* vm, uint32_t address) {
     switch (address) {
+        // 0x0840 - Retired instructions, not counting the current one
+        case VR_READ_INSTRET:
+        // 0x0850 - Cycles, each instruction takes one
+        case VR_READ_CYCLE:
+            return (uint32_t)vm->instret;
+            break;
+        case VR_READ_INSTRET_HIGH:
+        case VR_READ_CYCLE_HIGH:
+            return (uint32_t)(vm->instret >> 32);
+            break;
+        // 0x0848 - Host monotonic time in microseconds
+        case VR_READ_TIME:
+            return (uint32_t)elapsed_micros(vm);
+            break;
+        case VR_READ_TIME_HIGH:
+            return (uint32_t)(elapsed_micros(vm) >> 32);
+            break;
+        // 0x085C - Hart id
+        case VR_READ_HART_ID:
+            return vm->hart_id;
+            break;
+        // 0x0860 - 0x0868 - Input file length, cursor and the byte at the cursor
+        case VR_INPUT_LENGTH:
+        case VR_INPUT_CURSOR:
+        case VR_INPUT_READ_CHAR:
+            return input_read_routine(vm, address);
+            break;
         // 0x0812 - Console Read Character
         case VR_READ_CHAR:
-            uint32_t ch = (uint32_t)getchar();
+            uint32_t ch = (uint32_t)vm->console.read_char(vm->console.context);
             return ch;
             break;
         // 0x0816 - Console Read Signed Integer
         case VR_READ_SINT:
             int32_t sint;
-            int scan_ret = scanf("%d", &sint);
-            if (scan_ret != 1) {
-                perror("Error scanf");
-                exit(1);
+            if (!vm->console.read_int(vm->console.context, &sint)) {
+                vm_stop(vm, VM_INPUT_ERROR);
             }
             return (uint32_t)sint;
             break;
@@ -675,10 +947,10 @@ uint32_t console_read_routine(uint32_t address, struct blob* vm_memory) {
         default:
             // Just read data from the address
             // Get the four bytes
-            uint32_t first_byte = (uint32_t)virtual_routines[address - VR_START];
-            uint32_t second_byte = (uint32_t)virtual_routines[address - VR_START + 1];
-            uint32_t third_byte = (uint32_t)virtual_routines[address - VR_START + 2];
-            uint32_t fourth_byte = (uint32_t)virtual_routines[address - VR_START + 3];
+            uint32_t first_byte = (uint32_t)vm->virtual_routines[address - VR_START];
+            uint32_t second_byte = (uint32_t)vm->virtual_routines[address - VR_START + 1];
+            uint32_t third_byte = (uint32_t)vm->virtual_routines[address - VR_START + 2];
+            uint32_t fourth_byte = (uint32_t)vm->virtual_routines[address - VR_START + 3];
             // Concatenating four bytes together
             uint32_t data = first_byte | (second_byte << 8) | (third_byte << 16) | (fourth_byte << 24);
             return data;
@@ -686,48 +958,81 @@ uint32_t console_read_routine(uint32_t address, struct blob* vm_memory) {
     }
 }
 
-int console_write_routine(uint32_t address, uint32_t value, struct blob* vm_memory, union instruction instruct) {
+int console_write_routine(struct vm* vm, uint32_t address, uint32_t value, union instruction instruct) {
     switch (address) {
         // 0x0800 - Console Write Character
         case VR_WRITE_CHAR:
-            putchar((uint8_t)value);
+            char ch = (char)value;
+            vm->console.write(vm->console.context, &ch, 1);
             break;
         // 0x0804 - Console Write Signed Integer
         case VR_WRITE_SINT:
-            printf("%d", (int32_t)value);
+            vm_printf(vm, "%d", (int32_t)value);
             break;
         // 0x0808 - Console Write Unsigned Integer
         case VR_WRITE_UINT:
-            printf("%x", (uint32_t)value);
+            vm_printf(vm, "%x", (uint32_t)value);
             break;
         // 0x080C - Halt
         case VR_HALT:
-            printf("CPU Halt Requested\n");
-            exit(0);
+            // Other harts halting only end themselves, the machine goes on
+            if (vm->hart_id == 0) {
+                vm_printf(vm, "CPU Halt Requested\n");
+            }
+            vm_stop(vm, VM_HALTED);
             break;
         // 0x0820 - Dump PC
         case VR_DUMP_PC:
-            printf("%x", pc);
+            vm_printf(vm, "%x", vm->pc);
             break;
         // 0x0824 - Dump Register Banks
         case VR_DUMP_REG:
-            register_dump();
+            register_dump(vm);
             break;
         // 0x0828 - Dump Memory Word
         case VR_DUMP_WORD:
-            uint32_t word = load_word((uint32_t)value, vm_memory, instruct);
-            printf("%x", word);
+            uint32_t word = load_word(vm, (uint32_t)value, instruct);
+            vm_printf(vm, "%x", word);
             break;
         // 0x0830 - Malloc
         case VR_MALLOC:
             // Set R[28]
-            reg_bank[28] = vm_malloc(value);
+            hart_lock_heap(vm, 1);
+            vm->reg_bank[28] = vm_malloc(MACHINE(vm), value);
+            hart_unlock_heap(vm);
+            break;
+        // 0x0838 - Realloc the chunk at R[28]
+        case VR_REALLOC:
+            hart_lock_heap(vm, 1);
+            int is_resized = vm_realloc(MACHINE(vm), vm->reg_bank[28], value, &vm->reg_bank[28]);
+            hart_unlock_heap(vm);
+            if (!is_resized) {
+                illegal_operation(vm, instruct);
+            }
+            break;
+        // 0x083C - Calloc
+        case VR_CALLOC:
+            hart_lock_heap(vm, 1);
+            vm->reg_bank[28] = vm_calloc(MACHINE(vm), value);
+            hart_unlock_heap(vm);
+            break;
+        // 0x0858 - Heap statistics
+        case VR_HEAP_STATS:
+            hart_lock_heap(vm, 0);
+            heap_stats_dump(MACHINE(vm), NULL);
+            hart_unlock_heap(vm);
+            break;
+        // 0x0864 - Move the input cursor
+        case VR_INPUT_CURSOR:
+            input_seek(vm, value);
             break;
         // 0x0834 - Free
         case VR_FREE:
-            int is_free = vm_free(value);
+            hart_lock_heap(vm, 1);
+            int is_free = vm_free(MACHINE(vm), value);
+            hart_unlock_heap(vm);
             if (!is_free) {
-                illegal_operation(instruct);
+                illegal_operation(vm, instruct);
             }
             break;
         default:
@@ -738,25 +1043,119 @@ int console_write_routine(uint32_t address, uint32_t value, struct blob* vm_memo
     return 1;
 }
 
-void init_heap() {
-    for(int i = 0; i < HEAP_BANK_NUM; i++) {
-        heap_banks[i] = 0;
+void init_heap(struct vm* vm) {
+    // Banks start zeroed or with the image's heap section, and vm_reset restores them page by page
+    vm->head.address = HEAP_START;
+    vm->head.bank_blocks = HEAP_BANK_NUM;
+    vm->head.allocated_size = 0;
+    vm->head.next = NULL;
+}
+
+void free_heap(struct vm* vm) {
+    struct heap_node* cursor = vm->head.next;
+    while (cursor) {
+        struct heap_node* next = cursor->next;
+        free(cursor);
+        cursor = next;
+    }
+    vm->head.next = NULL;
+}
+
+void heap_stats_dump(struct vm* vm, FILE* out) {
+    // Walk the free runs to see how scattered the free banks are
+    uint32_t free_banks = 0;
+    uint32_t free_runs = 0;
+    uint32_t largest_run = 0;
+    for (struct heap_node* cursor = &vm->head; cursor; cursor = cursor->next) {
+        if (cursor->allocated_size == 0) {
+            free_banks += cursor->bank_blocks;
+            free_runs++;
+            if (cursor->bank_blocks > largest_run) {
+                largest_run = cursor->bank_blocks;
+            }
+        }
     }
-    head.address = HEAP_START;
-    head.bank_blocks = HEAP_BANK_NUM;
-    head.allocated_size = 0;
-    head.next = NULL;
+    // 0% when all free banks are consecutive, approaching 100% as they split into single banks
+    double fragmentation = free_banks ? 100.0 * (free_banks - largest_run) / free_banks : 0.0;
+
+    struct heap_stats* stats = &vm->heap_stats;
+    report_printf(vm, out, "Heap: %llu malloc, %llu free, %llu invalid free\n",
+                  (unsigned long long)stats->malloc_calls, (unsigned long long)stats->free_calls,
+                  (unsigned long long)stats->invalid_frees);
+    report_printf(vm, out, "Live: %u bytes in %u banks, peak %u bytes in %u banks\n", stats->live_bytes,
+                  stats->live_banks, stats->peak_bytes, stats->peak_banks);
+    report_printf(vm, out, "Free: %u banks in %u runs, largest run %u banks, fragmentation %.2f%%\n",
+                  free_banks, free_runs, largest_run, fragmentation);
+    report_printf(vm, out, "Walked: %llu nodes in malloc (max %u), %llu nodes in free (max %u)\n",
+                  (unsigned long long)stats->malloc_walked, stats->malloc_max_walk,
+                  (unsigned long long)stats->free_walked, stats->free_max_walk);
+    report_printf(vm, out, "Failures: %llu zero size, %llu larger than heap, %llu heap full, %llu fragmented\n",
+                  (unsigned long long)stats->failures[HEAP_FAIL_ZERO_SIZE],
+                  (unsigned long long)stats->failures[HEAP_FAIL_TOO_LARGE],
+                  (unsigned long long)stats->failures[HEAP_FAIL_FULL],
+                  (unsigned long long)stats->failures[HEAP_FAIL_FRAGMENTED]);
+    report_printf(vm, out, "Request sizes:");
+    for (int i = 0; i < HEAP_SIZE_BUCKETS; i++) {
+        if (stats->sizes[i] == 0) {
+            continue;
+        }
+        // Bucket i holds requests of 2^(i-1) + 1 to 2^i banks
+        uint32_t low = (i == 0) ? 1 : (uint32_t)(1 << (i - 1)) * BANK_BLOCK_SIZE + 1;
+        if (i == HEAP_SIZE_BUCKETS - 1) {
+            report_printf(vm, out, " %u+: %llu", low, (unsigned long long)stats->sizes[i]);
+        } else {
+            report_printf(vm, out, " %u-%u: %llu", low, (uint32_t)(1 << i) * BANK_BLOCK_SIZE,
+                          (unsigned long long)stats->sizes[i]);
+        }
+    }
+    report_printf(vm, out, "\n");
 }
 
-uint32_t vm_malloc(uint32_t size) {
+void heap_stats_start(struct vm* vm, const char* report) {
+    vm->heap_stats_output = report;
+}
+
+void heap_stats_report(struct vm* vm) {
+    if (vm->heap_stats_output == NULL) {
+        return;
+    }
+    FILE* out = (strcmp(vm->heap_stats_output, "-") == 0) ? stdout : fopen(vm->heap_stats_output, "w");
+    if (out == NULL) {
+        perror("Error opening heap report");
+        return;
+    }
+    heap_stats_dump(vm, out);
+    if (out == stdout) {
+        fflush(out);
+    } else {
+        fclose(out);
+    }
+}
+
+uint32_t vm_malloc(struct vm* vm, uint32_t size) {
+    vm->heap_stats.malloc_calls++;
     // Calculate the required consecutive blocks to meet the size
     uint32_t required_blocks = (size + BANK_BLOCK_SIZE - 1) / BANK_BLOCK_SIZE;
     if (required_blocks == 0) {
+        vm->heap_stats.failures[HEAP_FAIL_ZERO_SIZE]++;
         return 0;  // 0 blocks to allocate, edge case for malloc 0
     }
-    struct heap_node* cursor = &head;  // Record the current node
+    // Count the request in its power of two bucket
+    int bucket = 0;
+    while (bucket < HEAP_SIZE_BUCKETS - 1 && (1u << bucket) < required_blocks) {
+        bucket++;
+    }
+    vm->heap_stats.sizes[bucket]++;
+
+    struct heap_node* cursor = &vm->head;  // Record the current node
+    uint32_t walked = 0;               // Nodes visited for this request
+    uint32_t free_banks = 0;           // Free banks passed over, to tell a full heap from a fragmented one
 
     while (cursor) {
+        walked++;
+        if (cursor->allocated_size == 0) {
+            free_banks += cursor->bank_blocks;
+        }
         // Check whether the avilable blocks of current node are sufficient
         if (cursor->allocated_size==0 && cursor->bank_blocks>=required_blocks) {
             // Starting allocation
@@ -776,6 +1175,19 @@ uint32_t vm_malloc(uint32_t size) {
             cursor->bank_blocks = required_blocks;
             cursor->allocated_size = size;
 
+            vm->heap_stats.live_bytes += size;
+            vm->heap_stats.live_banks += required_blocks;
+            if (vm->heap_stats.live_bytes > vm->heap_stats.peak_bytes) {
+                vm->heap_stats.peak_bytes = vm->heap_stats.live_bytes;
+            }
+            if (vm->heap_stats.live_banks > vm->heap_stats.peak_banks) {
+                vm->heap_stats.peak_banks = vm->heap_stats.live_banks;
+            }
+            vm->heap_stats.malloc_walked += walked;
+            if (walked > vm->heap_stats.malloc_max_walk) {
+                vm->heap_stats.malloc_max_walk = walked;
+            }
+            guard_map_heap(vm);
             return allocated_address;
         } else {
             // Keep iterating
@@ -784,16 +1196,36 @@ uint32_t vm_malloc(uint32_t size) {
     }
 
     // No blocks to allocate
+    vm->heap_stats.malloc_walked += walked;
+    if (walked > vm->heap_stats.malloc_max_walk) {
+        vm->heap_stats.malloc_max_walk = walked;
+    }
+    if (required_blocks > HEAP_BANK_NUM) {
+        vm->heap_stats.failures[HEAP_FAIL_TOO_LARGE]++;
+    } else if (free_banks < required_blocks) {
+        vm->heap_stats.failures[HEAP_FAIL_FULL]++;
+    } else {
+        vm->heap_stats.failures[HEAP_FAIL_FRAGMENTED]++;
+    }
     return 0;
 }
 
-int vm_free(uint32_t address) {
-    struct heap_node* cursor = &head;    // The current node
+int vm_free(struct vm* vm, uint32_t address) {
+    struct heap_node* cursor = &vm->head;    // The current node
     struct heap_node* prev_node = NULL;  // The node before current node
+    uint32_t walked = 0;                 // Nodes visited for this request
+    vm->heap_stats.free_calls++;
 
     while (cursor) {
+        walked++;
         // Check whether the address input is exactly an allocated address
         if (cursor->allocated_size > 0 && address == cursor->address) {
+            vm->heap_stats.live_bytes -= cursor->allocated_size;
+            vm->heap_stats.live_banks -= cursor->bank_blocks;
+            vm->heap_stats.free_walked += walked;
+            if (walked > vm->heap_stats.free_max_walk) {
+                vm->heap_stats.free_max_walk = walked;
+            }
             cursor->allocated_size = 0;  // Starting free
 
             // Concatenate the later consecutive redundant blocks
@@ -810,6 +1242,7 @@ int vm_free(uint32_t address) {
                 prev_node->next = cursor->next;
                 free(cursor);
             }
+            guard_map_heap(vm);
             return 1;  // Successfully freed
         } else {
             // Keep iterating
@@ -818,5 +1251,273 @@ int vm_free(uint32_t address) {
         }
     }
 
+    vm->heap_stats.free_walked += walked;
+    if (walked > vm->heap_stats.free_max_walk) {
+        vm->heap_stats.free_max_walk = walked;
+    }
+    vm->heap_stats.invalid_frees++;
     return 0; // Invalid free
+}
+
+void heap_move(struct vm* vm, uint32_t destination, uint32_t source, uint32_t len) {
+    mark_dirty_range(vm, destination, len);
+    memmove(&vm->heap_banks[destination - HEAP_START], &vm->heap_banks[source - HEAP_START], len);
+}
+
+int vm_realloc(struct vm* vm, uint32_t address, uint32_t size, uint32_t* result) {
+    if (address == 0) {
+        *result = vm_malloc(vm, size);
+        return 1;
+    }
+    struct heap_node* cursor = &vm->head;  // The chunk being resized
+    struct heap_node* prev_node = NULL;    // The node before the chunk
+    while (cursor && !(cursor->allocated_size > 0 && cursor->address == address)) {
+        prev_node = cursor;
+        cursor = cursor->next;
+    }
+    if (cursor == NULL) {
+        return 0;  // Not an allocated address
+    }
+    if (size == 0) {
+        *result = 0;
+        return vm_free(vm, address);
+    }
+
+    uint32_t required_blocks = (size + BANK_BLOCK_SIZE - 1) / BANK_BLOCK_SIZE;
+    uint32_t old_size = cursor->allocated_size;
+    uint32_t old_blocks = cursor->bank_blocks;
+    struct heap_node* next_node = cursor->next;
+    uint32_t next_free = next_node && next_node->allocated_size == 0 ? next_node->bank_blocks : 0;
+    uint32_t prev_free = prev_node && prev_node->allocated_size == 0 ? prev_node->bank_blocks : 0;
+    uint32_t new_address;
+
+    if (required_blocks <= old_blocks + next_free) {
+        // Resize in place, the banks past the new end go to or come from the free node after the chunk
+        uint32_t remaining = old_blocks + next_free - required_blocks;
+        if (next_free > 0 && remaining == 0) {
+            cursor->next = next_node->next;
+            free(next_node);
+        } else if (next_free > 0) {
+            next_node->address = address + required_blocks * BANK_BLOCK_SIZE;
+            next_node->bank_blocks = remaining;
+        } else if (remaining > 0) {
+            struct heap_node* new_node = (struct heap_node*)malloc(sizeof(struct heap_node));
+            new_node->address = address + required_blocks * BANK_BLOCK_SIZE;
+            new_node->bank_blocks = remaining;
+            new_node->allocated_size = 0;
+            new_node->next = next_node;
+            cursor->next = new_node;
+        }
+        cursor->bank_blocks = required_blocks;
+        cursor->allocated_size = size;
+        new_address = address;
+    } else if (required_blocks <= prev_free + old_blocks + next_free) {
+        // Slide the chunk down into the free node before it, which takes over the chunk's banks
+        uint32_t remaining = prev_free + old_blocks + next_free - required_blocks;
+        new_address = prev_node->address;
+        heap_move(vm, new_address, address, old_size);
+        prev_node->bank_blocks = required_blocks;
+        prev_node->allocated_size = size;
+        if (next_free > 0) {
+            cursor->next = next_node->next;
+            free(next_node);
+        }
+        if (remaining > 0) {
+            // The chunk's node holds the banks left over
+            cursor->address = new_address + required_blocks * BANK_BLOCK_SIZE;
+            cursor->bank_blocks = remaining;
+            cursor->allocated_size = 0;
+        } else {
+            prev_node->next = cursor->next;
+            free(cursor);
+        }
+    } else {
+        // No free banks next to the chunk are enough, move it to a new chunk
+        new_address = vm_malloc(vm, size);
+        if (new_address != 0) {
+            heap_move(vm, new_address, address, old_size);
+            vm_free(vm, address);
+        }
+        *result = new_address;
+        return 1;
+    }
+
+    vm->heap_stats.live_bytes = vm->heap_stats.live_bytes - old_size + size;
+    vm->heap_stats.live_banks = vm->heap_stats.live_banks - old_blocks + required_blocks;
+    if (vm->heap_stats.live_bytes > vm->heap_stats.peak_bytes) {
+        vm->heap_stats.peak_bytes = vm->heap_stats.live_bytes;
+    }
+    if (vm->heap_stats.live_banks > vm->heap_stats.peak_banks) {
+        vm->heap_stats.peak_banks = vm->heap_stats.live_banks;
+    }
+    guard_map_heap(vm);
+    *result = new_address;
+    return 1;
+}
+
+uint32_t vm_calloc(struct vm* vm, uint32_t size) {
+    uint32_t address = vm_malloc(vm, size);
+    if (address != 0) {
+        mark_dirty_range(vm, address, size);
+        memset(&vm->heap_banks[address - HEAP_START], 0, size);
+    }
+    return address;
+}
+
+_Atomic uint32_t* atomic_word(struct vm* vm, uint32_t address, union instruction instruct) {
+    // Host words are little endian like the guest's, and the memory arrays start on word boundaries
+    _Static_assert(offsetof(struct vm, memory.data_mem) % sizeof(uint32_t) == 0, "data memory is not aligned");
+    _Static_assert(offsetof(struct vm, heap_banks) % sizeof(uint32_t) == 0, "heap banks are not aligned");
+    if (address % sizeof(uint32_t) != 0) {
+        illegal_operation(vm, instruct);
+    }
+    struct vm* machine = MACHINE(vm);
+    unsigned char* word = NULL;
+    if (address >= DATA_MEM_START && address <= DATA_MEM_END) {
+        word = &machine->memory.data_mem[address - DATA_MEM_START];
+    } else if (address >= HEAP_START && address < HEAP_END && is_valid_address(vm, address + 3)) {
+        // Chunks start on bank boundaries, so the whole word is in the chunk its last byte is in
+        word = &machine->heap_banks[address - HEAP_START];
+    } else {
+        // Instruction memory is read only and virtual routines are not memory
+        illegal_operation(vm, instruct);
+    }
+    if (vm->cache_sim) {
+        cache_data_access(vm->cache_sim, address, sizeof(uint32_t), vm->pc);
+    }
+    return (_Atomic uint32_t*)word;
+}
+
+uint32_t load_reserved(struct vm* vm, uint32_t address, union instruction instruct) {
+    _Atomic uint32_t* word = atomic_word(vm, address, instruct);
+    vm->reserved = 1;
+    vm->reserved_address = address;
+    vm->reserved_value = atomic_load(word);
+    return vm->reserved_value;
+}
+
+uint32_t store_conditional(struct vm* vm, uint32_t address, uint32_t value, union instruction instruct) {
+    _Atomic uint32_t* word = atomic_word(vm, address, instruct);
+    int was_reserved = vm->reserved && vm->reserved_address == address;
+    vm->reserved = 0;
+    if (!was_reserved) {
+        return 1;
+    }
+    // The reservation holds while the word keeps the value lr.w read, a write of the same value goes unnoticed
+    mark_dirty(vm, address);
+    uint32_t expected = vm->reserved_value;
+    return atomic_compare_exchange_strong(word, &expected, value) ? 0 : 1;
+}
+
+uint32_t atomic_memory_operation(struct vm* vm, uint32_t address, uint32_t value, enum AtomicOperation operation,
+                                 union instruction instruct) {
+    _Atomic uint32_t* word = atomic_word(vm, address, instruct);
+    mark_dirty(vm, address);
+    switch (operation) {
+        case ATOMIC_SWAP:
+            return atomic_exchange(word, value);
+        case ATOMIC_ADD:
+            return atomic_fetch_add(word, value);
+        case ATOMIC_XOR:
+            return atomic_fetch_xor(word, value);
+        case ATOMIC_AND:
+            return atomic_fetch_and(word, value);
+        case ATOMIC_OR:
+            return atomic_fetch_or(word, value);
+        default:
+            break;
+    }
+    // The host has no fetch and min or max, retry until no other hart wrote the word in between
+    uint32_t old = atomic_load(word);
+    for (;;) {
+        uint32_t result;
+        switch (operation) {
+            case ATOMIC_MIN:
+                result = (int32_t)old < (int32_t)value ? old : value;
+                break;
+            case ATOMIC_MAX:
+                result = (int32_t)old > (int32_t)value ? old : value;
+                break;
+            case ATOMIC_MINU:
+                result = old < value ? old : value;
+                break;
+            default:
+                result = old > value ? old : value;
+                break;
+        }
+        if (atomic_compare_exchange_weak(word, &old, result)) {
+            return old;
+        }
+    }
+}
+
+int heap_range_valid(struct vm* vm, uint32_t address, uint32_t last) {
+    hart_lock_heap(vm, 0);
+    int valid = 1;
+    while (valid && address <= last) {
+        valid = 0;
+        for (struct heap_node* cursor = &MACHINE(vm)->head; cursor; cursor = cursor->next) {
+            if ((cursor->allocated_size > 0) && (address >= cursor->address) &&
+                (address < (cursor->address + cursor->allocated_size))) {
+                address = cursor->address + cursor->allocated_size;
+                valid = 1;
+                break;
+            }
+        }
+    }
+    hart_unlock_heap(vm);
+    return valid;
+}
+
+unsigned char* vector_memory(struct vm* vm, uint32_t address, uint32_t n, int store, union instruction instruct) {
+    if (!store && address >= INPUT_WINDOW_START) {
+        // Read in place like any other load of the input file, which is not cached memory
+        const unsigned char* input = input_range(vm, address, (uint64_t)n * 4);
+        if (input == NULL) {
+            illegal_operation(vm, instruct);
+        }
+        return (unsigned char*)input;
+    }
+    struct vm* machine = MACHINE(vm);
+    uint64_t last = (uint64_t)address + (uint64_t)n * 4 - 1;
+    unsigned char* memory = NULL;
+    if (address >= DATA_MEM_START && last <= DATA_MEM_END) {
+        memory = &machine->memory.data_mem[address - DATA_MEM_START];
+    } else if (!store && last <= INST_MEM_END) {
+        memory = &vm->program->inst_mem[address];
+    } else if (address >= HEAP_START && last < HEAP_END && heap_range_valid(vm, address, (uint32_t)last)) {
+        memory = &machine->heap_banks[address - HEAP_START];
+    } else {
+        // Instruction memory is read only, virtual routines are not memory, and ranges do not cross regions
+        illegal_operation(vm, instruct);
+    }
+    if (store) {
+        mark_dirty_range(vm, address, n * 4);
+    }
+    // Like scalar loads, only data and heap vectors go through the D-cache
+    if (vm->cache_sim && address >= DATA_MEM_START) {
+        for (uint32_t i = 0; i < n; i++) {
+            cache_data_access(vm->cache_sim, address + i * 4, 4, vm->pc);
+        }
+    }
+    return memory;
+}
+
+void vector_memory_operation(struct vm* vm, enum VectorOperation operation, uint32_t destination, uint32_t a,
+                             uint32_t b, uint32_t n, union instruction instruct) {
+    if (n == 0) {
+        return;
+    }
+    // Both sources are checked before anything is written
+    const unsigned char* x = vector_memory(vm, a, n, 0, instruct);
+    const unsigned char* y = vector_memory(vm, b, n, 0, instruct);
+    vector_words(operation, vector_memory(vm, destination, n, 1, instruct), x, y, n);
+}
+
+uint32_t vector_dot_product(struct vm* vm, uint32_t a, uint32_t b, uint32_t n, union instruction instruct) {
+    if (n == 0) {
+        return 0;
+    }
+    const unsigned char* x = vector_memory(vm, a, n, 0, instruct);
+    return vector_dot(x, vector_memory(vm, b, n, 0, instruct), n);
 }
\ No newline at end of file
@@ -1,12 +1,19 @@
 #ifndef VM_RISKXVII_H
 #define VM_RISKXVII_H
 
+#include <setjmp.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "libriskxvii.h"
+#include "vm_symbols.h"
+#include "vm_simd.h"
 
 #define INSTRUCT_BYTES 4
+#define COMPRESSED_BYTES 2
 #define INST_MEM_SIZE 1024
 #define DATA_MEM_SIZE 1024
 #define INST_MEM_END 0x3ff
@@ -16,6 +23,8 @@
 #define VR_END 0x8ff
 #define HEAP_START 0xb700
 #define HEAP_END 0xd700
+#define INPUT_WINDOW_START 0x10000000  // Where the input file is mapped, read only
+#define INPUT_WINDOW_SIZE (0xFFFFFFFFu - INPUT_WINDOW_START + 1)
 #define REG_NUM 32
 #define WORD_BITS 32
 #define VR_WRITE_CHAR 0x0800
@@ -29,9 +38,34 @@
 #define VR_DUMP_WORD 0x0828
 #define VR_MALLOC 0x0830
 #define VR_FREE 0x0834
+#define VR_REALLOC 0x0838            // Resize the block at R[28], the new address is returned in R[28]
+#define VR_CALLOC 0x083C             // Malloc zeroed memory
+#define VR_READ_INSTRET 0x0840       // Retired instructions, low word
+#define VR_READ_INSTRET_HIGH 0x0844  // Retired instructions, high word
+#define VR_READ_TIME 0x0848          // Microseconds since the vm started, low word
+#define VR_READ_TIME_HIGH 0x084C     // Microseconds since the vm started, high word
+#define VR_READ_CYCLE 0x0850         // Cycles, one per instruction, low word
+#define VR_READ_CYCLE_HIGH 0x0854    // Cycles, one per instruction, high word
+#define VR_HEAP_STATS 0x0858         // Print the heap allocator statistics
+#define VR_READ_HART_ID 0x085C       // The id of the reading hart, 0 unless the vm runs several
+#define VR_INPUT_LENGTH 0x0860       // Bytes in the input file
+#define VR_INPUT_CURSOR 0x0864       // Read or move the input cursor
+#define VR_INPUT_READ_CHAR 0x0868    // The input byte at the cursor, which moves on, 0xFFFFFFFF past the end
 #define VIRTUAL_ROUTINE_END 0x8ff
 #define HEAP_BANK_NUM 128
 #define BANK_BLOCK_SIZE 64
+#define DIRTY_PAGE_SIZE 64  // Granularity of write tracking, one heap bank
+#define DATA_PAGE_FIRST 0
+#define HEAP_PAGE_FIRST (DATA_MEM_SIZE / DIRTY_PAGE_SIZE)
+#define INST_PAGE_FIRST (HEAP_PAGE_FIRST + HEAP_BANK_NUM * BANK_BLOCK_SIZE / DIRTY_PAGE_SIZE)
+#define DIRTY_PAGE_NUM (INST_PAGE_FIRST + INST_MEM_SIZE / DIRTY_PAGE_SIZE)
+#define HEAP_SIZE_BUCKETS 9  // Request size histogram buckets, 1, 2, 3-4, ... 65-128 and more than 128 banks
+#define EXT_M 0x1  // RV32M multiply/divide extension
+#define EXT_C 0x2  // RV32C compressed instruction extension
+#define EXT_A 0x4  // RV32A atomic instruction extension
+#define EXT_XSIMD 0x8  // Custom packed and vector instructions, named _xsimd after the standard extensions
+#define HART_MAX 64  // Most harts a vm runs
+#define VM_PRINT_BUFFER 256  // Longest single piece of console output
 
 
 enum Opcode {
@@ -43,13 +77,16 @@ enum Opcode {
     S_TYPE = 0b0100011,
     SB_TYPE = 0b1100011,
     U_TYPE = 0b0110111,
-    UJ_TYPE = 0b1101111
+    UJ_TYPE = 0b1101111,
+    AMO_TYPE = 0b0101111,
+    // Left to custom extensions by the RISC-V spec
+    CUSTOM_0 = 0b0001011,
+    CUSTOM_1 = 0b0101011
 };  // The opcode for different instructions
 
 struct blob {
-    unsigned char inst_mem[INST_MEM_SIZE];
     unsigned char data_mem[DATA_MEM_SIZE];
-};  // The vm instruction memory and data memory
+};  // The vm data memory, instruction memory is part of the program
 
 union instruction {
     uint32_t raw_instruct;
@@ -63,6 +100,16 @@ union instruction {
         unsigned func7 : 7;
     } R_type;
 
+    struct {
+        unsigned opcode : 7;
+        unsigned rd : 5;
+        unsigned func3 : 3;
+        unsigned rs1 : 5;
+        unsigned rs2 : 5;
+        unsigned func2 : 2;
+        unsigned rs3 : 5;
+    } R4_type;
+
     struct {
         unsigned opcode : 7;
         unsigned rd : 5;
@@ -107,6 +154,11 @@ union instruction {
     } UJ_type;
 };  // Instructions have fixed size 32 bits
 
+struct decoded_instruct {
+    union instruction instruct;  // The instruction, expanded to 32 bits if it was compressed
+    uint32_t length;             // The instruction length in bytes, 0 if not decoded yet
+};  // The cached decoding of an instruction memory slot
+
 struct heap_node {
     uint32_t address;
     uint32_t bank_blocks;
@@ -114,199 +166,544 @@ struct heap_node {
     struct heap_node *next;
 }; // The liked list node to record the allocated information about specific heap address
 
+enum HeapFailure {
+    HEAP_FAIL_ZERO_SIZE,   // malloc(0)
+    HEAP_FAIL_TOO_LARGE,   // More banks than the whole heap
+    HEAP_FAIL_FULL,        // Fewer free banks than requested
+    HEAP_FAIL_FRAGMENTED,  // Enough free banks, but no run of consecutive ones is long enough
+    HEAP_FAIL_NUM
+};  // Why a malloc returned 0
+
+struct heap_stats {
+    uint64_t malloc_calls;
+    uint64_t free_calls;
+    uint64_t invalid_frees;
+    uint64_t failures[HEAP_FAIL_NUM];
+    uint32_t live_bytes;   // Requested bytes currently allocated
+    uint32_t live_banks;   // Banks currently allocated
+    uint32_t peak_bytes;
+    uint32_t peak_banks;
+    uint64_t malloc_walked;      // List nodes visited by all malloc calls
+    uint64_t free_walked;        // List nodes visited by all free calls
+    uint32_t malloc_max_walk;    // Most list nodes visited by a single malloc
+    uint32_t free_max_walk;      // Most list nodes visited by a single free
+    uint64_t sizes[HEAP_SIZE_BUCKETS];  // Request sizes by power of two bank counts
+};  // Heap allocator telemetry
+
+struct page_tracker {
+    unsigned char is_dirty[DIRTY_PAGE_NUM];               // Pages written since the vm was created or reset
+    uint16_t dirty_list[DIRTY_PAGE_NUM];                  // The dirty pages in the order they were first written
+    int dirty_num;
+};  // Data, heap and instruction memory pages written since the image was loaded, so a reset copies back only those
+
+struct profile;    // Call graph profiler state, see vm_profile.h
+struct cache_sim;  // Cache simulator state, see vm_cache.h
+struct pipeline;   // Pipeline timing model state, see vm_pipeline.h
+struct guard;      // Host MMU protection state, see vm_guard.h
+struct hart_group; // Harts sharing one vm's memory, see vm_harts.h
+struct input_device;  // Host file mapped into the guest, see vm_input.h
+struct shadow;     // Reference run the vm is checked against, see vm_shadow.h
+struct program;    // Instruction memory and initial state shared by the vms of one image, see vm_program.h
+
+// The vm whose data memory, heap and console a hart shares, the vm itself unless it is a copy made for a hart
+#define MACHINE(vm) ((vm)->machine ? (vm)->machine : (vm))
+
+enum AtomicOperation {
+    ATOMIC_SWAP,
+    ATOMIC_ADD,
+    ATOMIC_XOR,
+    ATOMIC_AND,
+    ATOMIC_OR,
+    ATOMIC_MIN,
+    ATOMIC_MAX,
+    ATOMIC_MINU,
+    ATOMIC_MAXU
+};  // The read-modify-write of an RV32A AMO instruction
+
+struct vm {
+    uint32_t pc;                 // Program counter
+    uint32_t reg_bank[REG_NUM];  // Register array
+    uint32_t isa_extensions;     // Enabled ISA extensions, plain rv32i by default
+    uint32_t inst_len;           // Length of the instruction being executed
+    uint64_t instret;            // Number of retired instructions
+    struct timespec start_time;  // Host monotonic time when the vm started
+    struct program* program;     // Instruction memory, its decoding and the initial memory, shared read only
+    struct blob memory;          // Data memory
+    unsigned char virtual_routines[VR_END - VR_START + 1];      // Virtual routines space
+    unsigned char heap_banks[HEAP_BANK_NUM * BANK_BLOCK_SIZE];  // Heap banks space
+    struct page_tracker pages;      // Memory written since the image was loaded
+    uint32_t entry_pc;              // The pc once the image was loaded, restored by vm_reset
+    uint32_t entry_regs[REG_NUM];   // The registers once the image was loaded, restored by vm_reset
+    struct heap_node head;          // The head node of the linked list for heap management
+    struct heap_stats heap_stats;   // Heap allocator telemetry
+    const char* heap_stats_output;  // Where the heap report is written, NULL when not reported
+    struct symbol_table symbols;    // Guest symbols for the profiler
+    struct profile* profile;        // The call graph profiler, NULL when off
+    struct cache_sim* cache_sim;    // The cache simulator, NULL when off
+    struct pipeline* pipeline;      // The pipeline timing model, NULL when off
+    struct guard* guard;            // Guard page protection of loads and stores, NULL for software checks
+    struct input_device* input;     // The input file window, NULL if no file is mapped
+    struct shadow* shadow;          // The reference copy checking this vm, NULL when not shadowed
+    uint32_t hart_id;               // Read by the guest through VR_READ_HART_ID
+    struct vm* machine;             // The vm this hart was copied from, NULL unless it is a copy
+    struct hart_group* harts;       // The harts running together, NULL with a single hart
+    int console_depth;              // Times this hart holds the console lock of its hart group
+    int reserved;                   // Set by lr.w until the next sc.w
+    uint32_t reserved_address;      // The word lr.w reserved
+    uint32_t reserved_value;        // The word's value when lr.w read it, sc.w fails if it changed
+    struct vm_console console;      // Guest console callbacks
+    enum vm_status status;          // Why the vm last stopped
+    int read_host_clock;            // Set once the guest reads the time, its results may differ between runs
+    jmp_buf stop;                   // Where vm_stop returns to, set by vm_run and vm_step
+};  // The complete state of one virtual machine
+
 /**
- * Load instruction and data memory to vm by reading the memory image file
+ * Parse an ISA string such as rv32i or rv32im into the enabled extension flags
+ * @param isa The ISA string given on the command line
+ * @return int The extension flags, or -1 if the string is not supported
+*/
+int parse_isa(const char* isa);
+
+/**
+ * Read a memory image file into a newly allocated buffer, legacy, sectioned or ELF
  * @param filename The image file to read
- * @param vm_memory The vm blob including instruction and data memory
+ * @param size Set to the number of bytes read, at most VM_IMAGE_SIZE for a legacy image
+ * @return unsigned char* The image bytes, or NULL with errno set if the file could not be read
+*/
+unsigned char* read_memory_image(const char* filename, size_t* size);
+
+/**
+ * Find the byte backing a guest address in instruction, data or heap memory
+ * @param vm The vm
+ * @param address The guest address
+ * @return unsigned char* The byte, or NULL for virtual routines and unmapped addresses
+*/
+unsigned char* guest_byte(struct vm* vm, uint32_t address);
+
+/**
+ * Get the write tracking page holding a guest address
+ * @param address The guest address
+ * @return int The page index, or -1 outside instruction, data and heap memory
+*/
+int dirty_page_index(uint32_t address);
+
+/**
+ * Get the first guest address of a write tracking page
+ * @param page The page index
+ * @return uint32_t The guest address
+*/
+uint32_t dirty_page_address(int page);
+
+/**
+ * Record a write to the page holding an address, so vm_reset copies it back from the program
+ * @param vm The vm
+ * @param address The guest address about to be written
+*/
+void mark_dirty(struct vm* vm, uint32_t address);
+
+/**
+ * Record a write to every page a range of addresses touches, for copies that bypass the store path
+ * @param vm The vm
+ * @param address The first guest address about to be written
+ * @param len The number of bytes about to be written
 */
-void read_memory_image(const char* filename, struct blob* vm_memory);
+void mark_dirty_range(struct vm* vm, uint32_t address, uint32_t len);
+
+/**
+ * Copy the initial contents of the program back into every dirty page and mark them clean
+ * @param vm The vm
+*/
+void restore_dirty_pages(struct vm* vm);
 
 /**
  * Fetch the next instruction from the vm memory
- * @parm vm_memory The vm memory blob
+ * @param vm The vm
  * @return union instruct The next instruction
  */
-union instruction fetch_instruct(struct blob* vm_memory);
+union instruction fetch_instruct(struct vm* vm);
+
+/**
+ * Fill the decode cache for every instruction slot, so vms sharing the program never write to it
+ * @param vm The vm
+*/
+void predecode_instructs(struct vm* vm);
+
+/**
+ * Expand a 16-bit compressed instruction into the equivalent 32-bit instruction
+ * @param half The compressed instruction
+ * @return uint32_t The expanded instruction, or the compressed bits unchanged if it is illegal
+*/
+uint32_t expand_compressed(uint16_t half);
+
+/**
+ * Build a 32-bit SB type instruction from its fields
+ * @param func3 The branch condition
+ * @param rs1 The first source register
+ * @param rs2 The second source register
+ * @param offset The signed byte offset of the branch target
+ * @return uint32_t The encoded instruction
+*/
+uint32_t encode_SB_instruct(uint32_t func3, uint32_t rs1, uint32_t rs2, int32_t offset);
+
+/**
+ * Build a 32-bit UJ type instruction from its fields
+ * @param rd The link register
+ * @param offset The signed byte offset of the jump target
+ * @return uint32_t The encoded instruction
+*/
+uint32_t encode_UJ_instruct(uint32_t rd, int32_t offset);
 
 /**
  * Execute the instruction
+ * @param vm The vm
  * @param instruct The instruction to execute
- * @param vm_memory The vm memory blob
 */
-void execute_instruct(union instruction instruct, struct blob* vm_memory);
+void execute_instruct(struct vm* vm, union instruction instruct);
 
 /**
- * Start running the virtual machine
- * @param vm_memory The vm memory blob
+ * Reset the registers, program counter, virtual routines and counters to their initial state
+ * @param vm The vm
 */
-void running_vm(struct blob* vm_memory);
+void reset_vm(struct vm* vm);
 
 /**
- * Increment the PC after executing the instruction
+ * Fetch, simulate and execute one instruction, time it, then count it and take a profile sample if one is due
+ * @param vm The vm
 */
-void increment_pc();
+void step_instruct(struct vm* vm);
 
 /**
- * Handle the R type instruction, including add, sub, xor, or, and, slt, srt, sra, slt, and sltu
+ * Execute a fetched instruction, time it, then count it and take a profile sample if one is due
+ * @param vm The vm
  * @param instruct The instruction
 */
-void handle_R_instruct(union instruction instruct);
+void finish_instruct(struct vm* vm, union instruction instruct);
 
 /**
- * Handle the I type 1 instruction, including addi, xori, ori, andi, slti, and sltiu
- * @param instruct The instruction
+ * Stop the running vm, returning from vm_run or vm_step
+ * @param vm The vm
+ * @param status Why the vm stopped
 */
-void handle_I1_instruct(union instruction instruct);
+void vm_stop(struct vm* vm, enum vm_status status);
 
 /**
- * Handle the I type 2 instruction, including lb, lh, lw, lbu, and lhu
- * @param instruct The instruction
+ * Write to the guest console, taking the arguments as a va_list
+ * @param vm The vm
+ * @param format The printf format
+ * @param args The format arguments
 */
-void handle_I2_instruct(union instruction instruct, struct blob* vm_memory);
+void vm_vprintf(struct vm* vm, const char* format, va_list args);
 
 /**
- * Handle the I type 3 instruction, jalr
- * @param instruct The instruction
- * 
+ * Write to the guest console
+ * @param vm The vm
+ * @param format The printf format
 */
-void handle_I3_instruct(union instruction instruct);
+void vm_printf(struct vm* vm, const char* format, ...);
 
 /**
- * Handle the S type instruction, including sb, sh, and sw
- * @param instruct The instruction
- * @param vm_memory The vm memory blob
+ * Write formatted output to a file, or to the guest console when the file is NULL
+ * @param vm The vm
+ * @param out The output file, NULL for the guest console
+ * @param format The printf format
 */
-void handle_S_instruct(union instruction instruct, struct blob* vm_memory);
+void report_printf(struct vm* vm, FILE* out, const char* format, ...);
 
 /**
- * Handle the SB type instruction, including beq, bne, blt, bltu, bge, and bgeu
- * @param instruct The instruction
+ * Read a character from stdin, the default console
+ * @param context Unused
+ * @return int The character, or -1 at the end of input
 */
-void handle_SB_instruct(union instruction instruct);
+int stdio_read_char(void* context);
 
 /**
- * Handle the U type instruction, lui
- * @param instruct The instruction
+ * Read a decimal integer from stdin, the default console
+ * @param context Unused
+ * @param value Set to the integer
+ * @return int 1 if an integer was read, otherwise 0
 */
-void handle_U_instruct(union instruction instruct);
+int stdio_read_int(void* context, int32_t* value);
 
 /**
- * Handle UJ type instruction, jal
- * @param instruct The instruction
+ * Write to stdout, the default console
+ * @param context Unused
+ * @param data The bytes to write
+ * @param len The number of bytes
+*/
+void stdio_write(void* context, const char* data, size_t len);
+
+/**
+ * Increment the PC past the current instruction, by 2 bytes if it was compressed
+ * @param vm The vm
 */
-void handle_UJ_instruct(union instruction instruct);
+void increment_pc(struct vm* vm);
 
 /**
  * Print the instruction not implemented information
+ * @param vm The vm
  * @param instruct The instruction
 */
-void instruct_not_implement(union instruction instruct);
+void instruct_not_implement(struct vm* vm, union instruction instruct);
 
 /**
  * Perform register dump and print the information
+ * @param vm The vm
 */
-void register_dump();
+void register_dump(struct vm* vm);
 
 /**
  * Chech whether the address is within the vm scope
+ * @param vm The vm
  * @param address The address to check
  * @return int, 1 valid, 0 invalid
 */
-int is_valid_address(uint32_t address);
+int is_valid_address(struct vm* vm, uint32_t address);
 
 /**
  * Print the illegal operation information
+ * @param vm The vm
  * @param instruct The current instruction to print
 */
-void illegal_operation(union instruction instruct);
+void illegal_operation(struct vm* vm, union instruction instruct);
 
 /**
  * Load a byte from specific address in vm
+ * @param vm The vm
  * @param address The address of the byte to load
- * @param vm_memory The vm memory blob
  * @param instruct The current instruction
  * @return uin8_t The loaded byte
 */
-uint8_t load_byte(uint32_t address, struct blob* vm_memory, union instruction instruct);
+uint8_t load_byte(struct vm* vm, uint32_t address, union instruction instruct);
 
 /**
  * Load a half word from specific address in vm
+ * @param vm The vm
  * @param address The address of the half word to load
- * @param vm_memory The vm memory blob
  * @param instruct The current instruction
  * @return uin16_t The loaded half word
 */
-uint16_t load_half_word(uint32_t address, struct blob* vm_memory, union instruction instruct);
+uint16_t load_half_word(struct vm* vm, uint32_t address, union instruction instruct);
 
 /**
  * Load a word from specfic address in vm
+ * @param vm The vm
  * @param address The address of the word
- * @param vm_memory The vm memory blob
  * @param instruct The current instruction
  * @return uin32_t The loaded word
 */
-uint32_t load_word(uint32_t address, struct blob* vm_memory, union instruction instruct);
+uint32_t load_word(struct vm* vm, uint32_t address, union instruction instruct);
 
 /**
  * Store a byte to specific address in vm
+ * @param vm The vm
  * @param address The address to store byte
  * @param value, The value of the byte to store
- * @param vm_memory The vm memory blob
  * @param instruct The current instruction
 */
-void store_byte(uint32_t address, uint8_t value, struct blob* vm_memory, union instruction instruct);
+void store_byte(struct vm* vm, uint32_t address, uint8_t value, union instruction instruct);
 
 /**
  * Store a half word to specific address in vm
+ * @param vm The vm
  * @param address The address to store the half word
  * @param value, The value of the half word
- * @param vm_memory The vm memory blob
  * @param instruct The current instruction
 */
-void store_half_word(uint32_t address, uint16_t value, struct blob* vm_memory, union instruction instruct);
+void store_half_word(struct vm* vm, uint32_t address, uint16_t value, union instruction instruct);
 
 /**
  * Store a word to specified address in vm
+ * @param vm The vm
  * @param address, The address to store the word
  * @param value, The value of the word
- * @param vm_memory The vm memory blob
  * @param instruct The current instruction
 */
-void store_word(uint32_t address, uint32_t value, struct blob* vm_memory, union instruction instruct);
+void store_word(struct vm* vm, uint32_t address, uint32_t value, union instruction instruct);
+
+/**
+ * Read the host monotonic clock relative to the start of the vm
+ * @param vm The vm
+ * @return uint64_t The elapsed time in microseconds
+*/
+uint64_t elapsed_micros(struct vm* vm);
 
 /**
  * Perform read related virtual routine
+ * @param vm The vm
  * @param address The address related to virtual routine
- * @param vm_memory The vm memory blob
  * @retun unin32_t The reading result of the virtual routine
 */
-uint32_t console_read_routine(uint32_t address, struct blob* vm_memory);
+uint32_t console_read_routine(struct vm* vm, uint32_t address);
 
 /**
  * Perform write related virtual routine
+ * @param vm The vm
  * @param address The address related to virtual routine
- * @param vm_memory The vm memory blob
  * @retun unin32_t The writing result of the virtual routine
 */
-int console_write_routine(uint32_t address, uint32_t value, struct blob* vm_memory, union instruction instruct);
+int console_write_routine(struct vm* vm, uint32_t address, uint32_t value, union instruction instruct);
+
+/**
+ * Initializes the heap management linked list with all 128 banks unallocated, the bank contents are left alone
+ * @param vm The vm
+*/
+void init_heap(struct vm* vm);
+
+/**
+ * Free the heap management linked list
+ * @param vm The vm
+*/
+void free_heap(struct vm* vm);
 
 /**
- * Initializes the heap management linked list with all 128 banks unallocated
+ * Print the heap allocator statistics, including the current fragmentation of the free banks
+ * @param vm The vm
+ * @param out The output file, NULL for the guest console
 */
-void init_heap();
+void heap_stats_dump(struct vm* vm, FILE* out);
+
+/**
+ * Write a heap statistics report once the vm stops
+ * @param vm The vm
+ * @param report The file for the report, "-" for stdout
+*/
+void heap_stats_start(struct vm* vm, const char* report);
+
+/**
+ * Write the heap statistics report, called after the run
+ * @param vm The vm
+*/
+void heap_stats_report(struct vm* vm);
 
 /**
  * Malloc a chunk of memory on the heap banks with the specified size
+ * @param vm The vm
  * @param size The size of the memory
  * @return The allocated memory address if successful, otherwise 0;
 */
-uint32_t vm_malloc(uint32_t size);
+uint32_t vm_malloc(struct vm* vm, uint32_t size);
 
 /**
  * Free a chunk of memory on the heap starting at the value being stored
+ * @param vm The vm
  * @param address The address on heap to free
  * @return the free result 1 if successful, otherwise 0
 */
-int vm_free(uint32_t address);
+int vm_free(struct vm* vm, uint32_t address);
+
+/**
+ * Copy bytes between heap addresses at host speed, the ranges may overlap
+ * @param vm The vm
+ * @param destination The heap address to copy to
+ * @param source The heap address to copy from
+ * @param len The number of bytes
+*/
+void heap_move(struct vm* vm, uint32_t destination, uint32_t source, uint32_t len);
+
+/**
+ * Resize a chunk of heap memory, in place when the banks after it are free, otherwise by moving it to
+ * a new chunk, or into the free banks before it. The first min(old, new size) bytes are kept.
+ * @param vm The vm
+ * @param address The chunk to resize, 0 to malloc a new chunk
+ * @param size The new size, 0 to free the chunk
+ * @param result Set to the address of the resized chunk, or 0 if it could not be resized and is unchanged
+ * @return int 1 if successful, 0 if the address is not an allocated chunk
+*/
+int vm_realloc(struct vm* vm, uint32_t address, uint32_t size, uint32_t* result);
+
+/**
+ * Malloc a chunk of memory on the heap banks and fill it with zeros
+ * @param vm The vm
+ * @param size The size of the memory
+ * @return The allocated memory address if successful, otherwise 0
+*/
+uint32_t vm_calloc(struct vm* vm, uint32_t size);
+
+/**
+ * Find the host word an atomic instruction works on, a naturally aligned word of data or heap memory
+ * @param vm The vm
+ * @param address The guest address
+ * @param instruct The instruction, reported as an illegal operation for any other address
+ * @return _Atomic uint32_t* The word, in the memory shared by all harts
+*/
+_Atomic uint32_t* atomic_word(struct vm* vm, uint32_t address, union instruction instruct);
+
+/**
+ * Load a word and reserve it, lr.w
+ * @param vm The vm
+ * @param address The guest address
+ * @param instruct The instruction
+ * @return uint32_t The word
+*/
+uint32_t load_reserved(struct vm* vm, uint32_t address, union instruction instruct);
+
+/**
+ * Store a word if it is still reserved and holds the value lr.w read, sc.w
+ * @param vm The vm
+ * @param address The guest address
+ * @param value The word to store
+ * @param instruct The instruction
+ * @return uint32_t 0 if the word was stored, otherwise 1
+*/
+uint32_t store_conditional(struct vm* vm, uint32_t address, uint32_t value, union instruction instruct);
+
+/**
+ * Atomically read a word and write back the result of an operation on it and a register
+ * @param vm The vm
+ * @param address The guest address
+ * @param value The register operand
+ * @param operation The operation
+ * @param instruct The instruction
+ * @return uint32_t The word before the operation
+*/
+uint32_t atomic_memory_operation(struct vm* vm, uint32_t address, uint32_t value, enum AtomicOperation operation,
+                                 union instruction instruct);
+
+/**
+ * Check that every byte of a heap range is in an allocated chunk, the range may run on into the next chunk
+ * only where the first one fills its banks, as a loop of byte loads would
+ * @param vm The vm
+ * @param address The first heap address
+ * @param last The last heap address
+ * @return int 1 if it is, otherwise 0
+*/
+int heap_range_valid(struct vm* vm, uint32_t address, uint32_t last);
+
+/**
+ * Find the host memory behind a range of words a vector instruction reads or writes, which must lie in one
+ * region: data memory, allocated heap, or instruction memory and the input file for reads. Anything else is an
+ * illegal operation
+ * @param vm The vm
+ * @param address The guest address of the first word
+ * @param n The number of words, at least 1
+ * @param store 1 if the instruction writes the range, which marks its pages dirty
+ * @param instruct The instruction
+ * @return unsigned char* Host address of the first word
+*/
+unsigned char* vector_memory(struct vm* vm, uint32_t address, uint32_t n, int store, union instruction instruct);
+
+/**
+ * Execute vadd.w or vsub.w, n words from two arrays into a third
+ * @param vm The vm
+ * @param operation The operation
+ * @param destination The guest address of the result
+ * @param a The guest address of the first array
+ * @param b The guest address of the second array
+ * @param n The number of words, nothing is accessed if it is 0
+ * @param instruct The instruction
+*/
+void vector_memory_operation(struct vm* vm, enum VectorOperation operation, uint32_t destination, uint32_t a,
+                             uint32_t b, uint32_t n, union instruction instruct);
+
+/**
+ * Execute vdot.w, the dot product of two arrays of n words
+ * @param vm The vm
+ * @param a The guest address of the first array
+ * @param b The guest address of the second array
+ * @param n The number of words, nothing is accessed if it is 0
+ * @param instruct The instruction
+ * @return uint32_t The low 32 bits of the sum of the products
+*/
+uint32_t vector_dot_product(struct vm* vm, uint32_t a, uint32_t b, uint32_t n, union instruction instruct);
 
 #endif
\ No newline at end of file
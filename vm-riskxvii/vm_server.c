@@ -0,0 +1,533 @@
+#define _DEFAULT_SOURCE  // For sockets, poll, sigaction and realpath
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "vm_server.h"
+#include "vm_riskxvii.h"
+#include "vm_program.h"
+
+struct server server;  // The daemon state
+
+int send_all(int fd, const void* data, size_t len) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    while (len > 0) {
+        ssize_t sent = send(fd, bytes, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return 0;
+            }
+            // The socket is non-blocking for the front end, wait for the client to catch up
+            struct pollfd waiting = {fd, POLLOUT, 0};
+            poll(&waiting, 1, -1);
+            continue;
+        }
+        bytes += sent;
+        len -= (size_t)sent;
+    }
+    return 1;
+}
+
+int send_frame(int fd, char type, const void* payload, size_t len) {
+    unsigned char header[FRAME_HEADER_BYTES] = {(unsigned char)type, (unsigned char)len, (unsigned char)(len >> 8),
+                                                (unsigned char)(len >> 16), (unsigned char)(len >> 24)};
+    return send_all(fd, header, sizeof(header)) && send_all(fd, payload, len);
+}
+
+int receive_frame(int fd, char* type, struct byte_buffer* payload) {
+    unsigned char header[FRAME_HEADER_BYTES];
+    size_t got = 0;
+    while (got < sizeof(header)) {
+        ssize_t ret = recv(fd, header + got, sizeof(header) - got, 0);
+        if (ret <= 0) {
+            return 0;
+        }
+        got += (size_t)ret;
+    }
+    *type = (char)header[0];
+    size_t len = header[1] | (header[2] << 8) | (header[3] << 16) | ((size_t)header[4] << 24);
+
+    buffer_clear(payload);
+    unsigned char chunk[SERVE_READ_CHUNK];
+    while (payload->len < len) {
+        size_t want = len - payload->len < sizeof(chunk) ? len - payload->len : sizeof(chunk);
+        ssize_t ret = recv(fd, chunk, want, 0);
+        if (ret <= 0) {
+            return 0;
+        }
+        buffer_append(payload, chunk, (size_t)ret);
+    }
+    return 1;
+}
+
+int job_read_char(void* context) {
+    return buffer_read_char(&((struct connection*)context)->input);
+}
+
+int job_read_int(void* context, int32_t* value) {
+    return buffer_read_int(&((struct connection*)context)->input, value);
+}
+
+void job_write(void* context, const char* data, size_t len) {
+    struct connection* conn = (struct connection*)context;
+    buffer_append(&conn->output, data, len);
+    if (conn->output.len >= SERVE_OUTPUT_BUFFER) {
+        flush_output(conn);
+    }
+}
+
+void flush_output(struct connection* conn) {
+    if (conn->output.len > 0 && !conn->failed) {
+        if (!send_frame(conn->fd, FRAME_OUTPUT, conn->output.data, conn->output.len)) {
+            conn->failed = 1;  // The client went away, let the job finish quietly
+        }
+    }
+    buffer_clear(&conn->output);
+}
+
+struct vm* cached_vm(const char* path, const char* isa, struct cached_image** owner, uint32_t* generation,
+                     const char** error) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        *error = "Error reading image";
+        return NULL;
+    }
+
+    pthread_mutex_lock(&server.lock);
+    struct cached_image* entry = server.images;
+    while (entry && (strcmp(entry->path, path) != 0 || strcmp(entry->isa, isa) != 0)) {
+        entry = entry->next;
+    }
+    if (entry && entry->vm && (entry->mtime.tv_sec != info.st_mtim.tv_sec ||
+                                entry->mtime.tv_nsec != info.st_mtim.tv_nsec || entry->size != info.st_size)) {
+        // The file changed since it was cached, build the template again
+        vm_destroy(entry->vm);
+        entry->vm = NULL;
+        while (entry->idle_num > 0) {
+            vm_destroy(entry->idle[--entry->idle_num]);
+        }
+        entry->generation++;
+    }
+    if (entry == NULL) {
+        entry = (struct cached_image*)calloc(1, sizeof(struct cached_image));
+        entry->path = strdup(path);
+        snprintf(entry->isa, sizeof(entry->isa), "%s", isa);
+        entry->next = server.images;
+        server.images = entry;
+    }
+    struct vm* loaded = NULL;
+    if (entry->vm == NULL) {
+        // Reading the file holds up neither the front end nor the other workers, which need the lock for the queue
+        pthread_mutex_unlock(&server.lock);
+        loaded = load_template(path, isa);
+        pthread_mutex_lock(&server.lock);
+        // Another worker may have installed a template of the same file meanwhile, theirs is kept
+        if (loaded && entry->vm == NULL) {
+            entry->vm = loaded;
+            entry->mtime = info.st_mtim;
+            entry->size = info.st_size;
+            loaded = NULL;
+        }
+    }
+
+    struct vm* vm = NULL;
+    *owner = entry;
+    *generation = entry->generation;
+    if (entry->idle_num > 0) {
+        vm = entry->idle[--entry->idle_num];
+    } else if (entry->vm) {
+        // A fresh vm owns no heap nodes or tools, so a plain copy without the symbols and with a reference of its own
+        // to the program is independent of the template
+        vm = (struct vm*)malloc(sizeof(struct vm));
+        memcpy(vm, entry->vm, sizeof(struct vm));
+        memset(&vm->symbols, 0, sizeof(vm->symbols));
+        program_retain(vm->program);
+        // Not reset_vm, which would clear the entry pc and registers of a sectioned image
+        clock_gettime(CLOCK_MONOTONIC, &vm->start_time);
+    } else {
+        *error = "Error reading image";
+    }
+    pthread_mutex_unlock(&server.lock);
+    vm_destroy(loaded);
+    return vm;
+}
+
+struct vm* load_template(const char* path, const char* isa) {
+    size_t size;
+    unsigned char* bytes = read_memory_image(path, &size);
+    struct vm* vm = bytes ? vm_create(bytes, size) : NULL;
+    free(bytes);
+    if (vm && isa[0] && !vm_set_isa(vm, isa)) {
+        vm_destroy(vm);
+        vm = NULL;
+    }
+    return vm;
+}
+
+void release_vm(struct cached_image* entry, uint32_t generation, struct vm* vm) {
+    // Only the pages the job wrote are copied back, far less than copying the template
+    vm_reset(vm);
+    pthread_mutex_lock(&server.lock);
+    if (entry->generation == generation && entry->idle_num < SERVE_IDLE_VMS) {
+        entry->idle[entry->idle_num++] = vm;
+        vm = NULL;
+    }
+    pthread_mutex_unlock(&server.lock);
+    vm_destroy(vm);
+}
+
+int parse_frames(struct connection* conn) {
+    struct byte_buffer* in = &conn->incoming;
+    while (in->len - in->pos >= FRAME_HEADER_BYTES) {
+        unsigned char* header = in->data + in->pos;
+        size_t len = header[1] | (header[2] << 8) | (header[3] << 16) | ((size_t)header[4] << 24);
+        if (len > FRAME_MAX_PAYLOAD) {
+            return -1;
+        }
+        if (in->len - in->pos < FRAME_HEADER_BYTES + len) {
+            break;  // Wait for the rest of the payload
+        }
+        unsigned char* payload = header + FRAME_HEADER_BYTES;
+        in->pos += FRAME_HEADER_BYTES + len;
+
+        switch (header[0]) {
+            case FRAME_PATH:
+                free(conn->path);
+                conn->path = (char*)malloc(len + 1);
+                memcpy(conn->path, payload, len);
+                conn->path[len] = '\0';
+                break;
+            case FRAME_IMAGE:
+                buffer_clear(&conn->image);
+                buffer_append(&conn->image, payload, len);
+                break;
+            case FRAME_INPUT:
+                buffer_append(&conn->input, payload, len);
+                break;
+            case FRAME_BUDGET:
+                conn->budget = 0;
+                for (size_t i = 0; i < len && i < sizeof(conn->budget); i++) {
+                    conn->budget |= (uint64_t)payload[i] << (8 * i);
+                }
+                break;
+            case FRAME_ISA:
+                if (len >= ISA_MAX_LEN) {
+                    return -1;
+                }
+                memcpy(conn->isa, payload, len);
+                conn->isa[len] = '\0';
+                break;
+            case FRAME_RUN:
+                return 1;
+            default:
+                return -1;
+        }
+    }
+
+    // Drop the parsed frames so the buffer does not keep growing
+    memmove(in->data, in->data + in->pos, in->len - in->pos);
+    in->len -= in->pos;
+    in->pos = 0;
+    return 0;
+}
+
+void run_job(struct connection* conn) {
+    const char* error = "Invalid image";
+    struct vm* vm = NULL;
+    struct cached_image* entry = NULL;
+    uint32_t generation = 0;
+    if (conn->path) {
+        vm = cached_vm(conn->path, conn->isa, &entry, &generation, &error);
+    } else {
+        vm = vm_create(conn->image.data, conn->image.len);
+        if (vm && conn->isa[0] && !vm_set_isa(vm, conn->isa)) {
+            vm_destroy(vm);
+            vm = NULL;
+            error = "Unsupported ISA";
+        }
+    }
+
+    if (vm == NULL) {
+        if (!send_frame(conn->fd, FRAME_ERROR, error, strlen(error))) {
+            conn->failed = 1;
+        }
+    } else {
+        struct vm_console console = {job_read_char, job_read_int, job_write, conn};
+        vm_set_console(vm, &console);
+        struct run_stop stop;
+        record_stop(vm, vm_run(vm, conn->budget), &stop);
+        if (entry) {
+            release_vm(entry, generation, vm);
+        } else {
+            vm_destroy(vm);
+        }
+
+        flush_output(conn);
+        unsigned char payload[STATUS_PAYLOAD_BYTES];
+        put_le(payload, (uint64_t)stop.status, 4);
+        put_le(payload + 4, stop.pc, 4);
+        put_le(payload + 8, stop.instruct, 4);
+        if (!conn->failed && !send_frame(conn->fd, FRAME_STATUS, payload, sizeof(payload))) {
+            conn->failed = 1;
+        }
+    }
+
+    // Ready for the next job on the same connection
+    free(conn->path);
+    conn->path = NULL;
+    buffer_clear(&conn->image);
+    buffer_clear(&conn->input);
+    conn->budget = 0;
+    conn->isa[0] = '\0';
+}
+
+void close_connection(struct connection* conn) {
+    close(conn->fd);
+    free(conn->incoming.data);
+    free(conn->path);
+    free(conn->image.data);
+    free(conn->input.data);
+    free(conn->output.data);
+    free(conn);
+}
+
+void rearm_connection(struct connection* conn) {
+    struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = conn};
+    if (epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) != 0) {
+        close_connection(conn);
+    }
+}
+
+void* serve_worker(void* arg) {
+    while (1) {
+        pthread_mutex_lock(&server.lock);
+        while (server.queue_head == NULL) {
+            pthread_cond_wait(&server.ready, &server.lock);
+        }
+        struct connection* conn = server.queue_head;
+        server.queue_head = conn->next;
+        if (server.queue_head == NULL) {
+            server.queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&server.lock);
+
+        // Jobs pipelined behind this one were left in the incoming buffer
+        int parsed;
+        do {
+            run_job(conn);
+            parsed = conn->failed ? -1 : parse_frames(conn);
+        } while (parsed == 1);
+
+        if (parsed < 0) {
+            epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+            close_connection(conn);
+        } else {
+            rearm_connection(conn);
+        }
+    }
+    return NULL;
+}
+
+void serve_readable(struct connection* conn) {
+    unsigned char chunk[SERVE_READ_CHUNK];
+    while (1) {
+        ssize_t ret = recv(conn->fd, chunk, sizeof(chunk), 0);
+        if (ret > 0) {
+            buffer_append(&conn->incoming, chunk, (size_t)ret);
+            continue;
+        }
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;  // Everything available has been read
+        }
+        // The client closed the connection or it failed
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close_connection(conn);
+        return;
+    }
+
+    int parsed = parse_frames(conn);
+    if (parsed < 0) {
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close_connection(conn);
+    } else if (parsed == 0) {
+        rearm_connection(conn);
+    } else {
+        // The connection stays disarmed until a worker has run the job
+        conn->next = NULL;
+        pthread_mutex_lock(&server.lock);
+        if (server.queue_tail) {
+            server.queue_tail->next = conn;
+        } else {
+            server.queue_head = conn;
+        }
+        server.queue_tail = conn;
+        pthread_cond_signal(&server.ready);
+        pthread_mutex_unlock(&server.lock);
+    }
+}
+
+int serve(const char* socket_path, int workers) {
+    // Clients that disconnect mid job must not kill the daemon
+    struct sigaction ignore = {.sa_handler = SIG_IGN};
+    sigaction(SIGPIPE, &ignore, NULL);
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.listen_fd < 0 || bind(server.listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(server.listen_fd, SERVE_BACKLOG) != 0) {
+        perror("Error opening socket");
+        return 1;
+    }
+    server.epoll_fd = epoll_create1(0);
+    struct epoll_event listen_event = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &listen_event);
+
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    for (int i = 0; i < (workers > 0 ? workers : SERVE_DEFAULT_WORKERS); i++) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, serve_worker, NULL);
+        pthread_detach(thread);
+    }
+
+    struct epoll_event events[SERVE_MAX_EVENTS];
+    while (1) {
+        int ready = epoll_wait(server.epoll_fd, events, SERVE_MAX_EVENTS, -1);
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.ptr != NULL) {
+                serve_readable((struct connection*)events[i].data.ptr);
+                continue;
+            }
+            int fd = accept(server.listen_fd, NULL, NULL);
+            if (fd < 0) {
+                continue;
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            struct connection* conn = (struct connection*)calloc(1, sizeof(struct connection));
+            conn->fd = fd;
+            // One shot, so a connection is never read by the front end while a worker owns it
+            struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = conn};
+            if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                close_connection(conn);
+            }
+        }
+    }
+    return 0;
+}
+
+int connect_run(const char* socket_path, const char* image, const char* isa, uint64_t budget, int repeat,
+                struct run_stop* stop) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 0;
+    }
+    strcpy(address.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        perror("Error connecting");
+        return 0;
+    }
+
+    // The whole of stdin is the console input, the guest may read any part of it, and every repeat gets all of it
+    struct byte_buffer input = {0};
+    buffer_read_file(stdin, &input);
+    // A path lets the daemon keep the image warm, the bytes are only read if it cannot open the file itself
+    char* path = realpath(image, NULL);
+    unsigned char* bytes = NULL;
+    size_t size = 0;
+    int done = 1;
+    for (int run = 0; run < repeat && done; run++) {
+        int rejected = 0;
+        if (path) {
+            done = send_job(fd, FRAME_PATH, path, strlen(path), isa, budget, &input) &&
+                   receive_job(fd, stop, &rejected);
+        }
+        if (path && !rejected) {
+            continue;
+        }
+        free(path);
+        path = NULL;
+        if (bytes == NULL && (bytes = read_memory_image(image, &size)) == NULL) {
+            perror("Error reading image");
+            done = 0;
+            break;
+        }
+        done = send_job(fd, FRAME_IMAGE, bytes, size, isa, budget, &input) && receive_job(fd, stop, NULL);
+    }
+    free(path);
+    free(bytes);
+    free(input.data);
+    close(fd);
+    return done;
+}
+
+int send_job(int fd, char image_type, const void* image, size_t len, const char* isa, uint64_t budget,
+             const struct byte_buffer* input) {
+    unsigned char budget_bytes[8];
+    for (int i = 0; i < 8; i++) {
+        budget_bytes[i] = (unsigned char)(budget >> (8 * i));
+    }
+    int sent = send_frame(fd, image_type, image, len) && send_frame(fd, FRAME_BUDGET, budget_bytes, 8);
+    if (sent && isa) {
+        sent = send_frame(fd, FRAME_ISA, isa, strlen(isa));
+    }
+    for (size_t pos = 0; sent && pos < input->len; pos += SERVE_READ_CHUNK) {
+        size_t chunk = input->len - pos < SERVE_READ_CHUNK ? input->len - pos : SERVE_READ_CHUNK;
+        sent = send_frame(fd, FRAME_INPUT, input->data + pos, chunk);
+    }
+    if (sent) {
+        sent = send_frame(fd, FRAME_RUN, NULL, 0);
+    }
+    if (!sent) {
+        fprintf(stderr, "Connection closed before the job was sent\n");
+    }
+    return sent;
+}
+
+int receive_job(int fd, struct run_stop* stop, int* rejected) {
+    struct byte_buffer payload = {0};
+    char type = 0;
+    int done = 0;
+    while (!done && receive_frame(fd, &type, &payload)) {
+        if (type == FRAME_OUTPUT) {
+            fwrite(payload.data, 1, payload.len, stdout);
+        } else if (type == FRAME_STATUS && payload.len >= STATUS_PAYLOAD_BYTES) {
+            stop->status = (enum vm_status)get_le(payload.data, 4);
+            stop->pc = (uint32_t)get_le(payload.data + 4, 4);
+            stop->instruct = (uint32_t)get_le(payload.data + 8, 4);
+            done = 1;
+        } else if (type == FRAME_ERROR) {
+            if (rejected) {
+                *rejected = 1;
+            } else {
+                fprintf(stderr, "%.*s\n", (int)payload.len, (const char*)payload.data);
+            }
+            break;
+        }
+    }
+    if (!done && type != FRAME_ERROR) {
+        fprintf(stderr, "Connection closed before the job finished\n");
+    }
+    free(payload.data);
+    // A rejected job that will be sent again still counts as received
+    return done || (rejected && *rejected);
+}
@@ -0,0 +1,241 @@
+#ifndef VM_SERVER_H
+#define VM_SERVER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include "libriskxvii.h"
+#include "vm_buffer.h"
+#include "vm_decode.h"
+
+#define SERVE_DEFAULT_WORKERS 4
+#define SERVE_MAX_EVENTS 64
+#define SERVE_BACKLOG 64
+#define SERVE_READ_CHUNK 4096
+#define SERVE_OUTPUT_BUFFER 4096         // Console output is sent once this much is pending
+#define FRAME_HEADER_BYTES 5             // Type byte and little endian payload length
+#define FRAME_MAX_PAYLOAD (16 << 20)     // Larger frames close the connection
+#define ISA_MAX_LEN 16
+#define SERVE_IDLE_VMS 8                 // Vms kept reset per cached image between jobs
+#define STATUS_PAYLOAD_BYTES 12          // Status, stop pc and instruction
+
+// Client to server frames, a job is any number of these followed by FRAME_RUN
+#define FRAME_PATH 'P'    // Image file path, read by the server and cached
+#define FRAME_IMAGE 'I'   // Image bytes
+#define FRAME_INPUT 'D'   // Console input, appended to what was sent before
+#define FRAME_BUDGET 'B'  // Instruction budget, 8 bytes little endian, 0 for no limit
+#define FRAME_ISA 'A'     // ISA string, e.g. rv32imc
+#define FRAME_RUN 'R'     // Run the job, empty
+// Server to client frames
+#define FRAME_OUTPUT 'O'  // Console output
+#define FRAME_STATUS 'S'  // Job finished, enum vm_status, stop pc and instruction, 4 bytes little endian each
+#define FRAME_ERROR 'E'   // Job rejected, the payload is the reason
+
+struct connection {
+    int fd;
+    struct byte_buffer incoming;  // Bytes received and not parsed into frames yet
+    char* path;                   // Image path of the job, NULL if the image was sent
+    struct byte_buffer image;     // Image bytes of the job
+    struct byte_buffer input;     // Console input of the job
+    struct byte_buffer output;    // Console output not sent yet
+    uint64_t budget;              // Instruction budget of the job, 0 for no limit
+    char isa[ISA_MAX_LEN];        // ISA of the job, empty for rv32i
+    int failed;                   // Set once a send fails, the connection is closed after the job
+    struct connection* next;      // Next job in the queue
+};  // A client connection, owned by the front end while idle and by one worker while running a job
+
+struct cached_image {
+    char* path;
+    char isa[ISA_MAX_LEN];
+    struct timespec mtime;  // The file is read again once it changes, to the nanosecond
+    off_t size;
+    struct vm* vm;  // Freshly created and predecoded, copied when no idle vm is left
+    struct vm* idle[SERVE_IDLE_VMS];  // Vms that ran a job and were reset, reused before copying the template
+    int idle_num;
+    uint32_t generation;  // Counts template rebuilds, vms of an older one are not kept
+    struct cached_image* next;
+};  // An image kept warm between jobs
+
+struct server {
+    int listen_fd;
+    int epoll_fd;
+    pthread_mutex_t lock;    // Guards the job queue and the image cache
+    pthread_cond_t ready;    // Signalled when a job is queued
+    struct connection* queue_head;
+    struct connection* queue_tail;
+    struct cached_image* images;
+};  // The daemon state
+
+/**
+ * Send a whole buffer on a socket, waiting while it is full
+ * @param fd The socket
+ * @param data The bytes
+ * @param len The number of bytes
+ * @return int 1 if everything was sent, otherwise 0
+*/
+int send_all(int fd, const void* data, size_t len);
+
+/**
+ * Send one frame
+ * @param fd The socket
+ * @param type The frame type
+ * @param payload The payload
+ * @param len The payload length
+ * @return int 1 if the frame was sent, otherwise 0
+*/
+int send_frame(int fd, char type, const void* payload, size_t len);
+
+/**
+ * Receive exactly one frame, blocking, for the client
+ * @param fd The socket
+ * @param type Set to the frame type
+ * @param payload The buffer the payload is read into, replacing its contents
+ * @return int 1 if a frame was received, otherwise 0
+*/
+int receive_frame(int fd, char* type, struct byte_buffer* payload);
+
+/**
+ * Console read character callback over the job input
+ * @param context The connection
+ * @return int The next character, or -1 at the end of the input
+*/
+int job_read_char(void* context);
+
+/**
+ * Console read integer callback over the job input
+ * @param context The connection
+ * @param value Set to the integer
+ * @return int 1 if an integer was read, otherwise 0
+*/
+int job_read_int(void* context, int32_t* value);
+
+/**
+ * Console write callback, output is streamed to the client in frames
+ * @param context The connection
+ * @param data The bytes written by the guest
+ * @param len The number of bytes
+*/
+void job_write(void* context, const char* data, size_t len);
+
+/**
+ * Send the pending console output of a job
+ * @param conn The connection
+*/
+void flush_output(struct connection* conn);
+
+/**
+ * Get a vm for an image file through the image cache, reading the file if it is new or changed
+ * @param path The image path
+ * @param isa The ISA string, empty for rv32i
+ * @param entry Set to the cache entry the vm belongs to
+ * @param generation Set to the template generation the vm came from
+ * @param error Set to the reason on failure
+ * @return struct vm* A fresh vm, or NULL on failure
+*/
+struct vm* cached_vm(const char* path, const char* isa, struct cached_image** entry, uint32_t* generation,
+                     const char** error);
+
+/**
+ * Read an image file and build the template vm its cache entry copies, without holding the server lock
+ * @param path The image path
+ * @param isa The ISA string, empty for rv32i
+ * @return struct vm* The template, or NULL if the file could not be read or the ISA set
+*/
+struct vm* load_template(const char* path, const char* isa);
+
+/**
+ * Give a vm back to the image cache once its job is done, resetting it for the next job
+ * @param entry The cache entry the vm came from
+ * @param generation The template generation the vm came from
+ * @param vm The vm, destroyed if the template changed since or enough vms are idle
+*/
+void release_vm(struct cached_image* entry, uint32_t generation, struct vm* vm);
+
+/**
+ * Parse the complete frames received on a connection
+ * @param conn The connection
+ * @return int 1 if a job is ready to run, 0 if more frames are needed, -1 if the stream is invalid
+*/
+int parse_frames(struct connection* conn);
+
+/**
+ * Run the job of a connection and send its output and status, then reset the job
+ * @param conn The connection
+*/
+void run_job(struct connection* conn);
+
+/**
+ * Free a connection and close its socket
+ * @param conn The connection
+*/
+void close_connection(struct connection* conn);
+
+/**
+ * Hand a connection back to the front end to wait for its next job
+ * @param conn The connection
+*/
+void rearm_connection(struct connection* conn);
+
+/**
+ * Worker thread, runs queued jobs until the process ends
+ * @param arg Unused
+ * @return void* Never returns
+*/
+void* serve_worker(void* arg);
+
+/**
+ * Read from a connection that epoll reported readable, queueing its job once complete
+ * @param conn The connection
+*/
+void serve_readable(struct connection* conn);
+
+/**
+ * Run the daemon on a Unix domain socket, never returns unless setting up fails
+ * @param socket_path The socket path, replaced if it exists
+ * @param workers The number of worker threads
+ * @return int 1 on failure
+*/
+int serve(const char* socket_path, int workers);
+
+/**
+ * Run an image on a daemon, sending stdin as the console input and printing the output. The absolute path of
+ * the image is sent, so the daemon keeps it warm, and its bytes only if the daemon cannot read the file
+ * @param socket_path The daemon socket
+ * @param image The image file
+ * @param isa The ISA string, NULL for rv32i
+ * @param budget The instruction budget, 0 for no limit
+ * @param repeat Times the job is run over the one connection, each with the whole input
+ * @param stop Set to how the last job stopped
+ * @return int 1 if every job ran, otherwise 0 with the reason printed
+*/
+int connect_run(const char* socket_path, const char* image, const char* isa, uint64_t budget, int repeat,
+                struct run_stop* stop);
+
+/**
+ * Send one job to a daemon
+ * @param fd The socket
+ * @param image_type FRAME_PATH or FRAME_IMAGE
+ * @param image The path or the image bytes
+ * @param len Their length
+ * @param isa The ISA string, NULL for rv32i
+ * @param budget The instruction budget, 0 for no limit
+ * @param input The console input
+ * @return int 1 if the job was sent, otherwise 0 with the reason printed
+*/
+int send_job(int fd, char image_type, const void* image, size_t len, const char* isa, uint64_t budget,
+             const struct byte_buffer* input);
+
+/**
+ * Print the output of a job as it streams back, until its status
+ * @param fd The socket
+ * @param stop Set to how the job stopped
+ * @param rejected If not NULL, set to 1 when the daemon rejects the job instead of printing the reason
+ * @return int 1 if the job finished or was rejected into rejected, otherwise 0 with the reason printed
+*/
+int receive_job(int fd, struct run_stop* stop, int* rejected);
+
+#endif
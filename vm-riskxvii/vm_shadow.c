@@ -0,0 +1,291 @@
+#include "vm_shadow.h"
+#include "vm_decode.h"
+#include "vm_input.h"
+#include "vm_program.h"
+
+int shadow_start(struct vm* vm, uint64_t interval) {
+    struct shadow* shadow = (struct shadow*)calloc(1, sizeof(struct shadow));
+    struct vm* reference = (struct vm*)malloc(sizeof(struct vm));
+    struct input_device* input = vm->input ? (struct input_device*)malloc(sizeof(struct input_device)) : NULL;
+    if (shadow == NULL || reference == NULL || (vm->input && input == NULL)) {
+        free(shadow);
+        free(reference);
+        free(input);
+        return 0;
+    }
+    // Like a hart, the copy owns nothing of the vm's, and it takes none of its tools or its guard page
+    memcpy(reference, vm, sizeof(struct vm));
+    memset(&reference->symbols, 0, sizeof(reference->symbols));
+    program_retain(reference->program);
+    init_heap(reference);
+    reference->heap_stats_output = NULL;
+    reference->profile = NULL;
+    reference->cache_sim = NULL;
+    reference->pipeline = NULL;
+    reference->guard = NULL;
+    reference->shadow = NULL;
+    // The reference reads the vm's mapping of the input file through a cursor of its own
+    if (input) {
+        memcpy(input, vm->input, sizeof(struct input_device));
+        reference->input = input;
+    }
+
+    shadow->reference = reference;
+    shadow->interval = interval ? interval : 1;
+    shadow->console = vm->console;
+    shadow->sides[0].shadow = shadow;
+    shadow->sides[1].shadow = shadow;
+    struct vm_console live = {shadow_live_read_char, shadow_live_read_int, shadow_live_write, &shadow->sides[0]};
+    struct vm_console replay = {shadow_replay_read_char, shadow_replay_read_int, shadow_replay_write,
+                                &shadow->sides[1]};
+    vm->console = live;
+    reference->console = replay;
+    vm->shadow = shadow;
+    return 1;
+}
+
+void shadow_free(struct vm* vm) {
+    struct shadow* shadow = vm->shadow;
+    if (shadow == NULL) {
+        return;
+    }
+    // The mapping belongs to the vm
+    if (shadow->reference->input) {
+        shadow->reference->input->data = NULL;
+    }
+    vm_destroy(shadow->reference);
+    free(shadow->input.data);
+    free(shadow->sides[0].output.data);
+    free(shadow->sides[1].output.data);
+    free(shadow);
+    vm->shadow = NULL;
+}
+
+int shadow_live_read_char(void* context) {
+    struct shadow* shadow = ((struct shadow_side*)context)->shadow;
+    int result = shadow->console.read_char(shadow->console.context);
+    unsigned char record[SHADOW_READ_BYTES];
+    record[0] = SHADOW_READ_CHAR;
+    put_le(record + 1, (uint32_t)result, 4);
+    put_le(record + 5, 0, 4);
+    buffer_append(&shadow->input, record, sizeof(record));
+    return result;
+}
+
+int shadow_live_read_int(void* context, int32_t* value) {
+    struct shadow* shadow = ((struct shadow_side*)context)->shadow;
+    int result = shadow->console.read_int(shadow->console.context, value);
+    unsigned char record[SHADOW_READ_BYTES];
+    record[0] = SHADOW_READ_INT;
+    put_le(record + 1, (uint32_t)result, 4);
+    put_le(record + 5, result ? (uint32_t)*value : 0, 4);
+    buffer_append(&shadow->input, record, sizeof(record));
+    return result;
+}
+
+void shadow_live_write(void* context, const char* data, size_t len) {
+    struct shadow_side* side = (struct shadow_side*)context;
+    side->shadow->console.write(side->shadow->console.context, data, len);
+    buffer_append(&side->output, data, len);
+}
+
+int shadow_replay(struct shadow_side* side, enum ShadowRead kind, int32_t* value) {
+    struct byte_buffer* input = &side->shadow->input;
+    if (side->input_diverged || input->len - side->input_pos < SHADOW_READ_BYTES ||
+        input->data[side->input_pos] != kind) {
+        side->input_diverged = 1;
+        return kind == SHADOW_READ_CHAR ? -1 : 0;
+    }
+    const unsigned char* record = input->data + side->input_pos;
+    side->input_pos += SHADOW_READ_BYTES;
+    *value = (int32_t)get_le(record + 5, 4);
+    return (int)(int32_t)get_le(record + 1, 4);
+}
+
+int shadow_replay_read_char(void* context) {
+    int32_t unused;
+    return shadow_replay((struct shadow_side*)context, SHADOW_READ_CHAR, &unused);
+}
+
+int shadow_replay_read_int(void* context, int32_t* value) {
+    return shadow_replay((struct shadow_side*)context, SHADOW_READ_INT, value);
+}
+
+void shadow_replay_write(void* context, const char* data, size_t len) {
+    buffer_append(&((struct shadow_side*)context)->output, data, len);
+}
+
+void shadow_follow(struct shadow* shadow, struct vm* vm, int vm_stopped) {
+    struct vm* reference = shadow->reference;
+    enum vm_status status = reference->status;
+    while (status == VM_READY && reference->instret < vm->instret) {
+        status = vm_step(reference);
+    }
+    // A halt or fault retires nothing, so the reference has yet to reach the instruction that stopped the vm
+    if (vm_stopped && status == VM_READY && reference->instret == vm->instret) {
+        vm_step(reference);
+    }
+}
+
+int shadow_agrees(struct vm* vm) {
+    struct shadow* shadow = vm->shadow;
+    struct vm* reference = shadow->reference;
+    struct byte_buffer* output = &shadow->sides[0].output;
+    struct byte_buffer* reference_output = &shadow->sides[1].output;
+    // Running out of a budget is being ready to go on, which is all the stepped reference ever is
+    enum vm_status status = vm->status == VM_BUDGET_EXCEEDED ? VM_READY : vm->status;
+    int agrees = vm->pc == reference->pc && status == reference->status && vm->instret == reference->instret &&
+                 memcmp(vm->reg_bank, reference->reg_bank, sizeof(vm->reg_bank)) == 0 &&
+                 memcmp(vm->memory.data_mem, reference->memory.data_mem, DATA_MEM_SIZE) == 0 &&
+                 memcmp(vm->heap_banks, reference->heap_banks, sizeof(vm->heap_banks)) == 0 &&
+                 output->len == reference_output->len &&
+                 (output->len == 0 || memcmp(output->data, reference_output->data, output->len) == 0) &&
+                 !shadow->sides[0].input_diverged && !shadow->sides[1].input_diverged;
+    if (agrees) {
+        buffer_clear(output);
+        buffer_clear(reference_output);
+    }
+    return agrees;
+}
+
+void shadow_report(struct vm* vm, uint32_t pc, uint64_t instret, FILE* out) {
+    struct shadow* shadow = vm->shadow;
+    struct vm* reference = shadow->reference;
+    fprintf(out, "Shadow divergence after %llu instructions, at 0x%08x", (unsigned long long)instret, pc);
+    const struct symbol* symbol = find_symbol(&vm->symbols, pc);
+    if (symbol) {
+        fprintf(out, " <%s+0x%x>", symbol->name, pc - symbol->address);
+    }
+    if (pc <= INST_MEM_SIZE - INSTRUCT_BYTES) {
+        // Fetched through the reference, which expands a compressed instruction
+        uint32_t saved_pc = reference->pc;
+        reference->pc = pc;
+        union instruction instruct = fetch_instruct(reference);
+        reference->pc = saved_pc;
+        char text[DISASM_LEN];
+        disassemble(reference->isa_extensions, instruct, pc, text, sizeof(text));
+        fprintf(out, ": %s", text);
+    }
+    fprintf(out, "\n");
+
+    enum vm_status status = vm->status == VM_BUDGET_EXCEEDED ? VM_READY : vm->status;
+    if (status != reference->status) {
+        fprintf(out, "  status: reference %s, vm %s\n", vm_status_name(reference->status), vm_status_name(status));
+    }
+    if (vm->instret != reference->instret) {
+        fprintf(out, "  instructions: reference %llu, vm %llu\n", (unsigned long long)reference->instret,
+                (unsigned long long)vm->instret);
+    }
+    if (vm->pc != reference->pc) {
+        fprintf(out, "  pc: reference 0x%08x, vm 0x%08x\n", reference->pc, vm->pc);
+    }
+    for (int i = 0; i < REG_NUM; i++) {
+        if (vm->reg_bank[i] != reference->reg_bank[i]) {
+            fprintf(out, "  %s: reference 0x%08x, vm 0x%08x\n", register_names[i], reference->reg_bank[i],
+                    vm->reg_bank[i]);
+        }
+    }
+
+    // Data memory, then the heap, a word at a time
+    int diffs = 0;
+    for (uint32_t offset = 0; offset < DATA_MEM_SIZE + sizeof(vm->heap_banks); offset += 4) {
+        int in_data = offset < DATA_MEM_SIZE;
+        uint32_t address = in_data ? DATA_MEM_START + offset : HEAP_START + offset - DATA_MEM_SIZE;
+        const unsigned char* word = in_data ? vm->memory.data_mem + offset : vm->heap_banks + offset - DATA_MEM_SIZE;
+        const unsigned char* reference_word = in_data ? reference->memory.data_mem + offset
+                                                      : reference->heap_banks + offset - DATA_MEM_SIZE;
+        if (memcmp(word, reference_word, 4) != 0 && diffs++ < SHADOW_MEMORY_DIFFS) {
+            fprintf(out, "  0x%08x: reference 0x%08x, vm 0x%08x\n", address, (uint32_t)get_le(reference_word, 4),
+                    (uint32_t)get_le(word, 4));
+        }
+    }
+    if (diffs > SHADOW_MEMORY_DIFFS) {
+        fprintf(out, "  ... %d more memory words differ\n", diffs - SHADOW_MEMORY_DIFFS);
+    }
+
+    struct byte_buffer* output = &shadow->sides[0].output;
+    struct byte_buffer* reference_output = &shadow->sides[1].output;
+    size_t same = 0;
+    while (same < output->len && same < reference_output->len && output->data[same] == reference_output->data[same]) {
+        same++;
+    }
+    if (same < output->len || same < reference_output->len) {
+        fprintf(out, "  output: reference %zu bytes, vm %zu bytes, first differing at byte %zu\n",
+                reference_output->len, output->len, same);
+    }
+    if (shadow->sides[1].input_diverged) {
+        fprintf(out, "  console: the reference read differently from the vm\n");
+    }
+    if (shadow->sides[0].input_diverged) {
+        fprintf(out, "  console: the vm read differently than on its first run\n");
+    }
+}
+
+void shadow_locate(struct vm* vm, uint64_t agreed, FILE* out) {
+    struct shadow* shadow = vm->shadow;
+    struct vm* reference = shadow->reference;
+    uint64_t end = vm->instret > reference->instret ? vm->instret : reference->instret;
+    // Both replay the recorded reads now, and nothing is written twice
+    struct vm_console replay = {shadow_replay_read_char, shadow_replay_read_int, shadow_replay_write,
+                                &shadow->sides[0]};
+    vm->console = replay;
+    for (int i = 0; i < 2; i++) {
+        shadow->sides[i].input_pos = 0;
+        shadow->sides[i].input_diverged = 0;
+        buffer_clear(&shadow->sides[i].output);
+    }
+    vm_reset(vm);
+    vm_reset(reference);
+    // Only checked writes reach the reference's memory, so its reset is the one trusted when an engine may
+    // have written around the page tracker
+    memcpy(vm->memory.data_mem, reference->memory.data_mem, DATA_MEM_SIZE);
+    memcpy(vm->heap_banks, reference->heap_banks, sizeof(vm->heap_banks));
+    if (agreed > 0) {
+        vm_run(vm, agreed);
+        shadow_follow(shadow, vm, 0);
+    }
+    buffer_clear(&shadow->sides[0].output);
+    buffer_clear(&shadow->sides[1].output);
+
+    for (;;) {
+        uint32_t pc = vm->pc;
+        uint64_t instret = vm->instret;
+        enum vm_status status = vm_run(vm, 1);
+        shadow_follow(shadow, vm, status != VM_BUDGET_EXCEEDED);
+        if (!shadow_agrees(vm)) {
+            shadow_report(vm, pc, instret, out);
+            return;
+        }
+        if (status != VM_BUDGET_EXCEEDED || vm->instret > end) {
+            fprintf(out, "Shadow divergence after %llu instructions did not happen again on replay, "
+                         "the guest may read the host clock\n", (unsigned long long)agreed);
+            return;
+        }
+    }
+}
+
+enum vm_status shadow_run(struct vm* vm, uint64_t max_instructions) {
+    if (vm->status != VM_READY && vm->status != VM_BUDGET_EXCEEDED) {
+        return vm->status;
+    }
+    struct shadow* shadow = vm->shadow;
+    uint64_t limit = vm->instret + max_instructions;
+    uint64_t agreed = vm->instret;
+    for (;;) {
+        uint64_t slice = shadow->interval;
+        if (max_instructions && limit - vm->instret < slice) {
+            slice = limit - vm->instret;
+        }
+        enum vm_status status = vm_run(vm, slice);
+        shadow_follow(shadow, vm, status != VM_BUDGET_EXCEEDED);
+        if (!shadow_agrees(vm)) {
+            shadow_locate(vm, agreed, stderr);
+            vm->status = VM_DIVERGED;
+            return vm->status;
+        }
+        agreed = vm->instret;
+        if (status != VM_BUDGET_EXCEEDED || (max_instructions && vm->instret >= limit)) {
+            return status;
+        }
+    }
+}
@@ -0,0 +1,148 @@
+#ifndef VM_SHADOW_H
+#define VM_SHADOW_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_riskxvii.h"
+#include "vm_buffer.h"
+
+#define SHADOW_DEFAULT_INTERVAL 1000  // Instructions between comparisons of the vm and its reference
+#define SHADOW_READ_BYTES 9           // A recorded console read: its kind, the result and the integer read
+#define SHADOW_MEMORY_DIFFS 16        // Most differing memory words listed in a divergence report
+
+enum ShadowRead {
+    SHADOW_READ_CHAR = 'c',
+    SHADOW_READ_INT = 'i'
+};  // Which console read a record holds
+
+struct shadow_side {
+    struct shadow* shadow;
+    size_t input_pos;           // Offset of the next recorded read this side replays
+    struct byte_buffer output;  // Console output since the last comparison
+    int input_diverged;         // Set once this side made a read that differs from the recorded one
+};  // The console of one of the two vms compared
+
+struct shadow {
+    struct vm* reference;          // Copy of the vm stepped one instruction at a time with software checks
+    uint64_t interval;             // Instructions between comparisons
+    struct vm_console console;     // The vm's own console, read live and written through
+    struct byte_buffer input;      // Every console read the vm made, replayed to the reference
+    struct shadow_side sides[2];   // The vm, then the reference
+};  // A reference run the vm is checked against, whatever engine the vm runs on
+
+/**
+ * Copy a vm that has not run yet into a reference that shadows it, the reference takes no tools and checks
+ * every access in software. Wraps the vm's console, so it is called once the console is set
+ * @param vm The vm
+ * @param interval Instructions between comparisons, at least 1
+ * @return int 1 if successful, 0 if the reference could not be allocated
+*/
+int shadow_start(struct vm* vm, uint64_t interval);
+
+/**
+ * Free the reference of a vm
+ * @param vm The vm, nothing is done if it is not shadowed
+*/
+void shadow_free(struct vm* vm);
+
+/**
+ * Console read character callback of the vm, reads its own console and records the result
+ * @param context The vm's shadow side
+ * @return int The character, or -1 at the end of input
+*/
+int shadow_live_read_char(void* context);
+
+/**
+ * Console read integer callback of the vm, reads its own console and records the result
+ * @param context The vm's shadow side
+ * @param value Set to the integer read
+ * @return int 1 if an integer was read, otherwise 0
+*/
+int shadow_live_read_int(void* context, int32_t* value);
+
+/**
+ * Console write callback of the vm, writes through to its own console and keeps the output for comparison
+ * @param context The vm's shadow side
+ * @param data The bytes
+ * @param len The number of bytes
+*/
+void shadow_live_write(void* context, const char* data, size_t len);
+
+/**
+ * Take the next recorded read of a side, marking the side diverged if it is of another kind or missing
+ * @param side The side
+ * @param kind The kind of read being made
+ * @param value Set to the integer of an integer read
+ * @return int The recorded result, the end of input once the side diverged
+*/
+int shadow_replay(struct shadow_side* side, enum ShadowRead kind, int32_t* value);
+
+/**
+ * Console read character callback replaying the reads the vm recorded
+ * @param context The shadow side
+ * @return int The character, or -1 at the end of input
+*/
+int shadow_replay_read_char(void* context);
+
+/**
+ * Console read integer callback replaying the reads the vm recorded
+ * @param context The shadow side
+ * @param value Set to the integer read
+ * @return int 1 if an integer was read, otherwise 0
+*/
+int shadow_replay_read_int(void* context, int32_t* value);
+
+/**
+ * Console write callback that only keeps the output for comparison
+ * @param context The shadow side
+ * @param data The bytes
+ * @param len The number of bytes
+*/
+void shadow_replay_write(void* context, const char* data, size_t len);
+
+/**
+ * Step the reference until it has retired as many instructions as the vm or it stops. If the vm stopped,
+ * the reference is stepped once more, into the instruction that stopped the vm
+ * @param shadow The shadow
+ * @param vm The vm
+ * @param vm_stopped 1 if the vm stopped rather than ran out of its budget
+*/
+void shadow_follow(struct shadow* shadow, struct vm* vm, int vm_stopped);
+
+/**
+ * Compare the vm with its reference: pc, registers, retired instructions, status, data memory, heap,
+ * console output and console reads. Output equal on both sides is dropped
+ * @param vm The vm
+ * @return int 1 if they agree, otherwise 0
+*/
+int shadow_agrees(struct vm* vm);
+
+/**
+ * Write how the vm and its reference differ
+ * @param vm The vm
+ * @param pc The address of the instruction they went apart on
+ * @param instret Instructions retired before it
+ * @param out Where the report is written
+*/
+void shadow_report(struct vm* vm, uint32_t pc, uint64_t instret, FILE* out);
+
+/**
+ * Run the vm and its reference again from the start on the recorded input, up to a point where they
+ * agreed, then one instruction at a time until they differ, and report that instruction
+ * @param vm The vm
+ * @param agreed Retired instructions when they last agreed
+ * @param out Where the report is written
+*/
+void shadow_locate(struct vm* vm, uint64_t agreed, FILE* out);
+
+/**
+ * Run a shadowed vm in slices of the comparison interval, checking it against its reference after each
+ * @param vm The vm
+ * @param max_instructions The instruction budget, 0 for no limit
+ * @return enum vm_status Why the vm stopped, VM_DIVERGED once the report has been written to stderr
+*/
+enum vm_status shadow_run(struct vm* vm, uint64_t max_instructions);
+
+#endif
@@ -0,0 +1,226 @@
+#include "vm_simd.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#else
+#define SIMD_X86 0
+#endif
+
+uint32_t packed_lanes(uint32_t a, uint32_t b, enum PackedOperation operation, int lane_bits) {
+    uint32_t mask = (lane_bits == 8) ? 0xFF : 0xFFFF;
+    uint32_t sign = 1u << (lane_bits - 1);
+    uint32_t result = 0;
+    for (int shift = 0; shift < PACKED_BITS; shift += lane_bits) {
+        uint32_t x = (a >> shift) & mask;
+        uint32_t y = (b >> shift) & mask;
+        // Flipping the sign bit orders signed lanes as unsigned ones
+        uint32_t sx = x ^ sign;
+        uint32_t sy = y ^ sign;
+        uint32_t lane;
+        switch (operation) {
+            case PACKED_ADD:
+                lane = x + y;
+                break;
+            case PACKED_SUB:
+                lane = x - y;
+                break;
+            case PACKED_SMIN:
+                lane = sx < sy ? x : y;
+                break;
+            case PACKED_SMAX:
+                lane = sx > sy ? x : y;
+                break;
+            case PACKED_UMIN:
+                lane = x < y ? x : y;
+                break;
+            default:
+                lane = x > y ? x : y;
+                break;
+        }
+        result |= (lane & mask) << shift;
+    }
+    return result;
+}
+
+uint32_t packed_operation(uint32_t a, uint32_t b, enum PackedOperation operation, int lane_bits) {
+#if SIMD_X86
+    __m128i x = _mm_cvtsi32_si128((int)a);
+    __m128i y = _mm_cvtsi32_si128((int)b);
+    __m128i r;
+    if (lane_bits == 8) {
+        // SSE2 only compares bytes unsigned, signed bytes are biased into that order and back
+        __m128i bias = _mm_set1_epi8((char)0x80);
+        switch (operation) {
+            case PACKED_ADD:
+                r = _mm_add_epi8(x, y);
+                break;
+            case PACKED_SUB:
+                r = _mm_sub_epi8(x, y);
+                break;
+            case PACKED_SMIN:
+                r = _mm_xor_si128(_mm_min_epu8(_mm_xor_si128(x, bias), _mm_xor_si128(y, bias)), bias);
+                break;
+            case PACKED_SMAX:
+                r = _mm_xor_si128(_mm_max_epu8(_mm_xor_si128(x, bias), _mm_xor_si128(y, bias)), bias);
+                break;
+            case PACKED_UMIN:
+                r = _mm_min_epu8(x, y);
+                break;
+            default:
+                r = _mm_max_epu8(x, y);
+                break;
+        }
+    } else {
+        // And halves only signed, the other way round
+        __m128i bias = _mm_set1_epi16((short)0x8000);
+        switch (operation) {
+            case PACKED_ADD:
+                r = _mm_add_epi16(x, y);
+                break;
+            case PACKED_SUB:
+                r = _mm_sub_epi16(x, y);
+                break;
+            case PACKED_SMIN:
+                r = _mm_min_epi16(x, y);
+                break;
+            case PACKED_SMAX:
+                r = _mm_max_epi16(x, y);
+                break;
+            case PACKED_UMIN:
+                r = _mm_xor_si128(_mm_min_epi16(_mm_xor_si128(x, bias), _mm_xor_si128(y, bias)), bias);
+                break;
+            default:
+                r = _mm_xor_si128(_mm_max_epi16(_mm_xor_si128(x, bias), _mm_xor_si128(y, bias)), bias);
+                break;
+        }
+    }
+    return (uint32_t)_mm_cvtsi128_si32(r);
+#else
+    return packed_lanes(a, b, operation, lane_bits);
+#endif
+}
+
+void vector_words_scalar(enum VectorOperation operation, unsigned char* destination, const unsigned char* a,
+                         const unsigned char* b, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        // Host words are little endian like the guest's
+        uint32_t x;
+        uint32_t y;
+        memcpy(&x, a + i * 4, 4);
+        memcpy(&y, b + i * 4, 4);
+        uint32_t result = operation == VECTOR_ADD ? x + y : x - y;
+        memcpy(destination + i * 4, &result, 4);
+    }
+}
+
+void vector_words_sse2(enum VectorOperation operation, unsigned char* destination, const unsigned char* a,
+                       const unsigned char* b, uint32_t n) {
+    uint32_t i = 0;
+#if SIMD_X86
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i * 4));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i * 4));
+        __m128i r = operation == VECTOR_ADD ? _mm_add_epi32(x, y) : _mm_sub_epi32(x, y);
+        _mm_storeu_si128((__m128i*)(destination + i * 4), r);
+    }
+#endif
+    vector_words_scalar(operation, destination + i * 4, a + i * 4, b + i * 4, n - i);
+}
+
+#if SIMD_X86
+__attribute__((target("avx2")))
+#endif
+void vector_words_avx2(enum VectorOperation operation, unsigned char* destination, const unsigned char* a,
+                       const unsigned char* b, uint32_t n) {
+    uint32_t i = 0;
+#if SIMD_X86
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i * 4));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i * 4));
+        __m256i r = operation == VECTOR_ADD ? _mm256_add_epi32(x, y) : _mm256_sub_epi32(x, y);
+        _mm256_storeu_si256((__m256i*)(destination + i * 4), r);
+    }
+#endif
+    vector_words_sse2(operation, destination + i * 4, a + i * 4, b + i * 4, n - i);
+}
+
+void vector_words(enum VectorOperation operation, unsigned char* destination, const unsigned char* a,
+                  const unsigned char* b, uint32_t n) {
+    // A kernel reads a block of elements before writing it, which a destination just ahead of a source would
+    // see as the old values
+    uintptr_t to = (uintptr_t)destination;
+    uintptr_t len = (uintptr_t)n * 4;
+    if ((to > (uintptr_t)a && to < (uintptr_t)a + len) || (to > (uintptr_t)b && to < (uintptr_t)b + len)) {
+        vector_words_scalar(operation, destination, a, b, n);
+    } else if (host_has_avx2()) {
+        vector_words_avx2(operation, destination, a, b, n);
+    } else {
+        vector_words_sse2(operation, destination, a, b, n);
+    }
+}
+
+uint32_t vector_dot_scalar(const unsigned char* a, const unsigned char* b, uint32_t n) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t x;
+        uint32_t y;
+        memcpy(&x, a + i * 4, 4);
+        memcpy(&y, b + i * 4, 4);
+        sum += x * y;
+    }
+    return sum;
+}
+
+uint32_t vector_dot_sse2(const unsigned char* a, const unsigned char* b, uint32_t n) {
+    uint32_t i = 0;
+    uint32_t sum = 0;
+#if SIMD_X86
+    // 64-bit products and sums, whose low halves are the wrapped 32-bit results
+    __m128i sums = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i * 4));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i * 4));
+        sums = _mm_add_epi64(sums, _mm_mul_epu32(x, y));
+        sums = _mm_add_epi64(sums, _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32)));
+    }
+    sum = (uint32_t)_mm_cvtsi128_si32(sums) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#endif
+    return sum + vector_dot_scalar(a + i * 4, b + i * 4, n - i);
+}
+
+#if SIMD_X86
+__attribute__((target("avx2")))
+#endif
+uint32_t vector_dot_avx2(const unsigned char* a, const unsigned char* b, uint32_t n) {
+    uint32_t i = 0;
+    uint32_t sum = 0;
+#if SIMD_X86
+    __m256i sums = _mm256_setzero_si256();
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i * 4));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i * 4));
+        sums = _mm256_add_epi32(sums, _mm256_mullo_epi32(x, y));
+    }
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, sums);
+    for (int lane = 0; lane < 8; lane++) {
+        sum += lanes[lane];
+    }
+#endif
+    return sum + vector_dot_sse2(a + i * 4, b + i * 4, n - i);
+}
+
+uint32_t vector_dot(const unsigned char* a, const unsigned char* b, uint32_t n) {
+    if (host_has_avx2()) {
+        return vector_dot_avx2(a, b, n);
+    }
+    return vector_dot_sse2(a, b, n);
+}
+
+int host_has_avx2(void) {
+#if SIMD_X86
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return 0;
+#endif
+}
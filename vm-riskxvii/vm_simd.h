@@ -0,0 +1,130 @@
+#ifndef VM_SIMD_H
+#define VM_SIMD_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PACKED_BITS 32  // Width of the register the packed instructions split into lanes
+
+enum PackedOperation {
+    PACKED_ADD,
+    PACKED_SUB,
+    PACKED_SMIN,
+    PACKED_SMAX,
+    PACKED_UMIN,
+    PACKED_UMAX
+};  // Lane by lane operations of the packed instructions, in func3 order
+
+enum VectorOperation {
+    VECTOR_ADD,
+    VECTOR_SUB
+};  // Element by element operations of the vector instructions over memory
+
+/**
+ * Apply an operation to each 8 or 16-bit lane of two registers, lanes wrap around without saturating
+ * @param a The first register
+ * @param b The second register
+ * @param operation The operation
+ * @param lane_bits 8 or 16
+ * @return uint32_t The packed lanes
+*/
+uint32_t packed_operation(uint32_t a, uint32_t b, enum PackedOperation operation, int lane_bits);
+
+/**
+ * Apply an operation to the lanes one at a time, for hosts without SSE2
+ * @param a The first register
+ * @param b The second register
+ * @param operation The operation
+ * @param lane_bits 8 or 16
+ * @return uint32_t The packed lanes
+*/
+uint32_t packed_lanes(uint32_t a, uint32_t b, enum PackedOperation operation, int lane_bits);
+
+/**
+ * Add or subtract two arrays of little endian 32-bit words into a third, in element order:
+ * a destination that overlaps a source ahead of it sees the elements already written
+ * @param operation The operation
+ * @param destination Host address of the result
+ * @param a Host address of the first operand
+ * @param b Host address of the second operand
+ * @param n The number of words
+*/
+void vector_words(enum VectorOperation operation, unsigned char* destination, const unsigned char* a,
+                  const unsigned char* b, uint32_t n);
+
+/**
+ * vector_words one word at a time, the order every other kernel must match
+ * @param operation The operation
+ * @param destination Host address of the result
+ * @param a Host address of the first operand
+ * @param b Host address of the second operand
+ * @param n The number of words
+*/
+void vector_words_scalar(enum VectorOperation operation, unsigned char* destination, const unsigned char* a,
+                         const unsigned char* b, uint32_t n);
+
+/**
+ * vector_words with 128-bit SSE2 registers, 4 words at a time
+ * @param operation The operation
+ * @param destination Host address of the result
+ * @param a Host address of the first operand
+ * @param b Host address of the second operand
+ * @param n The number of words
+*/
+void vector_words_sse2(enum VectorOperation operation, unsigned char* destination, const unsigned char* a,
+                       const unsigned char* b, uint32_t n);
+
+/**
+ * vector_words with 256-bit AVX2 registers, 8 words at a time, only called if the host supports AVX2
+ * @param operation The operation
+ * @param destination Host address of the result
+ * @param a Host address of the first operand
+ * @param b Host address of the second operand
+ * @param n The number of words
+*/
+void vector_words_avx2(enum VectorOperation operation, unsigned char* destination, const unsigned char* a,
+                       const unsigned char* b, uint32_t n);
+
+/**
+ * Dot product of two arrays of little endian 32-bit words, modulo 2^32 like a mul and add loop
+ * @param a Host address of the first array
+ * @param b Host address of the second array
+ * @param n The number of words
+ * @return uint32_t The low 32 bits of the sum of the products
+*/
+uint32_t vector_dot(const unsigned char* a, const unsigned char* b, uint32_t n);
+
+/**
+ * vector_dot one word at a time
+ * @param a Host address of the first array
+ * @param b Host address of the second array
+ * @param n The number of words
+ * @return uint32_t The low 32 bits of the sum of the products
+*/
+uint32_t vector_dot_scalar(const unsigned char* a, const unsigned char* b, uint32_t n);
+
+/**
+ * vector_dot with SSE2, which only multiplies the even lanes, so odd lanes are shifted down and multiplied apart
+ * @param a Host address of the first array
+ * @param b Host address of the second array
+ * @param n The number of words
+ * @return uint32_t The low 32 bits of the sum of the products
+*/
+uint32_t vector_dot_sse2(const unsigned char* a, const unsigned char* b, uint32_t n);
+
+/**
+ * vector_dot with AVX2 low 32-bit multiplies, only called if the host supports AVX2
+ * @param a Host address of the first array
+ * @param b Host address of the second array
+ * @param n The number of words
+ * @return uint32_t The low 32 bits of the sum of the products
+*/
+uint32_t vector_dot_avx2(const unsigned char* a, const unsigned char* b, uint32_t n);
+
+/**
+ * Check whether the host can run the AVX2 kernels
+ * @return int 1 if it can, otherwise 0
+*/
+int host_has_avx2(void);
+
+#endif
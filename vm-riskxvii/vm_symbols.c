@@ -0,0 +1,87 @@
+#include "vm_symbols.h"
+
+void add_symbol(struct symbol_table* table, uint32_t address, const char* name) {
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 64;
+        table->symbols = (struct symbol*)realloc(table->symbols, table->capacity * sizeof(struct symbol));
+    }
+    size_t len = strlen(name);
+    char* copy = (char*)malloc(len + 1);
+    memcpy(copy, name, len + 1);
+    table->symbols[table->count].address = address;
+    table->symbols[table->count].name = copy;
+    table->count++;
+}
+
+int compare_symbols(const void* lhs, const void* rhs) {
+    const struct symbol* a = (const struct symbol*)lhs;
+    const struct symbol* b = (const struct symbol*)rhs;
+    if (a->address != b->address) {
+        return (a->address < b->address) ? -1 : 1;
+    }
+    return strcmp(a->name, b->name);
+}
+
+void sort_symbols(struct symbol_table* table) {
+    if (table->count > 0) {
+        qsort(table->symbols, table->count, sizeof(struct symbol), compare_symbols);
+    }
+}
+
+int load_symbols(const char* filename, struct symbol_table* table) {
+    FILE* fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    char line[SYMBOL_LINE_LEN];
+    char name[SYMBOL_LINE_LEN];
+    char type[SYMBOL_LINE_LEN];
+    unsigned int address;
+    while (fgets(line, sizeof(line), fp)) {
+        int fields;
+        if (sscanf(line, "%x <%[^>]>:", &address, name) == 2) {
+            // objdump listing label, e.g. "00000010 <main>:"
+            add_symbol(table, address, name);
+        } else if ((fields = sscanf(line, "%x %s %s", &address, type, name)) == 3 && strlen(type) == 1) {
+            // nm output, a one letter type before the name, only code symbols name guest functions
+            if (type[0] == 'T' || type[0] == 't' || type[0] == 'W' || type[0] == 'w') {
+                add_symbol(table, address, name);
+            }
+        } else if (fields >= 2) {
+            // Plain "address name" pair, the name is the second field
+            add_symbol(table, address, type);
+        }
+    }
+    fclose(fp);
+
+    sort_symbols(table);
+    return 1;
+}
+
+const struct symbol* find_symbol(const struct symbol_table* table, uint32_t address) {
+    // Binary search for the last symbol at or below the address
+    int low = 0;
+    int high = table->count - 1;
+    const struct symbol* found = NULL;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (table->symbols[mid].address <= address) {
+            found = &table->symbols[mid];
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+void free_symbols(struct symbol_table* table) {
+    for (int i = 0; i < table->count; i++) {
+        free(table->symbols[i].name);
+    }
+    free(table->symbols);
+    table->symbols = NULL;
+    table->count = 0;
+    table->capacity = 0;
+}
@@ -0,0 +1,67 @@
+#ifndef VM_SYMBOLS_H
+#define VM_SYMBOLS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYMBOL_LINE_LEN 512
+
+struct symbol {
+    uint32_t address;
+    char* name;
+};  // A named guest address
+
+struct symbol_table {
+    struct symbol* symbols;  // Sorted by address
+    int count;
+    int capacity;
+};  // The guest symbols used for profiles and fault reports
+
+/**
+ * Add a symbol to the table, the table is sorted again by sort_symbols
+ * @param table The symbol table
+ * @param address The symbol address
+ * @param name The symbol name, copied into the table
+*/
+void add_symbol(struct symbol_table* table, uint32_t address, const char* name);
+
+/**
+ * Order symbols by address, then by name so the result does not depend on the input order
+ * @param lhs The first symbol
+ * @param rhs The second symbol
+ * @return int Negative, zero or positive as for qsort
+*/
+int compare_symbols(const void* lhs, const void* rhs);
+
+/**
+ * Sort the symbols by address so they can be searched
+ * @param table The symbol table
+*/
+void sort_symbols(struct symbol_table* table);
+
+/**
+ * Load symbols from a map file, either nm output (address type name), plain address name pairs,
+ * or an objdump listing (.lst) with "address <name>:" labels
+ * @param filename The symbol file
+ * @param table The symbol table to fill
+ * @return int 1 if successful, otherwise 0
+*/
+int load_symbols(const char* filename, struct symbol_table* table);
+
+/**
+ * Find the symbol an address belongs to, the closest one at or below it
+ * @param table The symbol table
+ * @param address The guest address
+ * @return const struct symbol* The symbol, or NULL if no symbol is at or below the address
+*/
+const struct symbol* find_symbol(const struct symbol_table* table, uint32_t address);
+
+/**
+ * Free the symbols in the table
+ * @param table The symbol table
+*/
+void free_symbols(struct symbol_table* table);
+
+#endif